@@ -0,0 +1,195 @@
+#include <benchmark/benchmark.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bytecode.h"
+#ifdef DMM_HAVE_LLVM
+#include "codegen.h"
+#endif
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "tensor.h"
+
+// A small hot function: a few elementwise operations, a transpose and a
+// nested call, so that dispatch and call overhead show for small
+// tensors and the kernels dominate for large ones.
+static const char* HotSource = R"(
+def scale(a, factor) {
+  a * factor;
+}
+def step(a, b) {
+  var c = a * b + a;
+  c = transpose(c) - 1;
+  var d = 7;
+  scale(c, 0.5) + b % 3 - d;
+}
+)";
+
+static std::vector<Tensor> makeArgs(size_t side) {
+  std::vector<double> values(side * side);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = (double)(i % 13);
+  }
+  return {Tensor::fromValues({side, side}, values), Tensor::fromValues({side, side}, values)};
+}
+
+// Calls step on side x side matrices by walking the AST.
+static void BM_CallAST(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(HotSource));
+  std::stringstream out;
+  Interpreter interp(module, out);
+  std::vector<Tensor> args = makeArgs((size_t)state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(interp.call(Symbol("step"), args));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_CallAST)->ArgName("side")->Arg(1)->Arg(8)->Arg(256);
+
+// The same calls through the register bytecode VM.
+static void BM_CallBytecode(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(HotSource));
+  BytecodeModule program = BytecodeModule::compile(module);
+  std::stringstream out;
+  BytecodeVM vm(program, out);
+  std::vector<Tensor> args = makeArgs((size_t)state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(vm.call(Symbol("step"), args));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_CallBytecode)->ArgName("side")->Arg(1)->Arg(8)->Arg(256);
+
+#ifdef DMM_HAVE_LLVM
+// The same calls as native code; the first call, outside the timed loop,
+// compiles the specialization.
+static void BM_CallNative(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(HotSource));
+  std::stringstream out;
+  NativeEngine engine(module, out);
+  std::vector<Tensor> args = makeArgs((size_t)state.range(0));
+  engine.call(Symbol("step"), args);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.call(Symbol("step"), args));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_CallNative)->ArgName("side")->Arg(1)->Arg(8)->Arg(256);
+#endif
+
+// Elementwise trees over large tensors, where each unfused operator writes
+// and rereads a whole temporary.
+static const char* ElementwiseSource = R"(
+def chain(a, b, c, d) {
+  a + b * c - d;
+}
+def crossed(a, b, c, d) {
+  transpose(a) * transpose(b) + c / d;
+}
+)";
+
+static std::vector<Tensor> makeElementwiseArgs(size_t side) {
+  std::vector<Tensor> args = makeArgs(side);
+  std::vector<Tensor> more = makeArgs(side);
+  args.insert(args.end(), more.begin(), more.end());
+  return args;
+}
+
+static Fusion fusionArg(const benchmark::State& state) {
+  return state.range(1) ? Fusion::Enabled : Fusion::Disabled;
+}
+
+// Runs chain and crossed on side x side matrices, with fusion off and on.
+static void BM_ElementwiseAST(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(ElementwiseSource));
+  std::stringstream out;
+  Interpreter interp(module, out, fusionArg(state));
+  std::vector<Tensor> args = makeElementwiseArgs((size_t)state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(interp.call(Symbol("chain"), args));
+    benchmark::DoNotOptimize(interp.call(Symbol("crossed"), args));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * 2);
+}
+BENCHMARK(BM_ElementwiseAST)->ArgNames({"side", "fused"})->ArgsProduct({{256, 1024}, {0, 1}});
+
+static void BM_ElementwiseBytecode(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(ElementwiseSource));
+  BytecodeModule program = BytecodeModule::compile(module, fusionArg(state));
+  std::stringstream out;
+  BytecodeVM vm(program, out);
+  std::vector<Tensor> args = makeElementwiseArgs((size_t)state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(vm.call(Symbol("chain"), args));
+    benchmark::DoNotOptimize(vm.call(Symbol("crossed"), args));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * 2);
+}
+BENCHMARK(BM_ElementwiseBytecode)->ArgNames({"side", "fused"})->ArgsProduct({{256, 1024}, {0, 1}});
+
+#ifdef DMM_HAVE_LLVM
+static void BM_ElementwiseNative(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(ElementwiseSource));
+  std::stringstream out;
+  NativeEngine engine(module, out, fusionArg(state));
+  std::vector<Tensor> args = makeElementwiseArgs((size_t)state.range(0));
+  engine.call(Symbol("chain"), args);
+  engine.call(Symbol("crossed"), args);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.call(Symbol("chain"), args));
+    benchmark::DoNotOptimize(engine.call(Symbol("crossed"), args));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * 2);
+}
+BENCHMARK(BM_ElementwiseNative)->ArgNames({"side", "fused"})->ArgsProduct({{256, 1024}, {0, 1}});
+#endif
+
+static std::string makeCallChainSource(size_t calls) {
+  std::string source = "def inc(a) {\n  a + 1;\n}\ndef main() {\n  var x = 0;\n";
+  for (size_t i = 0; i < calls; i++) {
+    source += "  x = inc(x) * 1;\n";
+  }
+  source += "  x;\n}\n";
+  return source;
+}
+
+// Runs a main made of many scalar calls, where evaluation is all overhead.
+static void BM_CallChainAST(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(makeCallChainSource((size_t)state.range(0))));
+  std::stringstream out;
+  Interpreter interp(module, out);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(interp.call(Symbol("main"), {}));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CallChainAST)->ArgName("calls")->Arg(10000);
+
+static void BM_CallChainBytecode(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(makeCallChainSource((size_t)state.range(0))));
+  BytecodeModule program = BytecodeModule::compile(module);
+  std::stringstream out;
+  BytecodeVM vm(program, out);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(vm.call(Symbol("main"), {}));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CallChainBytecode)->ArgName("calls")->Arg(10000);
+
+#ifdef DMM_HAVE_LLVM
+static void BM_CallChainNative(benchmark::State& state) {
+  Module module = Parser::parse(Scanner::scan(makeCallChainSource((size_t)state.range(0))));
+  std::stringstream out;
+  NativeEngine engine(module, out);
+  engine.call(Symbol("main"), {});
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.call(Symbol("main"), {}));
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CallChainNative)->ArgName("calls")->Arg(10000);
+#endif
+
+BENCHMARK_MAIN();
@@ -0,0 +1,127 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include "incremental_parser.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+
+static std::string makeLargeLiteralSource(size_t elements) {
+  std::string source = "def main() {\n  var weights = [";
+  for (size_t i = 0; i < elements; i++) {
+    source += (i == 0) ? "" : ", ";
+    source += std::to_string(i % 97) + "." + std::to_string(i % 7);
+  }
+  source += "];\n  print(weights * 2 + weights);\n}\n";
+  return source;
+}
+
+// Parses a large literal tensor and tears the resulting tree down again.
+// alloc:0 allocates nodes in the module arena, alloc:1 on the heap.
+static void BM_ParseAndTeardown(benchmark::State& state) {
+  NodeAllocation allocation = (NodeAllocation)state.range(0);
+  std::string source = makeLargeLiteralSource((size_t)state.range(1));
+  std::vector<LexToken> tokens = Scanner::scan(source);
+  for (auto _ : state) {
+    Module module = Parser::parse(tokens, allocation);
+    benchmark::DoNotOptimize(module.size());
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * state.range(1));
+}
+BENCHMARK(BM_ParseAndTeardown)
+  ->ArgNames({"alloc", "elements"})
+  ->Args({(int)NodeAllocation::Arena, 100000})
+  ->Args({(int)NodeAllocation::Heap, 100000});
+
+static std::string makeExpressionSource(size_t functions, size_t terms) {
+  static const char* ops[] = {" + ", " * ", " - ", " / "};
+  std::string source;
+  for (size_t i = 0; i < functions; i++) {
+    source += "def f" + std::to_string(i) + "(a, b) {\n  r = a";
+    for (size_t j = 1; j < terms; j++) {
+      source += ops[j % 4];
+      source += (j % 3 == 0) ? "(a - b)" : (j % 3 == 1) ? "b" : std::to_string(j);
+    }
+    source += ";\n}\n";
+  }
+  return source;
+}
+
+// Parses functions made of one long mixed-precedence expression each.
+static void BM_ParseExpressionChain(benchmark::State& state) {
+  size_t terms = (size_t)state.range(0);
+  std::string source = makeExpressionSource(100000 / terms, terms);
+  std::vector<LexToken> tokens = Scanner::scan(source);
+  for (auto _ : state) {
+    Module module = Parser::parse(tokens);
+    benchmark::DoNotOptimize(module.size());
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * (int64_t)tokens.size());
+}
+BENCHMARK(BM_ParseExpressionChain)
+  ->ArgName("terms")
+  ->Arg(8)
+  ->Arg(1000)
+  ->Arg(100000)
+  ->Unit(benchmark::kMillisecond);
+
+static std::string makeManyFunctionsSource(size_t functions) {
+  std::string source;
+  for (size_t i = 0; i < functions; i++) {
+    source += "def f" + std::to_string(i) + "(a, b) {\n";
+    source += "  var x<2, 2> = [[1, 2], [3, " + std::to_string(i) + "]];\n";
+    source += "  var y = [a, b, [x, x]];\n  print(transpose(x) * a);\n}\n";
+  }
+  return source;
+}
+
+// Parses thousands of independent definitions on the given number of threads.
+static void BM_ParseParallel(benchmark::State& state) {
+  SourceFile source("bench.d--", makeManyFunctionsSource(20000));
+  std::vector<Token> tokens = Scanner::scan(source);
+  for (auto _ : state) {
+    Module module = Parser::parseParallel(source, tokens, (unsigned)state.range(0));
+    benchmark::DoNotOptimize(module.size());
+  }
+  state.SetItemsProcessed((int64_t)state.iterations() * 20000);
+}
+BENCHMARK(BM_ParseParallel)
+  ->ArgName("threads")
+  ->RangeMultiplier(2)
+  ->Range(1, 16)
+  ->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
+
+// One keystroke in the middle of a 50k-line file: a full scan and parse
+// against an incremental update of the edited definition.
+static std::string editMiddleFunction(const std::string& source, size_t iteration) {
+  std::string edited = source;
+  size_t pos = edited.find("[3, ", edited.size() / 2) + 4;
+  edited[pos] = (char)('0' + iteration % 10);
+  return edited;
+}
+
+static void BM_EditFullReparse(benchmark::State& state) {
+  std::string source = makeManyFunctionsSource(10000);
+  size_t iteration = 0;
+  for (auto _ : state) {
+    std::string edited = editMiddleFunction(source, iteration++);
+    Module module = Parser::parse(Scanner::scan(edited));
+    benchmark::DoNotOptimize(module.size());
+  }
+}
+BENCHMARK(BM_EditFullReparse)->Unit(benchmark::kMicrosecond);
+
+static void BM_EditIncremental(benchmark::State& state) {
+  std::string source = makeManyFunctionsSource(10000);
+  IncrementalParser incremental;
+  incremental.update(source);
+  size_t iteration = 0;
+  for (auto _ : state) {
+    incremental.update(editMiddleFunction(source, iteration++));
+    benchmark::DoNotOptimize(incremental.getNumReparsed());
+  }
+}
+BENCHMARK(BM_EditIncremental)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
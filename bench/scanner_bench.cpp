@@ -0,0 +1,63 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include "char_scan.h"
+#include "lexer.h"
+#include "source_file.h"
+
+// Mimics generated sources: deeply indented, mostly comments, with a
+// statement every few lines.
+static std::string makeCommentHeavySource(size_t functions) {
+  std::string source;
+  for (size_t i = 0; i < functions; i++) {
+    source += "# Generated function " + std::to_string(i) + "\n";
+    source += "def f" + std::to_string(i) + "(a, b) {\n";
+    for (size_t j = 0; j < 8; j++) {
+      source += "        # The following statement was generated from layer ";
+      source += std::to_string(j) + " of the model description and must not be edited.\n";
+      source += "        \t# Shape is inferred from the operands.\n";
+      source += "        var t" + std::to_string(j) + " = a * b + " + std::to_string(j) + ";\n";
+    }
+    source += "};\n\n";
+  }
+  return source;
+}
+
+static void BM_ScanCommentHeavy(benchmark::State& state) {
+  CharScanImpl impl = (CharScanImpl)state.range(0);
+  if (!isCharScanImplSupported(impl)) {
+    state.SkipWithError("unsupported on this CPU");
+    return;
+  }
+  CharScanImpl previous = getCharScanImpl();
+  setCharScanImpl(impl);
+  SourceFile source("bench.d--", makeCommentHeavySource(4096));
+  for (auto _ : state) {
+    std::vector<Token> tokens = Scanner::scan(source);
+    benchmark::DoNotOptimize(tokens.data());
+  }
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)source.getText().length());
+  setCharScanImpl(previous);
+}
+BENCHMARK(BM_ScanCommentHeavy)
+  ->ArgName("impl")
+  ->Arg((int)CharScanImpl::Scalar)
+  ->Arg((int)CharScanImpl::SSE2)
+  ->Arg((int)CharScanImpl::AVX2);
+
+// Scans a large comment-heavy file split across the given number of threads.
+static void BM_ScanParallel(benchmark::State& state) {
+  SourceFile source("bench.d--", makeCommentHeavySource(32768));
+  for (auto _ : state) {
+    std::vector<Token> tokens = Scanner::scanParallel(source, (unsigned)state.range(0));
+    benchmark::DoNotOptimize(tokens.data());
+  }
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)source.getText().length());
+}
+BENCHMARK(BM_ScanParallel)
+  ->ArgName("threads")
+  ->RangeMultiplier(2)
+  ->Range(1, 16)
+  ->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
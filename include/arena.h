@@ -0,0 +1,31 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator that releases everything it handed out at once when it is
+// destroyed. Individual allocations are never freed.
+class Arena {
+  static constexpr size_t InitialBlockSize = size_t(1) << 16;
+  static constexpr size_t MaxBlockSize = size_t(1) << 24;
+
+  std::vector<std::unique_ptr<char[]>> Blocks;
+  char* BlockPos = nullptr;
+  size_t BlockLeft = 0;
+  size_t NextBlockSize = InitialBlockSize;
+  size_t BytesAllocated = 0;
+  void newBlock(size_t);
+
+public:
+  void* allocate(size_t, size_t);
+  size_t getBytesAllocated() const;
+  Arena() = default;
+  Arena(Arena&&) = default;
+  Arena& operator=(Arena&&) = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+};
+
+#endif
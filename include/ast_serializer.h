@@ -0,0 +1,49 @@
+#ifndef AST_SERIALIZER_H_
+#define AST_SERIALIZER_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "parser.h"
+
+// Binary form of a Module's definitions. The file is a fixed header followed
+// by flat, fixed-width sections read in place from a mapping:
+//   - the number values of the module, including packed tensor literal data;
+//   - the nodes, in breadth-first order, each naming its children by their
+//     distance forward in the node array;
+//   - the child links, the top-level definitions, the string table and the
+//     shape dimensions.
+// Names are stored once and interned once per load rather than per use.
+// Files are tied to FormatVersion and the byte order they were written with.
+class ASTSerializer {
+public:
+  static constexpr uint32_t FormatVersion = 1;
+  // The content hash and size identify the source the module was parsed from
+  // and are returned again by readContentKey.
+  static std::string serialize(const Module&, uint64_t = 0, uint64_t = 0);
+  // Rebuilds the module; throws std::runtime_error if the data is not a
+  // valid serialized module of this version.
+  static Module deserialize(std::string_view, NodeAllocation = NodeAllocation::Arena);
+  // Reads the content hash and size from the header, if the data is
+  // recognizably a serialized module of this version.
+  static std::optional<std::pair<uint64_t, uint64_t>> readContentKey(std::string_view);
+};
+
+// Serialized modules on disk, keyed by a hash of the source text, so that an
+// unchanged file is loaded without being lexed or parsed.
+class ModuleCache {
+  std::string Dir;
+  std::string getPath(uint64_t) const;
+
+public:
+  // The module cached for this source text, if any. Missing, stale or
+  // corrupt entries are misses.
+  std::optional<Module> load(std::string_view, NodeAllocation = NodeAllocation::Arena) const;
+  // Caches the module parsed from the text. Modules with errors are not
+  // cached. Throws std::runtime_error if the entry cannot be written.
+  void store(std::string_view, const Module&) const;
+  ModuleCache(std::string);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef AST_VISITOR_H_
+#define AST_VISITOR_H_
+
+#include <type_traits>
+#include "casting.h"
+#include "parser.h"
+
+// CRTP visitor over the AST. visit() switches on the node's kind and calls
+// the matching visitXxx method of Derived directly, so there is no virtual
+// call or RTTI per node. Unhandled node types fall back through their base
+// classes (visitExprNode, visitStmtNode, visitNode).
+template<typename Derived, typename RetTy, bool IsConst>
+class ASTVisitorBase {
+protected:
+  template<typename T>
+  using Ref = std::conditional_t<IsConst, const T&, T&>;
+
+  Derived& derived() { return static_cast<Derived&>(*this); }
+
+public:
+  RetTy visit(Ref<Node> node) {
+    switch (node.getKind()) {
+    case NodeKind::NumberExpr:
+      return derived().visitNumberExprNode(cast<NumberExprNode>(node));
+    case NodeKind::VariableExpr:
+      return derived().visitVariableExprNode(cast<VariableExprNode>(node));
+    case NodeKind::BinaryExpr:
+      return derived().visitBinaryExprNode(cast<BinaryExprNode>(node));
+    case NodeKind::ArrayExpr:
+      return derived().visitArrayExprNode(cast<ArrayExprNode>(node));
+    case NodeKind::ConstantTensorExpr:
+      return derived().visitConstantTensorNode(cast<ConstantTensorNode>(node));
+    case NodeKind::Assgn:
+      return derived().visitAssgnNode(cast<AssgnNode>(node));
+    case NodeKind::Prototype:
+      return derived().visitPrototypeNode(cast<PrototypeNode>(node));
+    case NodeKind::Function:
+      return derived().visitFunctionNode(cast<FunctionNode>(node));
+    }
+    return derived().visitNode(node);
+  }
+
+  RetTy visitNumberExprNode(Ref<NumberExprNode> node) { return derived().visitExprNode(node); }
+  RetTy visitVariableExprNode(Ref<VariableExprNode> node) { return derived().visitExprNode(node); }
+  RetTy visitBinaryExprNode(Ref<BinaryExprNode> node) { return derived().visitExprNode(node); }
+  RetTy visitArrayExprNode(Ref<ArrayExprNode> node) { return derived().visitExprNode(node); }
+  RetTy visitConstantTensorNode(Ref<ConstantTensorNode> node) { return derived().visitExprNode(node); }
+  RetTy visitAssgnNode(Ref<AssgnNode> node) { return derived().visitStmtNode(node); }
+  RetTy visitPrototypeNode(Ref<PrototypeNode> node) { return derived().visitNode(node); }
+  RetTy visitFunctionNode(Ref<FunctionNode> node) { return derived().visitNode(node); }
+  RetTy visitExprNode(Ref<ExprNode> node) { return derived().visitStmtNode(node); }
+  RetTy visitStmtNode(Ref<StmtNode> node) { return derived().visitNode(node); }
+  RetTy visitNode(Ref<Node>) { return RetTy(); }
+};
+
+template<typename Derived, typename RetTy = void>
+using ASTVisitor = ASTVisitorBase<Derived, RetTy, false>;
+
+template<typename Derived, typename RetTy = void>
+using ConstASTVisitor = ASTVisitorBase<Derived, RetTy, true>;
+
+#endif
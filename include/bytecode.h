@@ -0,0 +1,116 @@
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fusion.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include "tensor.h"
+
+// Operations of the register bytecode; A is the destination register unless
+// noted otherwise.
+enum class Opcode : uint8_t {
+  LoadConst,  // A = Constants[B], sharing its buffer
+  Move,       // A = B
+  Add,        // A = B + C, and likewise for the other operators
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Transpose,  // A = transpose(B)
+  Fused,      // A = Kernels[C] over the leaves B, B + 1, ...
+  Pack,       // A = [B, B + 1, ...] with ArrayEntryOffsets[C]
+  Reshape,    // A = B viewed with Shapes[C]
+  Print,      // print(B); A has no value
+  Call,       // A = Functions[C](B, B + 1, ...)
+  CallExtern, // A = Externs[C](B, B + 1, ...)
+  Require,    // fails with "expression has no value" unless A has a value
+  Fail,       // fails with Messages[A]
+  Return,     // returns A
+  ReturnNone, // returns no value
+  NumOpcodes
+};
+
+struct Instruction {
+  Opcode Code = Opcode::Fail;
+  uint32_t A = 0;
+  uint32_t B = 0;
+  uint32_t C = 0;
+};
+
+struct BytecodeFunction {
+  Symbol Name;
+  uint32_t NumParams = 0;
+  uint32_t NumRegisters = 0;
+  std::vector<Instruction> Code;
+  // Source offset of each instruction, for errors.
+  std::vector<uint32_t> Offsets;
+};
+
+// A module lowered to register bytecode. Each function keeps its parameters
+// in the first registers, gives every variable a register of its own and
+// reuses the registers of temporaries from one statement to the next. The
+// language has no control flow, so a reference to a variable that is not
+// assigned earlier in the body, an unknown function or a wrong argument
+// count is known while compiling; it becomes a Fail instruction at that
+// point, which keeps the behavior of the tree-walking Interpreter.
+//
+// Fused trees (see FusionPlan) become a single instruction over registers
+// holding their leaves. The leaves are computed first, so a tree is only
+// fused when the leaves after its first operator are numbers, constants and
+// assigned variables, which can neither fail nor print ahead of an operand
+// shape error.
+struct BytecodeModule {
+  std::vector<BytecodeFunction> Functions;
+  std::vector<Tensor> Constants;
+  std::vector<std::vector<size_t>> Shapes;
+  // Source offsets of the entries of each array, which also give their count.
+  std::vector<std::vector<uint32_t>> ArrayEntryOffsets;
+  // Names and parameter counts of the extern functions.
+  std::vector<Symbol> Externs;
+  std::vector<uint32_t> ExternArity;
+  std::vector<std::string> Messages;
+  std::vector<FusedExpr> Kernels;
+  std::unordered_map<Symbol, uint32_t> FunctionIndex;
+
+  static BytecodeModule compile(const Module&, Fusion = Fusion::Enabled);
+  // One line per instruction, e.g. "  r2 = mul r0, r1".
+  void disassemble(std::ostream&) const;
+};
+
+// Runs a BytecodeModule with the semantics of the Interpreter. Dispatch is
+// threaded through computed gotos where the compiler supports them, and calls
+// push frames on a register stack instead of recursing. Errors throw
+// InterpreterError. The module must outlive the VM.
+class BytecodeVM {
+  struct Frame {
+    const BytecodeFunction* Function;
+    const Instruction* ReturnAddress;
+    size_t Base;
+    uint32_t Result;
+  };
+  const BytecodeModule& Program;
+  std::ostream& Out;
+  std::vector<Interpreter::NativeFunction> Natives;
+  std::vector<Tensor> Registers;
+  std::vector<Frame> Frames;
+
+  Tensor execute(const BytecodeFunction&, std::vector<Tensor>);
+
+public:
+  void defineExtern(Symbol, Interpreter::NativeFunction);
+  // Calls main, which must take no arguments.
+  void run();
+  // Calls a function of the module; nullopt if it has no value.
+  std::optional<Tensor> call(Symbol, std::vector<Tensor>);
+  BytecodeVM(const BytecodeModule&, std::ostream&);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef CASTING_H_
+#define CASTING_H_
+
+#include <cassert>
+#include <type_traits>
+
+// LLVM-style checked casts over a class hierarchy whose members provide a
+// static classof(const Base*). None of these use RTTI.
+
+template<typename To, typename From>
+bool isa(const From* value) {
+  return To::classof(value);
+}
+
+template<typename To, typename From, typename = std::enable_if_t<!std::is_pointer<From>::value>>
+bool isa(const From& value) {
+  return To::classof(&value);
+}
+
+template<typename To, typename From>
+To* cast(From* value) {
+  assert(isa<To>(value) && "cast<Ty>() argument of incompatible type!");
+  return static_cast<To*>(value);
+}
+
+template<typename To, typename From>
+const To* cast(const From* value) {
+  assert(isa<To>(value) && "cast<Ty>() argument of incompatible type!");
+  return static_cast<const To*>(value);
+}
+
+template<typename To, typename From, typename = std::enable_if_t<!std::is_pointer<From>::value>>
+To& cast(From& value) {
+  assert(isa<To>(value) && "cast<Ty>() argument of incompatible type!");
+  return static_cast<To&>(value);
+}
+
+template<typename To, typename From, typename = std::enable_if_t<!std::is_pointer<From>::value>>
+const To& cast(const From& value) {
+  assert(isa<To>(value) && "cast<Ty>() argument of incompatible type!");
+  return static_cast<const To&>(value);
+}
+
+template<typename To, typename From>
+To* dyn_cast(From* value) {
+  return isa<To>(value) ? static_cast<To*>(value) : nullptr;
+}
+
+template<typename To, typename From>
+const To* dyn_cast(const From* value) {
+  return isa<To>(value) ? static_cast<const To*>(value) : nullptr;
+}
+
+template<typename To, typename From>
+To* dyn_cast_or_null(From* value) {
+  return (value != nullptr) ? dyn_cast<To>(value) : nullptr;
+}
+
+template<typename To, typename From>
+const To* dyn_cast_or_null(const From* value) {
+  return (value != nullptr) ? dyn_cast<To>(value) : nullptr;
+}
+
+#endif
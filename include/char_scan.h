@@ -0,0 +1,38 @@
+#ifndef CHAR_SCAN_H_
+#define CHAR_SCAN_H_
+
+#include <cstddef>
+#include <string_view>
+
+// Vectorized byte scans used by the Scanner to skip text that can never
+// start a token, and to count lines for diagnostics. The implementation is
+// picked once at startup from the instruction sets the CPU supports and can
+// be overridden for testing.
+typedef enum class CharScanImpl {
+  Scalar,
+  SSE2,
+  AVX2
+} CharScanImpl;
+
+inline bool isWhitespaceChar(char c) {
+  return (c == ' ') || (c >= '\t' && c <= '\r');
+}
+
+inline bool isLineEndChar(char c) {
+  return (c == '\n') || (c == '\r') || (c == '\f');
+}
+
+// Position of the first non-whitespace byte at or after pos, or the length
+// of the buffer if there is none.
+size_t skipWhitespace(std::string_view, size_t);
+// Position of the first '\n', '\r' or '\f' at or after pos, or the length of
+// the buffer if there is none. Comments end at any of these.
+size_t skipToLineEnd(std::string_view, size_t);
+// Number of '\n' bytes in the buffer.
+size_t countNewlines(std::string_view);
+
+bool isCharScanImplSupported(CharScanImpl);
+CharScanImpl getCharScanImpl();
+void setCharScanImpl(CharScanImpl);
+
+#endif
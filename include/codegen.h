@@ -0,0 +1,44 @@
+#ifndef CODEGEN_H_
+#define CODEGEN_H_
+
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "fusion.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include "tensor.h"
+
+// Compiles functions to native code with LLVM and runs them through an ORC
+// LLJIT. Code is generated per specialization from ShapeInference, so every
+// tensor has a static shape: values are 64-byte aligned buffers, elementwise
+// operators and transposes become loops over fixed extents, and reshapes and
+// variables alias the buffer of their value. Each module is optimized with the
+// default O2 pipeline for the host before it is added to the JIT. Fused trees
+// (see FusionPlan) become one loop nest that computes each output element
+// from the leaves directly.
+//
+// A call compiles the specializations it reaches on first use. Programs get
+// the semantics of the Interpreter, except that errors are found before
+// anything runs: shape errors, unknown names and wrong arities, and values
+// whose shape is not known statically (those of extern functions and of
+// recursive calls), throw InterpreterError at the first offending node. The
+// module must outlive the engine.
+class NativeEngine {
+  struct State;
+  std::unique_ptr<State> Impl;
+
+public:
+  // Calls main, which must take no arguments.
+  void run();
+  // Calls a function of the module; nullopt if it has no value.
+  std::optional<Tensor> call(Symbol, const std::vector<Tensor>&);
+  // The optimized IR of every module compiled so far.
+  std::string getIR() const;
+  NativeEngine(const Module&, std::ostream&, Fusion = Fusion::Enabled);
+  ~NativeEngine();
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class SourceFile;
+
+typedef enum class Severity {
+  Error,
+  Warning
+} Severity;
+
+// One report, positioned by byte offset; line and column are only worked out
+// when the report is printed.
+struct Diagnostic {
+  Severity Level;
+  uint32_t Offset;
+  std::string Message;
+};
+
+// Collects diagnostics in the order they are reported so that one pass over
+// a file can report every problem in it.
+class DiagnosticEngine {
+  std::vector<Diagnostic> Diagnostics;
+  size_t NumErrors = 0;
+
+public:
+  void report(Severity, uint32_t, std::string);
+  void error(uint32_t, std::string);
+  const std::vector<Diagnostic>& getDiagnostics() const;
+  size_t getNumErrors() const;
+  bool hasErrors() const;
+  // Moves the other engine's diagnostics after this one's.
+  void append(DiagnosticEngine&&);
+  // Prints "name:line:col: error: message" lines.
+  void print(std::ostream&, const SourceFile&) const;
+  // Prints "name:@offset: error: message" lines for input that was not kept.
+  void print(std::ostream&, const std::string&) const;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FUSION_H_
+#define FUSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "parser.h"
+#include "tensor.h"
+
+typedef enum class Fusion {
+  Enabled,
+  Disabled
+} Fusion;
+
+// A tree of elementwise operations evaluated in one pass over its output
+// instead of one temporary tensor per node. Its interior nodes are binary
+// operators and transposes; every other expression under it is a leaf. All
+// values in the tree have the output's shape or are scalars, and a transpose
+// reverses every dimension of its subtree, so it only remaps the indices of
+// the leaves below it: a leaf under an odd number of transposes is read with
+// its dimensions reversed.
+struct FusedExpr {
+  enum class StepKind : uint8_t {
+    Leaf,
+    Binary,
+    Transpose
+  };
+  struct Step {
+    StepKind Kind;
+    Op Operator = Op::Plus;
+    // Index into Leaves of a Leaf step.
+    uint32_t Leaf = 0;
+    // Source offset of a Binary step, for errors.
+    uint32_t Offset = 0;
+  };
+  struct Leaf {
+    const ExprNode* Expr;
+    bool Transposed;
+  };
+  // Postfix, in the order the unfused evaluation visits the nodes.
+  std::vector<Step> Steps;
+  std::vector<Leaf> Leaves;
+  size_t NumOperators = 0;
+
+  // Evaluates the tree, asking for the value of each leaf as the unfused
+  // evaluation would reach it, so operand shape errors are raised (as
+  // InterpreterError) in the same order relative to the leaves. The output is
+  // computed in tiles along its last dimension that stay in cache; transposed
+  // leaves are gathered with strides, others are read in place.
+  Tensor evaluate(const std::function<Tensor(uint32_t)>& leafValue) const;
+};
+
+// Finds the trees worth fusing in a module: maximal trees of binary operators
+// and calls of the transpose builtin that contain at least two of them. A
+// lone operator gains nothing over the unfused kernels. The module must
+// outlive the plan.
+class FusionPlan {
+  std::unordered_map<const ExprNode*, FusedExpr> Trees;
+
+  void collect(const ExprNode&);
+  void build(const ExprNode&, bool transposed, FusedExpr&);
+
+public:
+  // The tree rooted at the expression; nullptr if it is not the root of one.
+  const FusedExpr* find(const ExprNode&) const;
+  size_t size() const;
+  FusionPlan(const Module&);
+};
+
+#endif
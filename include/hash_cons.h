@@ -0,0 +1,27 @@
+#ifndef HASH_CONS_H_
+#define HASH_CONS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "parser.h"
+
+// Maps every node to the first structurally equal node interned, using the
+// cached node hashes, so identical subexpressions can be recognized (and
+// shared by later passes) without pairwise tree comparisons. Nodes are not
+// owned and must outlive the table.
+class HashConsTable {
+  std::unordered_multimap<uint64_t, const Node*> Nodes;
+
+public:
+  // The canonical node equal to the given one; the node itself if it is the
+  // first of its kind.
+  const Node* intern(const Node&);
+  // Interns every expression in the tree, children before parents, and
+  // returns how many of them equalled an expression already interned.
+  size_t internExpressions(const Node&);
+  size_t size() const;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef INCREMENTAL_PARSER_H_
+#define INCREMENTAL_PARSER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "diagnostics.h"
+#include "parser.h"
+
+// Keeps the parse of a file across edits. The text is divided into spans,
+// each starting at a 'def' or 'extern' token (the first span also covers
+// anything before the first one) and running up to the next. An update
+// re-lexes only the spans the edit touched and reparses only those whose
+// text hash changed, so the cost follows the size of the edited definition
+// rather than the file.
+//
+// Nodes and diagnostics of a span are positioned relative to the span's
+// start, so spans after an edit are reused without touching their nodes.
+// For well-formed input the definitions match Parser::parse on the whole
+// text.
+class IncrementalParser {
+  struct Span {
+    size_t Start;
+    size_t Length;
+    uint64_t Hash;
+    std::unique_ptr<Node> Definition;
+    DiagnosticEngine Diags;
+  };
+
+  std::string Text;
+  std::vector<Span> Spans;
+  size_t NumReparsed = 0;
+  static bool isSafeBoundary(std::string_view, size_t);
+  static Span parseSpan(std::string_view, size_t, uint64_t);
+
+public:
+  // Replaces the text and brings the parse up to date with it. An invalid
+  // lexeme throws std::runtime_error and leaves the previous parse in place.
+  void update(std::string);
+  const std::string& getText() const;
+  size_t getNumSpans() const;
+  size_t getSpanStart(size_t) const;
+  // The definition parsed from a span, or nullptr if it had none or it was
+  // dropped because of a syntax error.
+  const Node* getDefinition(size_t) const;
+  const DiagnosticEngine& getDiagnostics(size_t) const;
+  // All definitions in source order.
+  std::vector<const Node*> getDefinitions() const;
+  // All diagnostics in source order, with offsets into the whole text.
+  DiagnosticEngine collectDiagnostics() const;
+  // Spans parsed by the most recent update.
+  size_t getNumReparsed() const;
+};
+
+#endif
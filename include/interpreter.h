@@ -0,0 +1,65 @@
+#ifndef INTERPRETER_H_
+#define INTERPRETER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fusion.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include "tensor.h"
+
+// A failure while running a program, at the offset of the offending node.
+class InterpreterError : public std::runtime_error {
+  uint32_t Offset;
+
+public:
+  uint32_t getOffset() const;
+  InterpreterError(uint32_t, const std::string&);
+};
+
+// Runs a module by walking its AST. Values are Tensors: literals build them,
+// binary operators apply elementwise to operands of the same shape or with
+// one scalar operand, and a declaration with a size reshapes its value, which
+// must keep the element count (a declaration without one, recorded by the
+// parser as <1>, keeps the value's shape). print writes its argument to the
+// output stream and transpose reverses the dimensions. A function's value is
+// that of its last statement when that is an expression; otherwise calls to
+// it have no value. Arguments and variables share their tensors' buffers, so
+// calls never copy data. Trees of elementwise operators and transposes are
+// fused (see FusionPlan) unless disabled. Errors throw InterpreterError. The
+// module must outlive the interpreter.
+class Interpreter {
+public:
+  using NativeFunction = std::function<Tensor(const std::vector<Tensor>&)>;
+  // The language has no conditionals, so any recursion runs until this limit.
+  static constexpr size_t MaxCallDepth = 1000;
+
+private:
+  class Evaluator;
+  std::ostream& Out;
+  // FunctionNodes and extern PrototypeNodes by name.
+  std::unordered_map<Symbol, const Node*> Functions;
+  std::unordered_map<Symbol, NativeFunction> Natives;
+  std::optional<FusionPlan> Plan;
+  size_t Depth = 0;
+
+  std::optional<Tensor> callFunction(const FunctionNode&, std::vector<Tensor>);
+
+public:
+  // Supplies the implementation of an extern function.
+  void defineExtern(Symbol, NativeFunction);
+  // Calls main, which must take no arguments.
+  void run();
+  // Calls a function defined in the module; nullopt if it has no value.
+  std::optional<Tensor> call(Symbol, std::vector<Tensor>);
+  Interpreter(const Module&, std::ostream&, Fusion = Fusion::Enabled);
+};
+
+#endif
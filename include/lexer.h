@@ -1,10 +1,14 @@
 #ifndef LEXER_H_
 #define LEXER_H_
 
-#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <vector>
-#include <stack>
 #include <string>
+#include <string_view>
+#include "line_table.h"
+#include "symbol_table.h"
 
 typedef enum class Lexeme {
   D,
@@ -56,69 +60,96 @@ typedef enum class TokenType {
   Invalid = -20
 } TokenType;
 
-typedef enum class LexState {
-  S0 = -1,
-  S1 = -2,
-  S2 = -3,
-  S3 = 1,
-  S4 = -4,
-  S5 = 2,
-  S6 = -5,
-  S7 = -6,
-  S8 = -7,
-  S9 = 2,
-  S10 = -8,
-  S11 = -9,
-  S12 = 3,
-  S13 = 4,
-  S14 = 5,
-  S15 = 6,
-  S16 = 7,
-  S17 = 8,
-  S18 = 9,
-  S19 = 10,
-  S20 = 11,
-  S21 = 22,
-  S22 = 13,
-  S23 = 14,
-  S24 = 15,
-  S25 = 16,
-  S26 = 17,
-  S27 = 18,
-  S28 = 19,
-  S29 = 20,
-  S30 = 21,
-  SE = -10
+typedef enum class LexState : uint8_t {
+  S0,
+  S1,
+  S2,
+  S3,
+  S4,
+  S5,
+  S6,
+  S7,
+  S8,
+  S9,
+  S10,
+  S11,
+  S12,
+  S13,
+  S14,
+  S15,
+  S16,
+  S17,
+  S18,
+  S19,
+  S20,
+  S21,
+  S22,
+  S23,
+  S24,
+  S25,
+  S26,
+  S27,
+  SE
 } LexState;
 
+constexpr size_t NumLexemes = (size_t)Lexeme::Invalid + 1;
+constexpr size_t NumLexStates = (size_t)LexState::SE + 1;
+
+// Compact token referencing its text by position in the SourceFile that
+// produced it.
+struct Token {
+  TokenType Type;
+  uint32_t Offset;
+  uint32_t Length;
+};
+
+static_assert(sizeof(Token) == 12, "Token is expected to stay compact");
+
+// Self-describing token whose text is a view into the scanned buffer (or a
+// string literal for fixed punctuation), so the buffer must outlive it.
+// Identifiers are interned and numbers converted to their value on
+// construction, so the parser never has to look at their text again.
 class LexToken {
   TokenType Type;
-  std::string SourceStr;
+  uint32_t Offset = 0;
+  std::string_view SourceStr;
+  Symbol Sym;
+  double NumVal = 0;
   void commonInit(TokenType);
 
 public:
-  TokenType getType();
-  std::string getStr();
+  TokenType getType() const;
+  std::string_view getStr() const;
+  Symbol getSymbol() const;
+  double getNumber() const;
+  // Byte offset of the token in its source; not compared by operator==.
+  uint32_t getOffset() const;
   bool operator==(const LexToken&) const;
   LexToken(TokenType);
-  LexToken(TokenType, std::string);
+  LexToken(TokenType, std::string_view, uint32_t = 0);
 };
 
+class SourceFile;
+
 class Scanner {
 private:
-  static Scanner* Instance;
-  static Scanner& getInstance();
-  std::map<LexState, std::map<Lexeme, LexState>> TransitionTable;
-  std::map<LexState, TokenType> TokenTypeTable;
-  std::map<char, Lexeme> LexemeTypeTable;
-  Lexeme getLexeme(char);
-  void initialzeTransitionTable();
-  void initializeStateTable();
-  void initializeLexemeTypeTable();
   Scanner() = default;
 
 public:
-  static std::vector<LexToken> scan(std::string);
+  // Scans the longest token starting at the given offset and stores its
+  // length; returns Invalid if no token starts there.
+  static TokenType scanToken(std::string_view, size_t, size_t&);
+  static std::runtime_error invalidLexemeError(SourceLocation, char);
+  static std::vector<LexToken> scan(std::string_view);
+  static std::vector<Token> scan(const SourceFile&);
+  // Scans only [begin, end) of the text, which must not start or end inside
+  // a token or comment. Offsets and error locations refer to the whole text.
+  static std::vector<Token> scanRange(std::string_view, size_t, size_t);
+  // Same tokens as scan, produced by scanning newline-aligned pieces of the
+  // input on up to the given number of threads (0 picks the hardware
+  // concurrency).
+  static std::vector<LexToken> scanParallel(std::string_view, unsigned = 0);
+  static std::vector<Token> scanParallel(const SourceFile&, unsigned = 0);
 };
 
 #endif
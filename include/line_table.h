@@ -0,0 +1,31 @@
+#ifndef LINE_TABLE_H_
+#define LINE_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 1-based line and byte column of a source offset.
+struct SourceLocation {
+  uint32_t Line;
+  uint32_t Column;
+  std::string str() const;
+};
+
+// Offsets of the first byte of every line in a buffer, sorted so a location
+// is one binary search away. Lines end at '\n'.
+class LineTable {
+  std::vector<uint32_t> LineStarts;
+
+public:
+  // Resolves a single offset by counting newlines before it, without keeping
+  // a table around; meant for one-off diagnostics.
+  static SourceLocation locate(std::string_view, size_t);
+  SourceLocation getLocation(size_t) const;
+  size_t getNumLines() const;
+  LineTable(std::string_view);
+};
+
+#endif
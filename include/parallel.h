@@ -0,0 +1,52 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Maps a requested thread count to a usable one; 0 means one per hardware
+// thread.
+inline unsigned resolveThreadCount(unsigned numThreads) {
+  if (numThreads == 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  return std::max(1u, numThreads);
+}
+
+// Runs task(i) for every i in [0, numTasks) on up to numThreads threads, the
+// calling thread included. Tasks are handed out in index order through an
+// atomic counter. Once every thread has joined, the exception of the lowest
+// failing task is rethrown.
+template <typename TaskFn>
+void parallelFor(size_t numTasks, unsigned numThreads, TaskFn&& task) {
+  std::vector<std::exception_ptr> errors(numTasks);
+  std::atomic<size_t> nextTask{0};
+  auto worker = [&]() {
+    for (size_t i = nextTask.fetch_add(1); i < numTasks; i = nextTask.fetch_add(1)) {
+      try {
+	task(i);
+      } catch (...) {
+	errors[i] = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min<size_t>(resolveThreadCount(numThreads), numTasks); i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (std::exception_ptr& error : errors) {
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+#endif
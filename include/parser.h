@@ -1,10 +1,16 @@
 #ifndef PARSER_H_
 #define PARSER_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <memory>
+#include "arena.h"
+#include "casting.h"
+#include "diagnostics.h"
 #include "lexer.h"
-#include <iostream>
+#include "symbol_table.h"
+#include "token_stream.h"
 
 template<typename T>
 bool operator==(const std::vector<std::unique_ptr<T>>& n1, const std::vector<std::unique_ptr<T>>& n2) {
@@ -27,53 +33,106 @@ typedef enum class Op {
   Modulus = '%'
 } Op;
 
+// Discriminator for the node hierarchy. Kinds are grouped so that every
+// abstract base covers a contiguous range, which is what classof tests.
+typedef enum class NodeKind {
+  NumberExpr,
+  VariableExpr,
+  BinaryExpr,
+  ArrayExpr,
+  ConstantTensorExpr,
+  LastExpr = ConstantTensorExpr,
+  Assgn,
+  LastStmt = Assgn,
+  Prototype,
+  Function
+} NodeKind;
+
+// Nodes live either on the heap or in the Arena of the Module being parsed.
+// Each allocation is preceded by a small header saying which, so deleting an
+// arena node through its unique_ptr runs the destructor but leaves the memory
+// to be released with the arena.
 class Node {
+  NodeKind Kind;
+  uint32_t Offset = 0;
+  uint64_t Hash = 0;
+
+protected:
+  Node(NodeKind kind) : Kind(kind) {}
+  // Called at the end of every concrete constructor, once the children exist
+  // and have their own hashes.
+  void initHash();
+
 public:
-  virtual bool operator==(const Node& other) const __attribute__((used)) {
-    return false;
-  }
-};
+  static void* operator new(size_t);
+  static void* operator new(size_t, Arena&);
+  static void operator delete(void*);
+  static void operator delete(void*, Arena&);
+
+  NodeKind getKind() const { return Kind; }
+  // Byte offset in the source of the token the node starts at (the operator
+  // for binary expressions). Not part of structural equality.
+  uint32_t getOffset() const { return Offset; }
+  void setOffset(uint32_t offset) { Offset = offset; }
+  // Structural hash, computed bottom-up when the node is built. Nodes that
+  // compare equal have equal hashes; a constant tensor literal hashes like
+  // the nested array of numbers it stands for.
+  uint64_t getHash() const { return Hash; }
 
-bool operator==(const std::vector<std::unique_ptr<Node>>& n1, const std::vector<std::unique_ptr<Node>>& n2);
+  // Structural equality, dispatched on the kind tag. Nodes with different
+  // hashes are rejected without looking at their children.
+  bool operator==(const Node& other) const __attribute__((used));
+
+  virtual ~Node() = default;
+};
 
 class StmtNode : public Node {
+protected:
+  StmtNode(NodeKind kind) : Node(kind) {}
+
 public:
+  static bool classof(const Node* node) {
+    return node->getKind() <= NodeKind::LastStmt;
+  }
 };
 
 class ExprNode : public StmtNode {
+protected:
+  ExprNode(NodeKind kind) : StmtNode(kind) {}
+
 public:
+  static bool classof(const Node* node) {
+    return node->getKind() <= NodeKind::LastExpr;
+  }
 };
 
 class NumberExprNode : public ExprNode {
   double Val;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const NumberExprNode*>(&other_)) {
-      return (Val == other->Val);
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::NumberExpr;
   }
 
-  NumberExprNode(double val) : Val(val) {}
+  double getValue() const { return Val; }
+
+  NumberExprNode(double val) : ExprNode(NodeKind::NumberExpr), Val(val) { initHash(); }
 };
 
 class VariableExprNode : public ExprNode {
-  std::string Name;
+  Symbol Name;
   std::vector<std::unique_ptr<ExprNode>> Args;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const VariableExprNode*>(&other_)) {
-      return (Name == other->Name && (Args == other->Args));
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::VariableExpr;
   }
 
-  VariableExprNode(std::string identifier, std::vector<std::unique_ptr<ExprNode>> args)
-    : Name(identifier), Args(std::move(args)) {}
+  Symbol getName() const { return Name; }
+  const std::vector<std::unique_ptr<ExprNode>>& getArgs() const { return Args; }
+
+  VariableExprNode(Symbol identifier, std::vector<std::unique_ptr<ExprNode>> args)
+    : ExprNode(NodeKind::VariableExpr), Name(identifier), Args(std::move(args)) { initHash(); }
 };
 
 class BinaryExprNode : public ExprNode {
@@ -82,73 +141,94 @@ class BinaryExprNode : public ExprNode {
   std::unique_ptr<ExprNode> RHS;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const BinaryExprNode*>(&other_)) {
-      return ((Oper == other->Oper) && \
-	      (*LHS == *(other->LHS)) &&	\
-	      (*RHS == *(other->RHS)));
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::BinaryExpr;
   }
 
+  Op getOp() const { return Oper; }
+  ExprNode& getLHS() const { return *LHS; }
+  ExprNode& getRHS() const { return *RHS; }
+
   BinaryExprNode(enum Op oper, std::unique_ptr<ExprNode> lhs, std::unique_ptr<ExprNode> rhs)
-    : Oper(oper), LHS(std::move(lhs)), RHS(std::move(rhs)) {}
+    : ExprNode(NodeKind::BinaryExpr), Oper(oper), LHS(std::move(lhs)), RHS(std::move(rhs)) { initHash(); }
+  // Releases nested binary operands from a worklist rather than recursively,
+  // since a long chain nests one node per operand.
+  ~BinaryExprNode() override;
+  BinaryExprNode(BinaryExprNode&&) = default;
 };
 
 class ArrayExprNode : public ExprNode {
   std::vector<std::unique_ptr<ExprNode>> Entries;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const ArrayExprNode*>(&other_)) {
-      return (Entries == other->Entries);
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::ArrayExpr;
   }
 
+  const std::vector<std::unique_ptr<ExprNode>>& getEntries() const { return Entries; }
+
   ArrayExprNode(std::vector<std::unique_ptr<ExprNode>> entries)
-    : Entries(std::move(entries)) {}
+    : ExprNode(NodeKind::ArrayExpr), Entries(std::move(entries)) { initHash(); }
+};
+
+// Array literal whose entries are all numbers, possibly nested, stored as one
+// contiguous row-major buffer. The parser produces it instead of an
+// ArrayExprNode of NumberExprNodes, which it compares equal to.
+class ConstantTensorNode : public ExprNode {
+  std::vector<size_t> Shape;
+  std::vector<double> Values;
+
+public:
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::ConstantTensorExpr;
+  }
+
+  const std::vector<size_t>& getShape() const { return Shape; }
+  const std::vector<double>& getValues() const { return Values; }
+
+  ConstantTensorNode(std::vector<size_t> shape, std::vector<double> values)
+    : ExprNode(NodeKind::ConstantTensorExpr), Shape(std::move(shape)), Values(std::move(values)) { initHash(); }
 };
 
 class AssgnNode : public StmtNode {
-  std::string Name;
+  Symbol Name;
   std::vector<std::unique_ptr<NumberExprNode>> Size;
   std::unique_ptr<ExprNode> Expr;
   bool IsDecl;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const AssgnNode*>(&other_)) {
-      return ((Name == other->Name) && \
-	      (Size == other->Size) && \
-	      (*Expr == *(other->Expr)) && \
-	      (IsDecl == other->IsDecl));
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::Assgn;
   }
 
-  AssgnNode(std::string identifier, std::vector<std::unique_ptr<NumberExprNode>> size, std::unique_ptr<ExprNode> expr, bool isDecl)
-    : Name(identifier), Size(std::move(size)), Expr(std::move(expr)), IsDecl(isDecl) {};
+  Symbol getName() const { return Name; }
+  const std::vector<std::unique_ptr<NumberExprNode>>& getSize() const { return Size; }
+  ExprNode& getExpr() const { return *Expr; }
+  bool isDecl() const { return IsDecl; }
+
+  AssgnNode(Symbol identifier, std::vector<std::unique_ptr<NumberExprNode>> size, std::unique_ptr<ExprNode> expr, bool isDecl)
+    : StmtNode(NodeKind::Assgn), Name(identifier), Size(std::move(size)), Expr(std::move(expr)), IsDecl(isDecl) {
+    initHash();
+  }
 };
 
 class PrototypeNode : public Node {
-  std::string Name;
-  std::vector<std::string> Args;
+  Symbol Name;
+  std::vector<Symbol> Args;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const PrototypeNode*>(&other_)) {
-      return (Name == other->Name && (Args == other->Args));
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::Prototype;
   }
 
-  PrototypeNode(std::string identifier, std::vector<std::string> args)
-    : Name(identifier), Args(std::move(args)) {};
+  Symbol getName() const { return Name; }
+  const std::vector<Symbol>& getArgs() const { return Args; }
+
+  PrototypeNode(Symbol identifier, std::vector<Symbol> args)
+    : Node(NodeKind::Prototype), Name(identifier), Args(std::move(args)) { initHash(); }
+
+  PrototypeNode(Symbol identifier, const std::vector<std::string>& args)
+    : Node(NodeKind::Prototype), Name(identifier), Args(args.begin(), args.end()) { initHash(); }
 };
 
 class FunctionNode : public Node {
@@ -156,34 +236,66 @@ class FunctionNode : public Node {
   std::vector<std::unique_ptr<StmtNode>> Body;
 
 public:
-  virtual bool operator==(const Node& other_) const override __attribute__((used)) {
-    if (auto other=dynamic_cast<const FunctionNode*>(&other_)) {
-      return ((*Prototype == *(other->Prototype)) && (Body == other->Body));
-    } else {
-      return Node::operator==(other_);
-    }
+  static bool classof(const Node* node) {
+    return node->getKind() == NodeKind::Function;
   }
 
+  PrototypeNode& getPrototype() const { return *Prototype; }
+  const std::vector<std::unique_ptr<StmtNode>>& getBody() const { return Body; }
+
   FunctionNode(std::unique_ptr<PrototypeNode> prototype, std::vector<std::unique_ptr<StmtNode>> body)
-    : Prototype(std::move(prototype)), Body(std::move(body)) {};
+    : Node(NodeKind::Function), Prototype(std::move(prototype)), Body(std::move(body)) { initHash(); }
+};
+
+typedef enum class NodeAllocation {
+  Arena,
+  Heap
+} NodeAllocation;
+
+// Result of one Parser::parse call. Owns the top-level definitions and, when
+// parsed in arena mode, the memory of every node reachable from them, which
+// is released in bulk after the definitions are destroyed.
+class Module {
+  std::unique_ptr<Arena> NodeArena;
+  std::vector<std::unique_ptr<Arena>> MergedArenas;
+  std::vector<std::unique_ptr<Node>> Definitions;
+  DiagnosticEngine Diags;
+
+public:
+  Arena* getArena();
+  std::vector<std::unique_ptr<Node>>& getDefinitions();
+  const std::vector<std::unique_ptr<Node>>& getDefinitions() const;
+  size_t size() const;
+  std::unique_ptr<Node>& operator[](size_t);
+  std::vector<std::unique_ptr<Node>>::iterator begin();
+  std::vector<std::unique_ptr<Node>>::iterator end();
+  // Syntax errors found while parsing the module, in source order.
+  DiagnosticEngine& getDiagnostics();
+  const DiagnosticEngine& getDiagnostics() const;
+  // Moves the other module's definitions and diagnostics after this one's,
+  // taking ownership of the arena the definitions live in.
+  void append(Module&&);
+  Module(NodeAllocation);
 };
 
 class Parser {
 private:
-  static Parser* Instance;
-  static Parser& getInstance();
-  size_t TokenPos;
-  std::vector<LexToken> Tokens;
-  std::map<Op, int> BinopPrecedence;
-  void reset();
-  void rollback();
-  void syncTo(TokenType);
-  LexToken& peakNextToken();
-  LexToken& getNextToken();
-  LexToken& expect(TokenType, TokenType);
+  // Thrown once a syntax error is reported, to unwind to the nearest
+  // recovery point.
+  struct SyntaxError {};
+  Arena* NodeArena = nullptr;
+  TokenStream& Tokens;
+  DiagnosticEngine OwnDiags;
+  DiagnosticEngine& Diags;
+  [[noreturn]] void syntaxError(const LexToken&, const std::string&);
+  void recoverInStatement();
+  void recoverAtTopLevel();
+  const LexToken& peakNextToken();
+  LexToken getNextToken();
+  LexToken expect(TokenType);
   bool accept(TokenType);
   std::unique_ptr<AssgnNode> parseVarDecl();
-  std::unique_ptr<ArrayExprNode> parseArray();
+  std::unique_ptr<ExprNode> parseArray();
   std::vector<std::unique_ptr<NumberExprNode>> parseSize();
   std::unique_ptr<AssgnNode> parseAssgn();
   std::unique_ptr<NumberExprNode> parseNumberExpr();
@@ -193,14 +305,44 @@ private:
   std::unique_ptr<ExprNode> parseExpr();
   std::unique_ptr<StmtNode> parseStmt();
   std::vector<std::unique_ptr<StmtNode>> parseStmtList();
-  std::unique_ptr<BinaryExprNode> parseBinOpRhs(int, std::unique_ptr<ExprNode>);
+  std::unique_ptr<ExprNode> parseBinOpRhs(int, std::unique_ptr<ExprNode>);
   std::unique_ptr<PrototypeNode> parsePrototype();
   std::unique_ptr<PrototypeNode> parseExtern();
   std::unique_ptr<FunctionNode> parseFunction();
-  Parser() = default;
+  static std::vector<size_t> findDefinitionStarts(const std::vector<Token>&);
+  template<typename T, typename... Args>
+  std::unique_ptr<T> makeNode(uint32_t offset, Args&&... args) {
+    std::unique_ptr<T> node;
+    if (NodeArena != nullptr) {
+      node.reset(new (*NodeArena) T(std::forward<Args>(args)...));
+    } else {
+      node = std::make_unique<T>(std::forward<Args>(args)...);
+    }
+    node->setOffset(offset);
+    return node;
+  }
 
 public:
-  static std::vector<std::unique_ptr<Node>> parse(std::vector<LexToken>);
+  // Nodes are placed in the arena when one is given and on the heap
+  // otherwise. Syntax errors go to the given engine, or to one owned by the
+  // parser.
+  Parser(TokenStream&, Arena* = nullptr, DiagnosticEngine* = nullptr);
+  DiagnosticEngine& getDiagnostics();
+  // Parses the next top-level extern or def, pulling only the tokens it
+  // spans; returns nullptr at the end of input. Syntax errors are always
+  // reported. An error inside a body statement drops only that statement,
+  // and the function is returned without it. Any other error, such as one
+  // in a prototype or an extern, or a body that does not end at a '}',
+  // skips the whole definition.
+  std::unique_ptr<Node> parseDefinition();
+  static Module parse(TokenStream&, NodeAllocation = NodeAllocation::Arena);
+  static Module parse(const std::vector<LexToken>&, NodeAllocation = NodeAllocation::Arena);
+  static Module parse(const SourceFile&, const std::vector<Token>&, NodeAllocation = NodeAllocation::Arena);
+  // Splits the tokens at top-level def/extern boundaries and parses the
+  // pieces on up to the given number of threads (0 picks the hardware
+  // concurrency). The result is the same as parse().
+  static Module parseParallel(const SourceFile&, const std::vector<Token>&, unsigned = 0,
+			      NodeAllocation = NodeAllocation::Arena);
 };
 
 #endif
@@ -0,0 +1,91 @@
+#ifndef SHAPE_INFERENCE_H_
+#define SHAPE_INFERENCE_H_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "diagnostics.h"
+#include "parser.h"
+#include "symbol_table.h"
+
+// Static shape of a tensor value; rank 0 is a scalar. Values the pass cannot
+// see into, such as the results of extern functions, have an unknown shape.
+class TensorShape {
+  std::vector<size_t> Dims;
+  bool Known = false;
+
+public:
+  static TensorShape scalar();
+  bool isKnown() const;
+  const std::vector<size_t>& getDims() const;
+  size_t getRank() const;
+  size_t getNumElements() const;
+  // "<2, 3>", "<>" for a scalar and "<?>" when unknown.
+  std::string str() const;
+  bool operator==(const TensorShape&) const;
+  bool operator!=(const TensorShape&) const;
+  bool operator<(const TensorShape&) const;
+  // An unknown shape.
+  TensorShape() = default;
+  TensorShape(std::vector<size_t>);
+};
+
+// Infers the shape of every expression in the function bodies of a module.
+// Shapes come from literals and declared sizes (a declaration without a size
+// takes the shape of its value; one with a size reshapes it, keeping the
+// element count) and flow through variables, elementwise binary operators
+// (operands of the same shape, or one scalar), transpose (which reverses the
+// dimensions) and calls.
+//
+// Functions are generic: every distinct list of argument shapes a function
+// is called with gets its own Specialization, in which the body is inferred
+// with the parameters bound to those shapes. A function's value is that of
+// its last statement when that is an expression; otherwise calls to it have
+// no value. Problems are reported to the DiagnosticEngine at node offsets and
+// the offending values get an unknown shape. The module must outlive the
+// pass.
+class ShapeInference {
+public:
+  struct Specialization {
+    const FunctionNode& Function;
+    std::vector<TensorShape> ArgShapes;
+    // Shape of the value of a call; nullopt if calls produce no value.
+    std::optional<TensorShape> Result;
+    std::unordered_map<const ExprNode*, TensorShape> ExprShapes;
+    std::unordered_map<const VariableExprNode*, const Specialization*> Callees;
+    bool InProgress = false;
+    // Shape of an expression of the body; nullptr if it has no value.
+    const TensorShape* getShape(const ExprNode&) const;
+    // The specialization a call in the body resolves to; nullptr for
+    // builtins and externs.
+    const Specialization* getCallee(const VariableExprNode&) const;
+    Specialization(const FunctionNode&, std::vector<TensorShape>);
+  };
+
+private:
+  class BodyInference;
+  DiagnosticEngine& Diags;
+  const std::vector<std::unique_ptr<Node>>& Definitions;
+  // FunctionNodes and extern PrototypeNodes by name.
+  std::unordered_map<Symbol, const Node*> Functions;
+  std::map<std::pair<const FunctionNode*, std::vector<TensorShape>>, std::unique_ptr<Specialization>>
+    Specializations;
+  std::unordered_map<const FunctionNode*, size_t> NumActive;
+
+public:
+  // Specializes every function that takes no arguments, as entry points.
+  void run();
+  const Specialization& specialize(const FunctionNode&, const std::vector<TensorShape>&);
+  // The named function's specialization; nullptr if there is no function
+  // definition by that name.
+  const Specialization* specialize(Symbol, const std::vector<TensorShape>&);
+  size_t getNumSpecializations() const;
+  ShapeInference(const Module&, DiagnosticEngine&);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SOURCE_FILE_H_
+#define SOURCE_FILE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "lexer.h"
+#include "line_table.h"
+
+// Owns the text of one D-- source file, either as a read-only memory mapping
+// or as an in-memory buffer. Tokens produced from it reference the text by
+// offset, so it must outlive them and any LexTokens made from them.
+class SourceFile {
+  std::string Name;
+  std::string Buffer;
+  const char* MappedData = nullptr;
+  size_t MappedSize = 0;
+  mutable std::atomic<const LineTable*> Lines{nullptr};
+  void unmap();
+
+public:
+  static SourceFile open(const std::string&);
+  const std::string& getName() const;
+  std::string_view getText() const;
+  std::string_view getStr(const Token&) const;
+  LexToken getToken(const Token&) const;
+  // Line and column of a byte offset. The line table is built on the first
+  // call, so files that never produce a diagnostic never pay for it.
+  SourceLocation getLocation(size_t) const;
+  bool isMapped() const;
+  SourceFile(std::string, std::string);
+  SourceFile(SourceFile&&) noexcept;
+  SourceFile& operator=(SourceFile&&) noexcept;
+  SourceFile(const SourceFile&) = delete;
+  SourceFile& operator=(const SourceFile&) = delete;
+  ~SourceFile();
+};
+
+#endif
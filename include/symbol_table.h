@@ -0,0 +1,81 @@
+#ifndef SYMBOL_TABLE_H_
+#define SYMBOL_TABLE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Process-wide intern table for identifiers. Every distinct name is stored
+// once in arena blocks and gets a stable 32-bit id, so names can be compared
+// and hashed as integers. Interning is thread-safe; looking up the text of an
+// id never takes the lock.
+class SymbolTable {
+  struct Entry {
+    const char* Data;
+    uint32_t Length;
+    uint32_t Hash;
+  };
+
+  static constexpr size_t PageBits = 12;
+  static constexpr size_t PageSize = size_t(1) << PageBits;
+  static constexpr size_t MaxPages = size_t(1) << 14;
+  static constexpr size_t BlockSize = size_t(1) << 16;
+
+  std::mutex Mutex;
+  std::unique_ptr<std::atomic<Entry*>[]> Pages;
+  std::vector<std::unique_ptr<Entry[]>> OwnedPages;
+  std::vector<std::unique_ptr<char[]>> Blocks;
+  char* BlockPos = nullptr;
+  size_t BlockLeft = 0;
+  std::vector<uint32_t> Slots;
+  uint32_t NumSymbols = 0;
+  std::atomic<uint32_t> NumPublished{0};
+
+  static uint32_t hash(std::string_view);
+  const Entry& entry(uint32_t) const;
+  const char* copyToArena(std::string_view);
+  void grow();
+  SymbolTable();
+
+public:
+  static SymbolTable& global();
+  uint32_t intern(std::string_view);
+  std::string_view str(uint32_t) const;
+  size_t size();
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
+};
+
+// Interned identifier. Implicitly constructible from strings so AST nodes can
+// still be built from plain names.
+class Symbol {
+  uint32_t Id;
+
+public:
+  uint32_t getId() const { return Id; }
+  std::string_view str() const { return SymbolTable::global().str(Id); }
+  bool operator==(const Symbol& other) const { return Id == other.Id; }
+  bool operator!=(const Symbol& other) const { return Id != other.Id; }
+  bool operator<(const Symbol& other) const { return Id < other.Id; }
+  Symbol() : Id(0) {}
+  Symbol(std::string_view name) : Id(SymbolTable::global().intern(name)) {}
+  Symbol(const std::string& name) : Symbol(std::string_view(name)) {}
+  Symbol(const char* name) : Symbol(std::string_view(name)) {}
+};
+
+namespace std {
+template<>
+struct hash<Symbol> {
+  size_t operator()(const Symbol& symbol) const {
+    return std::hash<uint32_t>()(symbol.getId());
+  }
+};
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef TENSOR_H_
+#define TENSOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Dense row-major tensor of doubles; rank 0 is a scalar. The elements live in
+// one contiguous buffer aligned to 64 bytes, which copies of a Tensor share
+// through a reference count, so tensors are passed and stored without copying
+// data. A freshly allocated tensor is filled through data() before it is
+// shared; after that its elements are treated as immutable.
+class Tensor {
+  // Lives in the Alignment bytes just before the elements.
+  struct Header {
+    std::atomic<size_t> RefCount;
+    size_t Size;
+  };
+  double* Data = nullptr;
+  std::vector<size_t> Shape;
+  Header* getHeader() const;
+  void release();
+
+public:
+  static constexpr size_t Alignment = 64;
+  // A tensor of the given shape with uninitialized elements.
+  static Tensor allocate(std::vector<size_t>);
+  static Tensor scalar(double);
+  static Tensor fromValues(std::vector<size_t>, const std::vector<double>&);
+  const std::vector<size_t>& getShape() const;
+  size_t getRank() const;
+  // Number of elements.
+  size_t size() const;
+  const double* data() const;
+  double* data();
+  // The same elements viewed with another shape of the same element count;
+  // the buffer is shared, not copied.
+  Tensor reshape(std::vector<size_t>) const;
+  // Number of Tensors sharing the buffer; 0 for an empty Tensor.
+  size_t getUseCount() const;
+  // Nested brackets, e.g. "[[1, 2], [3, 4.5]]"; a scalar prints bare.
+  void print(std::ostream&) const;
+  // An empty tensor with no buffer, only useful as a placeholder.
+  Tensor() = default;
+  Tensor(const Tensor&);
+  Tensor(Tensor&&) noexcept;
+  Tensor& operator=(const Tensor&);
+  Tensor& operator=(Tensor&&) noexcept;
+  ~Tensor();
+};
+
+std::ostream& operator<<(std::ostream&, const Tensor&);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef TENSOR_OPS_H_
+#define TENSOR_OPS_H_
+
+#include <cstddef>
+#include "parser.h"
+#include "tensor.h"
+
+// Kernels shared by the evaluators. Results are freshly allocated tensors.
+
+// Whether a binary operator accepts the operands: the same shape, or either
+// one a scalar.
+bool canApplyElementwise(const Tensor&, const Tensor&);
+// Applies the operator to matching elements, or to every element and the
+// scalar operand; % is fmod. The result has the shape of the larger operand.
+Tensor applyElementwise(Op, const Tensor&, const Tensor&);
+// The same over count elements; a scalar operand points to one value.
+void applyElementwise(Op, const double*, bool, const double*, bool, double*, size_t);
+// Reverses the dimensions; tensors of rank below 2 are returned as they are.
+Tensor transpose(const Tensor&);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TOKEN_STREAM_H_
+#define TOKEN_STREAM_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lexer.h"
+
+class SourceFile;
+
+// Pull-based source of tokens for the Parser. Tokens are produced only when
+// first peeked or consumed and held in a small ring buffer, so the parser can
+// look a fixed distance ahead without the whole token sequence existing at
+// once. Once the input is exhausted every further token is Eof.
+class TokenStream {
+public:
+  static constexpr size_t MaxLookahead = 4;
+
+private:
+  std::array<LexToken, MaxLookahead> Lookahead;
+  size_t Head = 0;
+  size_t Count = 0;
+
+protected:
+  virtual LexToken pull() = 0;
+
+public:
+  const LexToken& peek(size_t ahead = 0);
+  LexToken next();
+  TokenStream();
+  TokenStream(const TokenStream&) = delete;
+  TokenStream& operator=(const TokenStream&) = delete;
+  virtual ~TokenStream() = default;
+};
+
+// Streams an already scanned token vector, which must end with Eof.
+class VectorTokenStream : public TokenStream {
+  const std::vector<LexToken>& Tokens;
+  size_t Pos = 0;
+
+protected:
+  LexToken pull() override;
+
+public:
+  VectorTokenStream(const std::vector<LexToken>&);
+};
+
+// Materializes compact tokens against their source file one at a time. The
+// stream can be limited to the token range [Begin, End), after which it reads
+// as Eof.
+class CompactTokenStream : public TokenStream {
+  const SourceFile& Source;
+  const std::vector<Token>& Tokens;
+  size_t Pos;
+  size_t End;
+
+protected:
+  LexToken pull() override;
+
+public:
+  // True once a token at or past the end of the range has been pulled.
+  bool reachedEnd() const;
+  CompactTokenStream(const SourceFile&, const std::vector<Token>&, size_t = 0, size_t = SIZE_MAX);
+};
+
+// Supplies raw input in chunks; read returns 0 only at the end of input.
+class ChunkReader {
+public:
+  virtual size_t read(char*, size_t) = 0;
+  virtual ~ChunkReader() = default;
+};
+
+// Reads from a file descriptor the caller keeps open.
+class FdChunkReader : public ChunkReader {
+  int Fd;
+  std::string Name;
+
+public:
+  size_t read(char*, size_t) override;
+  FdChunkReader(int, std::string);
+};
+
+// Hands out an in-memory buffer at most MaxChunk bytes at a time.
+class StringChunkReader : public ChunkReader {
+  std::string_view Text;
+  size_t MaxChunk;
+  size_t Pos = 0;
+
+public:
+  size_t read(char*, size_t) override;
+  StringChunkReader(std::string_view, size_t = SIZE_MAX);
+};
+
+// Scans tokens on demand from a ChunkReader, keeping only the unconsumed tail
+// of the input plus one chunk in memory. Identifier and punctuation tokens
+// reference stable storage; the text of a Number token is only valid until
+// 2 * MaxLookahead further tokens have been pulled.
+class ScannerTokenStream : public TokenStream {
+  ChunkReader& Reader;
+  size_t ChunkSize;
+  std::string Window;
+  size_t Pos = 0;
+  // Stream offset of Window[0], and what lies before it, for locations.
+  size_t WindowOffset = 0;
+  size_t LinesBefore = 0;
+  size_t LastLineStart = 0;
+  bool AtEof = false;
+  bool InComment = false;
+  std::array<std::string, 2 * MaxLookahead> NumberText;
+  size_t NextNumberSlot = 0;
+  bool refill();
+  SourceLocation locate(size_t) const;
+
+protected:
+  LexToken pull() override;
+
+public:
+  ScannerTokenStream(ChunkReader&, size_t = 1 << 16);
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <cstdint>
 #include <memory>
+#include <string_view>
 #include <vector>
 
 template<typename T, typename... Ptrs>
@@ -11,4 +13,14 @@ std::vector<std::unique_ptr<T>> make_vector(Ptrs&&... ptrs) {
   return vec;
 }
 
+// 64-bit FNV-1a, for keying content by its text.
+inline uint64_t hashBytes(std::string_view bytes) {
+  uint64_t h = 14695981039346656037ull;
+  for (char c : bytes) {
+    h ^= (unsigned char)c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
 #endif
@@ -0,0 +1,34 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "arena.h"
+
+void Arena::newBlock(size_t minSize) {
+  size_t blockSize = NextBlockSize;
+  while (blockSize < minSize) {
+    blockSize *= 2;
+  }
+  if (NextBlockSize < MaxBlockSize) {
+    NextBlockSize *= 2;
+  }
+  Blocks.push_back(std::make_unique<char[]>(blockSize));
+  BlockPos = Blocks.back().get();
+  BlockLeft = blockSize;
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+  size_t padding = (align - ((uintptr_t)BlockPos & (align - 1))) & (align - 1);
+  if (BlockPos == nullptr || padding + size > BlockLeft) {
+    newBlock(size + align);
+    padding = (align - ((uintptr_t)BlockPos & (align - 1))) & (align - 1);
+  }
+  char* result = BlockPos + padding;
+  BlockPos += padding + size;
+  BlockLeft -= padding + size;
+  BytesAllocated += size;
+  return result;
+}
+
+size_t Arena::getBytesAllocated() const {
+  return BytesAllocated;
+}
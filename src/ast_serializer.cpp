@@ -0,0 +1,481 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ast_serializer.h"
+#include "casting.h"
+#include "source_file.h"
+#include "utils.h"
+
+namespace {
+
+constexpr char FileMagic[8] = {'D', '-', '-', 'A', 'S', 'T', '\0', '\0'};
+constexpr uint32_t ByteOrderMark = 0x01020304;
+
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrder;
+  uint64_t ContentHash;
+  uint64_t ContentSize;
+  uint32_t NumNumbers;
+  uint32_t NumNodes;
+  uint32_t NumLinks;
+  uint32_t NumDefinitions;
+  uint32_t NumStrings;
+  uint32_t NumDims;
+  uint32_t NumChars;
+  uint32_t Reserved;
+};
+
+// Links[FirstLink, FirstLink + NumLinks) are the children, as distances
+// forward from the node, except where noted:
+//   NumberExpr      Value indexes Numbers
+//   VariableExpr    Name; children are the arguments
+//   BinaryExpr      Flags holds the operator; children are LHS and RHS
+//   ArrayExpr       children are the entries
+//   ConstantTensor  Name indexes Dims and NumLinks is the rank; Value
+//                   indexes the first of the values in Numbers
+//   Assgn           Name; Flags is 1 for declarations; children are the
+//                   size entries followed by the expression
+//   Prototype       Name; links are string indices of the arguments
+//   Function        children are the prototype followed by the body
+struct PackedNode {
+  uint8_t Kind;
+  uint8_t Flags;
+  uint16_t Reserved;
+  uint32_t Offset;
+  uint32_t Name;
+  uint32_t Value;
+  uint32_t FirstLink;
+  uint32_t NumLinks;
+};
+
+struct PackedString {
+  uint32_t Offset;
+  uint32_t Length;
+};
+
+static_assert(sizeof(FileHeader) == 64, "header must keep the number section aligned");
+static_assert(sizeof(PackedNode) == 24, "unexpected padding in PackedNode");
+
+std::runtime_error corruptError() {
+  return std::runtime_error("corrupt serialized module");
+}
+
+class Writer {
+  std::vector<double> Numbers;
+  std::vector<PackedNode> Nodes;
+  std::vector<const Node*> Sources;
+  std::vector<uint32_t> Links;
+  std::vector<uint32_t> Definitions;
+  std::vector<PackedString> Strings;
+  std::vector<uint32_t> Dims;
+  std::string Chars;
+  std::unordered_map<Symbol, uint32_t> StringIndex;
+
+  uint32_t addString(Symbol symbol) {
+    auto [it, inserted] = StringIndex.emplace(symbol, (uint32_t)Strings.size());
+    if (inserted) {
+      std::string_view text = symbol.str();
+      Strings.push_back(PackedString{(uint32_t)Chars.size(), (uint32_t)text.size()});
+      Chars += text;
+    }
+    return it->second;
+  }
+
+  uint32_t addNode(const Node& node) {
+    Nodes.push_back(PackedNode{(uint8_t)node.getKind(), 0, 0, node.getOffset(), 0, 0, 0, 0});
+    Sources.push_back(&node);
+    return (uint32_t)(Nodes.size() - 1);
+  }
+
+  template<typename T>
+  void addChildren(size_t index, const std::vector<std::unique_ptr<T>>& children) {
+    for (const auto& child : children) {
+      Links.push_back(addNode(*child) - (uint32_t)index);
+    }
+  }
+
+  // Fills in the node's fields and queues its children behind every node
+  // already queued, so children always follow their parent.
+  void fill(size_t index) {
+    const Node& node = *Sources[index];
+    PackedNode packed = Nodes[index];
+    packed.FirstLink = (uint32_t)Links.size();
+    switch (node.getKind()) {
+    case NodeKind::NumberExpr:
+      packed.Value = (uint32_t)Numbers.size();
+      Numbers.push_back(cast<NumberExprNode>(node).getValue());
+      break;
+    case NodeKind::VariableExpr: {
+      const auto& variable = cast<VariableExprNode>(node);
+      packed.Name = addString(variable.getName());
+      addChildren(index, variable.getArgs());
+      break;
+    }
+    case NodeKind::BinaryExpr: {
+      const auto& binary = cast<BinaryExprNode>(node);
+      packed.Flags = (uint8_t)binary.getOp();
+      Links.push_back(addNode(binary.getLHS()) - (uint32_t)index);
+      Links.push_back(addNode(binary.getRHS()) - (uint32_t)index);
+      break;
+    }
+    case NodeKind::ArrayExpr:
+      addChildren(index, cast<ArrayExprNode>(node).getEntries());
+      break;
+    case NodeKind::ConstantTensorExpr: {
+      const auto& tensor = cast<ConstantTensorNode>(node);
+      packed.Name = (uint32_t)Dims.size();
+      for (size_t dim : tensor.getShape()) {
+	Dims.push_back((uint32_t)dim);
+      }
+      packed.Value = (uint32_t)Numbers.size();
+      Numbers.insert(Numbers.end(), tensor.getValues().begin(), tensor.getValues().end());
+      packed.NumLinks = (uint32_t)tensor.getShape().size();
+      Nodes[index] = packed;
+      return;
+    }
+    case NodeKind::Assgn: {
+      const auto& assign = cast<AssgnNode>(node);
+      packed.Name = addString(assign.getName());
+      packed.Flags = assign.isDecl() ? 1 : 0;
+      addChildren(index, assign.getSize());
+      Links.push_back(addNode(assign.getExpr()) - (uint32_t)index);
+      break;
+    }
+    case NodeKind::Prototype: {
+      const auto& prototype = cast<PrototypeNode>(node);
+      packed.Name = addString(prototype.getName());
+      for (Symbol arg : prototype.getArgs()) {
+	Links.push_back(addString(arg));
+      }
+      break;
+    }
+    case NodeKind::Function: {
+      const auto& function = cast<FunctionNode>(node);
+      Links.push_back(addNode(function.getPrototype()) - (uint32_t)index);
+      addChildren(index, function.getBody());
+      break;
+    }
+    }
+    packed.NumLinks = (uint32_t)Links.size() - packed.FirstLink;
+    Nodes[index] = packed;
+  }
+
+  template<typename T>
+  static void append(std::string& out, const std::vector<T>& section) {
+    out.append((const char*)section.data(), section.size() * sizeof(T));
+  }
+
+public:
+  std::string write(const std::vector<std::unique_ptr<Node>>& definitions, uint64_t contentHash,
+		    uint64_t contentSize) {
+    for (const auto& definition : definitions) {
+      Definitions.push_back(addNode(*definition));
+    }
+    for (size_t i = 0; i < Nodes.size(); i++) {
+      fill(i);
+    }
+    FileHeader header;
+    std::memcpy(header.Magic, FileMagic, sizeof(FileMagic));
+    header.Version = ASTSerializer::FormatVersion;
+    header.ByteOrder = ByteOrderMark;
+    header.ContentHash = contentHash;
+    header.ContentSize = contentSize;
+    header.NumNumbers = (uint32_t)Numbers.size();
+    header.NumNodes = (uint32_t)Nodes.size();
+    header.NumLinks = (uint32_t)Links.size();
+    header.NumDefinitions = (uint32_t)Definitions.size();
+    header.NumStrings = (uint32_t)Strings.size();
+    header.NumDims = (uint32_t)Dims.size();
+    header.NumChars = (uint32_t)Chars.size();
+    header.Reserved = 0;
+    std::string out((const char*)&header, sizeof(header));
+    append(out, Numbers);
+    append(out, Nodes);
+    append(out, Links);
+    append(out, Definitions);
+    append(out, Strings);
+    append(out, Dims);
+    out += Chars;
+    return out;
+  }
+};
+
+// Sections are read in place; fields go through memcpy so the data need not
+// be aligned.
+template<typename T>
+class Section {
+  const char* Data = nullptr;
+  size_t Size = 0;
+
+public:
+  size_t size() const { return Size; }
+  T operator[](size_t index) const {
+    T value;
+    std::memcpy(&value, Data + index * sizeof(T), sizeof(T));
+    return value;
+  }
+  Section(std::string_view data, size_t& pos, size_t size) {
+    if (size > (data.size() - pos) / sizeof(T)) {
+      throw corruptError();
+    }
+    Data = data.data() + pos;
+    Size = size;
+    pos += size * sizeof(T);
+  }
+};
+
+bool readHeader(std::string_view data, FileHeader& header) {
+  if (data.size() < sizeof(FileHeader)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(FileHeader));
+  return std::memcmp(header.Magic, FileMagic, sizeof(FileMagic)) == 0 &&
+    header.Version == ASTSerializer::FormatVersion && header.ByteOrder == ByteOrderMark;
+}
+
+template<typename T, typename... Args>
+std::unique_ptr<T> makeNode(Arena* arena, Args&&... args) {
+  if (arena != nullptr) {
+    return std::unique_ptr<T>(new (*arena) T(std::forward<Args>(args)...));
+  }
+  return std::make_unique<T>(std::forward<Args>(args)...);
+}
+
+class Reader {
+  Section<double> Numbers;
+  Section<PackedNode> Nodes;
+  Section<uint32_t> Links;
+  Section<uint32_t> Definitions;
+  Section<PackedString> Strings;
+  Section<uint32_t> Dims;
+  std::string_view Chars;
+  std::vector<Symbol> Symbols;
+  std::vector<std::unique_ptr<Node>> Built;
+  Arena* NodeArena;
+
+  Symbol symbol(uint32_t index) const {
+    if (index >= Symbols.size()) {
+      throw corruptError();
+    }
+    return Symbols[index];
+  }
+
+  // Takes ownership of a child that has already been built; each node can
+  // only be taken once.
+  template<typename T>
+  std::unique_ptr<T> take(size_t index, uint32_t link) {
+    size_t child = index + Links[link];
+    if (child <= index || child >= Built.size() || Built[child] == nullptr || !isa<T>(Built[child].get())) {
+      throw corruptError();
+    }
+    return std::unique_ptr<T>(cast<T>(Built[child].release()));
+  }
+
+  template<typename T>
+  std::vector<std::unique_ptr<T>> takeRange(size_t index, uint32_t first, uint32_t count) {
+    std::vector<std::unique_ptr<T>> children;
+    children.reserve(count);
+    for (uint32_t link = first; link < first + count; link++) {
+      children.push_back(take<T>(index, link));
+    }
+    return children;
+  }
+
+  std::unique_ptr<Node> build(size_t index) {
+    PackedNode packed = Nodes[index];
+    if ((uint64_t)packed.FirstLink + packed.NumLinks > Links.size()) {
+      throw corruptError();
+    }
+    uint32_t first = packed.FirstLink;
+    uint32_t count = packed.NumLinks;
+    switch ((NodeKind)packed.Kind) {
+    case NodeKind::NumberExpr:
+      if (packed.Value >= Numbers.size()) {
+	throw corruptError();
+      }
+      return makeNode<NumberExprNode>(NodeArena, Numbers[packed.Value]);
+    case NodeKind::VariableExpr:
+      return makeNode<VariableExprNode>(NodeArena, symbol(packed.Name), takeRange<ExprNode>(index, first, count));
+    case NodeKind::BinaryExpr: {
+      char op = (char)packed.Flags;
+      if (count != 2 || (op != '+' && op != '-' && op != '*' && op != '/' && op != '%')) {
+	throw corruptError();
+      }
+      std::unique_ptr<ExprNode> lhs = take<ExprNode>(index, first);
+      std::unique_ptr<ExprNode> rhs = take<ExprNode>(index, first + 1);
+      return makeNode<BinaryExprNode>(NodeArena, (Op)op, std::move(lhs), std::move(rhs));
+    }
+    case NodeKind::ArrayExpr:
+      return makeNode<ArrayExprNode>(NodeArena, takeRange<ExprNode>(index, first, count));
+    case NodeKind::ConstantTensorExpr: {
+      if ((uint64_t)packed.Name + count > Dims.size()) {
+	throw corruptError();
+      }
+      std::vector<size_t> shape;
+      uint64_t numValues = 1;
+      for (uint32_t i = 0; i < count; i++) {
+	shape.push_back(Dims[packed.Name + i]);
+	numValues *= shape.back();
+	if (numValues > Numbers.size()) {
+	  throw corruptError();
+	}
+      }
+      if (packed.Value + numValues > Numbers.size()) {
+	throw corruptError();
+      }
+      std::vector<double> values(numValues);
+      for (size_t i = 0; i < numValues; i++) {
+	values[i] = Numbers[packed.Value + i];
+      }
+      return makeNode<ConstantTensorNode>(NodeArena, std::move(shape), std::move(values));
+    }
+    case NodeKind::Assgn: {
+      if (count == 0) {
+	throw corruptError();
+      }
+      std::vector<std::unique_ptr<NumberExprNode>> size = takeRange<NumberExprNode>(index, first, count - 1);
+      std::unique_ptr<ExprNode> expr = take<ExprNode>(index, first + count - 1);
+      return makeNode<AssgnNode>(NodeArena, symbol(packed.Name), std::move(size), std::move(expr),
+				 packed.Flags != 0);
+    }
+    case NodeKind::Prototype: {
+      std::vector<Symbol> args;
+      for (uint32_t link = first; link < first + count; link++) {
+	args.push_back(symbol(Links[link]));
+      }
+      return makeNode<PrototypeNode>(NodeArena, symbol(packed.Name), std::move(args));
+    }
+    case NodeKind::Function: {
+      if (count == 0) {
+	throw corruptError();
+      }
+      std::unique_ptr<PrototypeNode> prototype = take<PrototypeNode>(index, first);
+      return makeNode<FunctionNode>(NodeArena, std::move(prototype), takeRange<StmtNode>(index, first + 1, count - 1));
+    }
+    }
+    throw corruptError();
+  }
+
+public:
+  Reader(std::string_view data, const FileHeader& header, size_t pos)
+    : Numbers(data, pos, header.NumNumbers), Nodes(data, pos, header.NumNodes), Links(data, pos, header.NumLinks),
+      Definitions(data, pos, header.NumDefinitions), Strings(data, pos, header.NumStrings),
+      Dims(data, pos, header.NumDims), Chars(data.substr(pos)) {
+    if (Chars.size() != header.NumChars) {
+      throw corruptError();
+    }
+  }
+
+  // Children follow their parents in the node array, so building from the
+  // back finds every child ready without recursing.
+  void read(Module& module) {
+    NodeArena = module.getArena();
+    Symbols.reserve(Strings.size());
+    for (size_t i = 0; i < Strings.size(); i++) {
+      PackedString string = Strings[i];
+      if ((uint64_t)string.Offset + string.Length > Chars.size()) {
+	throw corruptError();
+      }
+      Symbols.push_back(Symbol(Chars.substr(string.Offset, string.Length)));
+    }
+    Built.resize(Nodes.size());
+    for (size_t i = Nodes.size(); i > 0; i--) {
+      Built[i - 1] = build(i - 1);
+      Built[i - 1]->setOffset(Nodes[i - 1].Offset);
+    }
+    for (size_t i = 0; i < Definitions.size(); i++) {
+      uint32_t index = Definitions[i];
+      if (index >= Built.size() || Built[index] == nullptr ||
+	  !(isa<PrototypeNode>(Built[index].get()) || isa<FunctionNode>(Built[index].get()))) {
+	throw corruptError();
+      }
+      module.getDefinitions().push_back(std::move(Built[index]));
+    }
+    for (const auto& node : Built) {
+      if (node != nullptr) {
+	throw corruptError();
+      }
+    }
+  }
+};
+
+} // namespace
+
+std::string ASTSerializer::serialize(const Module& module, uint64_t contentHash, uint64_t contentSize) {
+  return Writer().write(module.getDefinitions(), contentHash, contentSize);
+}
+
+Module ASTSerializer::deserialize(std::string_view data, NodeAllocation allocation) {
+  FileHeader header;
+  if (!readHeader(data, header)) {
+    throw std::runtime_error("not a serialized module of format version " + std::to_string(FormatVersion));
+  }
+  Module module(allocation);
+  Reader(data, header, sizeof(FileHeader)).read(module);
+  return module;
+}
+
+std::optional<std::pair<uint64_t, uint64_t>> ASTSerializer::readContentKey(std::string_view data) {
+  FileHeader header;
+  if (!readHeader(data, header)) {
+    return std::nullopt;
+  }
+  return std::make_pair(header.ContentHash, header.ContentSize);
+}
+
+ModuleCache::ModuleCache(std::string dir) : Dir(std::move(dir)) {}
+
+std::string ModuleCache::getPath(uint64_t contentHash) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.dast", (unsigned long long)contentHash);
+  return Dir + "/" + name;
+}
+
+std::optional<Module> ModuleCache::load(std::string_view text, NodeAllocation allocation) const {
+  uint64_t contentHash = hashBytes(text);
+  try {
+    SourceFile entry = SourceFile::open(getPath(contentHash));
+    if (ASTSerializer::readContentKey(entry.getText()) != std::make_pair(contentHash, (uint64_t)text.size())) {
+      return std::nullopt;
+    }
+    return ASTSerializer::deserialize(entry.getText(), allocation);
+  } catch (const std::runtime_error&) {
+    return std::nullopt;
+  }
+}
+
+// Written to a temporary file and renamed into place, so concurrent readers
+// never see a partial entry.
+void ModuleCache::store(std::string_view text, const Module& module) const {
+  if (module.getDiagnostics().hasErrors()) {
+    return;
+  }
+  if (::mkdir(Dir.c_str(), 0777) != 0 && errno != EEXIST) {
+    throw std::runtime_error(Dir + ": cannot create cache directory: " + std::strerror(errno));
+  }
+  uint64_t contentHash = hashBytes(text);
+  std::string path = getPath(contentHash);
+  std::string tempPath = path + ".tmp" + std::to_string(::getpid());
+  std::string data = ASTSerializer::serialize(module, contentHash, text.size());
+  {
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), (std::streamsize)data.size());
+    if (!out.flush()) {
+      std::remove(tempPath.c_str());
+      throw std::runtime_error(tempPath + ": cannot write cache entry");
+    }
+  }
+  if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    throw std::runtime_error(path + ": cannot write cache entry: " + std::strerror(errno));
+  }
+}
@@ -0,0 +1,621 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include "ast_visitor.h"
+#include "bytecode.h"
+#include "casting.h"
+#include "shape_inference.h"
+#include "tensor_ops.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DMM_HAVE_COMPUTED_GOTO 1
+#endif
+
+namespace {
+
+// Lowers one function body. Visiting an expression emits its code and yields
+// the register that holds its value.
+class FunctionCompiler : public ConstASTVisitor<FunctionCompiler, uint32_t> {
+  BytecodeModule& Program;
+  BytecodeFunction& Function;
+  const std::unordered_map<Symbol, const Node*>& Definitions;
+  const FusionPlan* Plan;
+  std::unordered_map<Symbol, uint32_t> Variables;
+  std::unordered_map<uint64_t, uint32_t> ScalarConstants;
+  uint32_t NextRegister = 0;
+  // First register of the temporaries of the current statement.
+  uint32_t StatementStart = 0;
+
+  uint32_t allocate() {
+    Function.NumRegisters = std::max(Function.NumRegisters, NextRegister + 1);
+    return NextRegister++;
+  }
+
+  void emit(const Node& node, Opcode code, uint32_t a, uint32_t b = 0, uint32_t c = 0) {
+    Function.Code.push_back({code, a, b, c});
+    Function.Offsets.push_back(node.getOffset());
+  }
+
+  void fail(const Node& node, std::string message) {
+    emit(node, Opcode::Fail, (uint32_t)Program.Messages.size());
+    Program.Messages.push_back(std::move(message));
+  }
+
+  uint32_t loadConstant(const Node& node, Tensor value) {
+    uint32_t result = allocate();
+    emit(node, Opcode::LoadConst, result, (uint32_t)Program.Constants.size());
+    Program.Constants.push_back(std::move(value));
+    return result;
+  }
+
+  // Print and calls of defined functions are the only expressions that can
+  // lack a value.
+  static bool mayLackValue(const ExprNode& expr) {
+    auto* call = dyn_cast<VariableExprNode>(&expr);
+    return call != nullptr && !call->getArgs().empty() && call->getName().str() != "transpose";
+  }
+
+  // An operand of an operator, entry, argument or assignment, which must
+  // have a value.
+  uint32_t compileValue(const ExprNode& expr) {
+    uint32_t result = visit(expr);
+    if (mayLackValue(expr)) {
+      emit(expr, Opcode::Require, result);
+    }
+    return result;
+  }
+
+  // Puts the values of the expressions in consecutive registers and returns
+  // the first.
+  template<typename Exprs>
+  uint32_t compileOperands(const Exprs& exprs) {
+    std::vector<uint32_t> registers;
+    for (const auto& expr : exprs) {
+      registers.push_back(compileValue(*expr));
+    }
+    bool consecutive = true;
+    for (size_t i = 1; i < registers.size(); i++) {
+      consecutive = consecutive && registers[i] == registers[0] + i;
+    }
+    if (consecutive && !registers.empty()) {
+      return registers[0];
+    }
+    uint32_t first = NextRegister;
+    for (size_t i = 0; i < exprs.size(); i++) {
+      emit(*exprs[i], Opcode::Move, allocate(), registers[i]);
+    }
+    return first;
+  }
+
+  bool checkArity(const VariableExprNode& call, size_t expected) {
+    if (call.getArgs().size() == expected) {
+      return true;
+    }
+    fail(call, "'" + std::string(call.getName().str()) + "' expects " + std::to_string(expected) +
+	 " argument" + (expected == 1 ? "" : "s") + " but got " + std::to_string(call.getArgs().size()));
+    return false;
+  }
+
+  // Whether a leaf can be computed ahead of the operators before it.
+  bool isPure(const ExprNode& expr) const {
+    if (isa<NumberExprNode>(expr) || isa<ConstantTensorNode>(expr)) {
+      return true;
+    }
+    auto* variable = dyn_cast<VariableExprNode>(&expr);
+    return variable && variable->getArgs().empty() && Variables.count(variable->getName()) != 0;
+  }
+
+  // The fused tree rooted at the expression, if its leaves allow fusing it.
+  const FusedExpr* findFused(const ExprNode& expr) const {
+    const FusedExpr* fused = Plan ? Plan->find(expr) : nullptr;
+    if (fused == nullptr) {
+      return nullptr;
+    }
+    bool afterOperator = false;
+    for (const FusedExpr::Step& step : fused->Steps) {
+      if (step.Kind == FusedExpr::StepKind::Binary) {
+	afterOperator = true;
+      } else if (step.Kind == FusedExpr::StepKind::Leaf && afterOperator &&
+		 !isPure(*fused->Leaves[step.Leaf].Expr)) {
+	return nullptr;
+      }
+    }
+    return fused;
+  }
+
+  uint32_t compileFused(const ExprNode& root, const FusedExpr& fused) {
+    std::vector<const ExprNode*> leaves;
+    for (const FusedExpr::Leaf& leaf : fused.Leaves) {
+      leaves.push_back(leaf.Expr);
+    }
+    uint32_t first = compileOperands(leaves);
+    uint32_t result = allocate();
+    emit(root, Opcode::Fused, result, first, (uint32_t)Program.Kernels.size());
+    Program.Kernels.push_back(fused);
+    return result;
+  }
+
+  uint32_t compileCall(const VariableExprNode& call) {
+    uint32_t args = compileOperands(call.getArgs());
+    uint32_t result = allocate();
+    std::string_view name = call.getName().str();
+    if (name == "print") {
+      if (checkArity(call, 1)) {
+	emit(call, Opcode::Print, result, args);
+      }
+      return result;
+    }
+    if (name == "transpose") {
+      if (checkArity(call, 1)) {
+	emit(call, Opcode::Transpose, result, args);
+      }
+      return result;
+    }
+    auto it = Definitions.find(call.getName());
+    if (it == Definitions.end()) {
+      fail(call, "unknown function '" + std::string(name) + "'");
+      return result;
+    }
+    if (auto* prototype = dyn_cast<PrototypeNode>(it->second)) {
+      if (checkArity(call, prototype->getArgs().size())) {
+	auto extern_ = std::find(Program.Externs.begin(), Program.Externs.end(), call.getName());
+	emit(call, Opcode::CallExtern, result, args, (uint32_t)(extern_ - Program.Externs.begin()));
+      }
+      return result;
+    }
+    const auto& callee = cast<FunctionNode>(*it->second);
+    if (checkArity(call, callee.getPrototype().getArgs().size())) {
+      emit(call, Opcode::Call, result, args, Program.FunctionIndex.at(call.getName()));
+    }
+    return result;
+  }
+
+public:
+  uint32_t visitNumberExprNode(const NumberExprNode& node) {
+    double value = node.getValue();
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto [it, inserted] = ScalarConstants.emplace(bits, (uint32_t)Program.Constants.size());
+    if (inserted) {
+      Program.Constants.push_back(Tensor::scalar(value));
+    }
+    uint32_t result = allocate();
+    emit(node, Opcode::LoadConst, result, it->second);
+    return result;
+  }
+
+  uint32_t visitConstantTensorNode(const ConstantTensorNode& node) {
+    return loadConstant(node, Tensor::fromValues(node.getShape(), node.getValues()));
+  }
+
+  uint32_t visitArrayExprNode(const ArrayExprNode& node) {
+    uint32_t entries = compileOperands(node.getEntries());
+    uint32_t result = allocate();
+    emit(node, Opcode::Pack, result, entries, (uint32_t)Program.ArrayEntryOffsets.size());
+    std::vector<uint32_t> entryOffsets;
+    for (const auto& entry : node.getEntries()) {
+      entryOffsets.push_back(entry->getOffset());
+    }
+    Program.ArrayEntryOffsets.push_back(std::move(entryOffsets));
+    return result;
+  }
+
+  uint32_t visitBinaryExprNode(const BinaryExprNode& node) {
+    if (const FusedExpr* fused = findFused(node)) {
+      return compileFused(node, *fused);
+    }
+    uint32_t lhs = compileValue(node.getLHS());
+    uint32_t rhs = compileValue(node.getRHS());
+    uint32_t result = allocate();
+    Opcode code = Opcode::Mod;
+    switch (node.getOp()) {
+    case Op::Plus:
+      code = Opcode::Add;
+      break;
+    case Op::Minus:
+      code = Opcode::Sub;
+      break;
+    case Op::Times:
+      code = Opcode::Mul;
+      break;
+    case Op::Divide:
+      code = Opcode::Div;
+      break;
+    case Op::Modulus:
+      break;
+    }
+    emit(node, code, result, lhs, rhs);
+    return result;
+  }
+
+  uint32_t visitVariableExprNode(const VariableExprNode& node) {
+    if (const FusedExpr* fused = findFused(node)) {
+      return compileFused(node, *fused);
+    }
+    if (!node.getArgs().empty()) {
+      return compileCall(node);
+    }
+    auto it = Variables.find(node.getName());
+    if (it == Variables.end()) {
+      fail(node, "unknown variable '" + std::string(node.getName().str()) + "'");
+      return allocate();
+    }
+    return it->second;
+  }
+
+  // The parser records a missing size as <1>, which keeps the value's shape.
+  uint32_t visitAssgnNode(const AssgnNode& node) {
+    // A new variable takes the next register, before the temporaries.
+    auto it = Variables.find(node.getName());
+    uint32_t target = (it != Variables.end()) ? it->second : allocate();
+    uint32_t value = compileValue(node.getExpr());
+    const auto& size = node.getSize();
+    if (node.isDecl() && !(size.size() == 1 && size[0]->getValue() == 1)) {
+      std::vector<size_t> dims;
+      for (const auto& dim : size) {
+	double extent = dim->getValue();
+	if (extent < 1 || extent != std::floor(extent)) {
+	  fail(*dim, "dimension must be a positive integer");
+	  return target;
+	}
+	dims.push_back((size_t)extent);
+      }
+      emit(node, Opcode::Reshape, target, value, (uint32_t)Program.Shapes.size());
+      Program.Shapes.push_back(std::move(dims));
+    } else if (target != value) {
+      // The value is usually a temporary that the last instruction produced,
+      // which can write the variable directly.
+      Instruction* last = (value >= StatementStart) ? &Function.Code.back() : nullptr;
+      if (last != nullptr && last->A == value && last->Code != Opcode::Require && last->Code != Opcode::Fail) {
+	last->A = target;
+      } else {
+	emit(node, Opcode::Move, target, value);
+      }
+    }
+    Variables[node.getName()] = target;
+    return target;
+  }
+
+  void run(const FunctionNode& node) {
+    const auto& params = node.getPrototype().getArgs();
+    for (Symbol param : params) {
+      Variables[param] = allocate();
+    }
+    Function.NumParams = (uint32_t)params.size();
+    const auto& body = node.getBody();
+    for (size_t i = 0; i < body.size(); i++) {
+      const StmtNode& stmt = *body[i];
+      // The temporaries of a statement are released once it is done; only a
+      // newly declared variable keeps its register.
+      size_t numVariables = Variables.size();
+      uint32_t mark = NextRegister;
+      StatementStart = mark;
+      uint32_t result = visit(stmt);
+      if (i + 1 == body.size() && !isa<AssgnNode>(&stmt)) {
+	emit(stmt, Opcode::Return, result);
+	return;
+      }
+      NextRegister = mark + (uint32_t)(Variables.size() - numVariables);
+    }
+    emit(node, Opcode::ReturnNone, 0);
+  }
+
+  FunctionCompiler(BytecodeModule& program, BytecodeFunction& function,
+		   const std::unordered_map<Symbol, const Node*>& definitions, const FusionPlan* plan)
+    : Program(program), Function(function), Definitions(definitions), Plan(plan) {}
+};
+
+} // namespace
+
+BytecodeModule BytecodeModule::compile(const Module& module, Fusion fusion) {
+  BytecodeModule program;
+  std::optional<FusionPlan> plan;
+  if (fusion == Fusion::Enabled) {
+    plan.emplace(module);
+  }
+  std::unordered_map<Symbol, const Node*> definitions;
+  std::vector<const FunctionNode*> functions;
+  for (const auto& definition : module.getDefinitions()) {
+    if (auto* function = dyn_cast<FunctionNode>(definition.get())) {
+      Symbol name = function->getPrototype().getName();
+      if (definitions.emplace(name, function).second) {
+	program.FunctionIndex.emplace(name, (uint32_t)functions.size());
+	functions.push_back(function);
+      }
+    } else {
+      const auto& prototype = cast<PrototypeNode>(*definition);
+      if (definitions.emplace(prototype.getName(), &prototype).second) {
+	program.Externs.push_back(prototype.getName());
+	program.ExternArity.push_back((uint32_t)prototype.getArgs().size());
+      }
+    }
+  }
+  program.Functions.resize(functions.size());
+  for (size_t i = 0; i < functions.size(); i++) {
+    program.Functions[i].Name = functions[i]->getPrototype().getName();
+    FunctionCompiler(program, program.Functions[i], definitions, plan ? &*plan : nullptr).run(*functions[i]);
+  }
+  return program;
+}
+
+void BytecodeModule::disassemble(std::ostream& out) const {
+  static const char* const names[] = {"loadconst", "move",	   "add",	"sub",	    "mul",  "div",
+				      "mod",	   "transpose", "fused",	"pack",	    "reshape", "print",
+				      "call",	   "callextern", "require", "fail",	    "return", "returnnone"};
+  static_assert(sizeof(names) / sizeof(names[0]) == (size_t)Opcode::NumOpcodes);
+  for (const BytecodeFunction& function : Functions) {
+    out << "def " << function.Name.str() << " (" << function.NumParams << " params, " << function.NumRegisters
+	<< " registers)\n";
+    for (const Instruction& inst : function.Code) {
+      out << "  ";
+      switch (inst.Code) {
+      case Opcode::Print:
+      case Opcode::Transpose:
+      case Opcode::Move:
+	out << "r" << inst.A << " = " << names[(size_t)inst.Code] << " r" << inst.B;
+	break;
+      case Opcode::LoadConst:
+	out << "r" << inst.A << " = loadconst " << Constants[inst.B];
+	break;
+      case Opcode::Reshape:
+	out << "r" << inst.A << " = reshape r" << inst.B << " to " << TensorShape(Shapes[inst.C]).str();
+	break;
+      case Opcode::Fused:
+	out << "r" << inst.A << " = fused r" << inst.B << ".." << inst.B + Kernels[inst.C].Leaves.size();
+	break;
+      case Opcode::Pack:
+	out << "r" << inst.A << " = pack r" << inst.B << ".." << inst.B + ArrayEntryOffsets[inst.C].size();
+	break;
+      case Opcode::Call:
+	out << "r" << inst.A << " = call " << Functions[inst.C].Name.str() << " r" << inst.B;
+	break;
+      case Opcode::CallExtern:
+	out << "r" << inst.A << " = callextern " << Externs[inst.C].str() << " r" << inst.B;
+	break;
+      case Opcode::Require:
+      case Opcode::Return:
+	out << names[(size_t)inst.Code] << " r" << inst.A;
+	break;
+      case Opcode::Fail:
+	out << "fail \"" << Messages[inst.A] << "\"";
+	break;
+      case Opcode::ReturnNone:
+	out << "returnnone";
+	break;
+      default:
+	out << "r" << inst.A << " = " << names[(size_t)inst.Code] << " r" << inst.B << ", r" << inst.C;
+	break;
+      }
+      out << "\n";
+    }
+  }
+}
+
+BytecodeVM::BytecodeVM(const BytecodeModule& program, std::ostream& out)
+  : Program(program), Out(out), Natives(program.Externs.size()) {}
+
+void BytecodeVM::defineExtern(Symbol name, Interpreter::NativeFunction function) {
+  auto it = std::find(Program.Externs.begin(), Program.Externs.end(), name);
+  if (it != Program.Externs.end()) {
+    Natives[it - Program.Externs.begin()] = std::move(function);
+  }
+}
+
+[[noreturn]] static void fail(const BytecodeFunction& function, const Instruction* ip, const std::string& message) {
+  throw InterpreterError(function.Offsets[ip - function.Code.data()], message);
+}
+
+Tensor BytecodeVM::execute(const BytecodeFunction& entry, std::vector<Tensor> args) {
+  size_t entryDepth = Frames.size();
+  size_t entryBase = Registers.size();
+  Registers.resize(entryBase + entry.NumRegisters);
+  std::move(args.begin(), args.end(), Registers.begin() + entryBase);
+  Frames.push_back({&entry, nullptr, entryBase, 0});
+  const BytecodeFunction* function = &entry;
+  const Instruction* ip = entry.Code.data();
+  Tensor* regs = Registers.data() + entryBase;
+
+#ifdef DMM_HAVE_COMPUTED_GOTO
+  // In Opcode order.
+  static void* const labels[] = {&&Op_LoadConst, &&Op_Move,	   &&Op_Add,	 &&Op_Sub,	&&Op_Mul,
+				 &&Op_Div,	 &&Op_Mod,	   &&Op_Transpose, &&Op_Fused,	&&Op_Pack,
+				 &&Op_Reshape,	 &&Op_Print,	   &&Op_Call,	 &&Op_CallExtern, &&Op_Require,
+				 &&Op_Fail,	 &&Op_Return,	   &&Op_ReturnNone};
+  static_assert(sizeof(labels) / sizeof(labels[0]) == (size_t)Opcode::NumOpcodes);
+#define CASE(name) Op_##name
+#define DISPATCH() goto *labels[(size_t)ip->Code]
+#else
+#define CASE(name) case Opcode::name
+#define DISPATCH() goto dispatch
+#endif
+
+#define BINARY_OP(name, op)							\
+  CASE(name) : {								\
+    const Tensor& lhs = regs[ip->B];						\
+    const Tensor& rhs = regs[ip->C];						\
+    if (!canApplyElementwise(lhs, rhs)) {					\
+      fail(*function, ip, std::string("operands of '") + (char)op + "' have shapes " + \
+	   TensorShape(lhs.getShape()).str() + " and " + TensorShape(rhs.getShape()).str()); \
+    }										\
+    regs[ip->A] = applyElementwise(op, lhs, rhs);				\
+    ip++;									\
+    DISPATCH();									\
+  }
+
+  try {
+#ifdef DMM_HAVE_COMPUTED_GOTO
+    DISPATCH();
+#else
+  dispatch:
+    switch (ip->Code) {
+#endif
+    CASE(LoadConst) : {
+      regs[ip->A] = Program.Constants[ip->B];
+      ip++;
+      DISPATCH();
+    }
+    CASE(Move) : {
+      regs[ip->A] = regs[ip->B];
+      ip++;
+      DISPATCH();
+    }
+    BINARY_OP(Add, Op::Plus)
+    BINARY_OP(Sub, Op::Minus)
+    BINARY_OP(Mul, Op::Times)
+    BINARY_OP(Div, Op::Divide)
+    BINARY_OP(Mod, Op::Modulus)
+    CASE(Transpose) : {
+      regs[ip->A] = transpose(regs[ip->B]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(Fused) : {
+      const Tensor* leaves = regs + ip->B;
+      regs[ip->A] = Program.Kernels[ip->C].evaluate([leaves](uint32_t leaf) { return leaves[leaf]; });
+      ip++;
+      DISPATCH();
+    }
+    CASE(Pack) : {
+      const Tensor* entries = regs + ip->B;
+      const std::vector<uint32_t>& entryOffsets = Program.ArrayEntryOffsets[ip->C];
+      uint32_t count = (uint32_t)entryOffsets.size();
+      std::vector<size_t> dims{count};
+      for (uint32_t i = 1; i < count; i++) {
+	if (entries[i].getShape() != entries[0].getShape()) {
+	  throw InterpreterError(entryOffsets[i], "array entry has shape " + TensorShape(entries[i].getShape()).str() +
+				 " but the previous entries have shape " + TensorShape(entries[0].getShape()).str());
+	}
+      }
+      if (count > 0) {
+	dims.insert(dims.end(), entries[0].getShape().begin(), entries[0].getShape().end());
+      }
+      Tensor result = Tensor::allocate(std::move(dims));
+      double* out = result.data();
+      for (uint32_t i = 0; i < count; i++) {
+	out = std::copy(entries[i].data(), entries[i].data() + entries[i].size(), out);
+      }
+      regs[ip->A] = std::move(result);
+      ip++;
+      DISPATCH();
+    }
+    CASE(Reshape) : {
+      const Tensor& value = regs[ip->B];
+      const std::vector<size_t>& dims = Program.Shapes[ip->C];
+      if (TensorShape(dims).getNumElements() != value.size()) {
+	fail(*function, ip, "cannot reshape a value of shape " + TensorShape(value.getShape()).str() + " to " +
+	     TensorShape(dims).str());
+      }
+      regs[ip->A] = value.reshape(dims);
+      ip++;
+      DISPATCH();
+    }
+    CASE(Print) : {
+      Out << regs[ip->B] << "\n";
+      regs[ip->A] = Tensor();
+      ip++;
+      DISPATCH();
+    }
+    CASE(Call) : {
+      const BytecodeFunction& callee = Program.Functions[ip->C];
+      if (Frames.size() == Interpreter::MaxCallDepth) {
+	fail(*function, ip, "call depth exceeds " + std::to_string(Interpreter::MaxCallDepth));
+      }
+      size_t callerBase = Frames.back().Base;
+      size_t calleeBase = Registers.size();
+      Registers.resize(calleeBase + callee.NumRegisters);
+      regs = Registers.data() + callerBase;
+      Tensor* calleeRegs = Registers.data() + calleeBase;
+      for (uint32_t i = 0; i < callee.NumParams; i++) {
+	calleeRegs[i] = regs[ip->B + i];
+      }
+      Frames.push_back({&callee, ip + 1, calleeBase, ip->A});
+      function = &callee;
+      regs = calleeRegs;
+      ip = callee.Code.data();
+      DISPATCH();
+    }
+    CASE(CallExtern) : {
+      const Interpreter::NativeFunction& native = Natives[ip->C];
+      if (!native) {
+	fail(*function, ip, "extern function '" + std::string(Program.Externs[ip->C].str()) +
+	     "' has no implementation");
+      }
+      regs[ip->A] = native(std::vector<Tensor>(regs + ip->B, regs + ip->B + Program.ExternArity[ip->C]));
+      ip++;
+      DISPATCH();
+    }
+    CASE(Require) : {
+      if (regs[ip->A].data() == nullptr) {
+	fail(*function, ip, "expression has no value");
+      }
+      ip++;
+      DISPATCH();
+    }
+    CASE(Fail) : {
+      fail(*function, ip, Program.Messages[ip->A]);
+    }
+    CASE(Return) : {
+      Tensor result = std::move(regs[ip->A]);
+      Frame frame = Frames.back();
+      Frames.pop_back();
+      Registers.resize(frame.Base);
+      if (Frames.size() == entryDepth) {
+	return result;
+      }
+      function = Frames.back().Function;
+      regs = Registers.data() + Frames.back().Base;
+      regs[frame.Result] = std::move(result);
+      ip = frame.ReturnAddress;
+      DISPATCH();
+    }
+    CASE(ReturnNone) : {
+      Frame frame = Frames.back();
+      Frames.pop_back();
+      Registers.resize(frame.Base);
+      if (Frames.size() == entryDepth) {
+	return Tensor();
+      }
+      function = Frames.back().Function;
+      regs = Registers.data() + Frames.back().Base;
+      regs[frame.Result] = Tensor();
+      ip = frame.ReturnAddress;
+      DISPATCH();
+    }
+#ifndef DMM_HAVE_COMPUTED_GOTO
+    case Opcode::NumOpcodes:
+      break;
+    }
+#endif
+  } catch (...) {
+    Frames.resize(entryDepth);
+    Registers.resize(entryBase);
+    throw;
+  }
+#undef BINARY_OP
+#undef DISPATCH
+#undef CASE
+  return Tensor();
+}
+
+std::optional<Tensor> BytecodeVM::call(Symbol name, std::vector<Tensor> args) {
+  auto it = Program.FunctionIndex.find(name);
+  if (it == Program.FunctionIndex.end()) {
+    throw std::runtime_error("no function named '" + std::string(name.str()) + "'");
+  }
+  const BytecodeFunction& function = Program.Functions[it->second];
+  if (function.NumParams != args.size()) {
+    throw std::runtime_error("'" + std::string(name.str()) + "' expects " + std::to_string(function.NumParams) +
+			     " arguments");
+  }
+  Tensor result = execute(function, std::move(args));
+  if (result.data() == nullptr) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+void BytecodeVM::run() {
+  call(Symbol("main"), {});
+  Out.flush();
+}
@@ -0,0 +1,254 @@
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <string_view>
+#include "char_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DMM_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*ScanFn)(const char*, size_t, size_t);
+
+static size_t skipWhitespaceScalar(const char* data, size_t pos, size_t end) {
+  while (pos < end && isWhitespaceChar(data[pos])) {
+    pos += 1;
+  }
+  return pos;
+}
+
+static size_t skipToLineEndScalar(const char* data, size_t pos, size_t end) {
+  while (pos < end && !isLineEndChar(data[pos])) {
+    pos += 1;
+  }
+  return pos;
+}
+
+static size_t countNewlinesScalar(const char* data, size_t pos, size_t end) {
+  size_t count = 0;
+  for (; pos < end; pos++) {
+    count += (data[pos] == '\n');
+  }
+  return count;
+}
+
+#ifdef DMM_HAVE_X86_SIMD
+
+// Whitespace is ' ' or the range '\t'..'\r'. The signed compares leave
+// bytes >= 0x80 outside the range, which matches isWhitespaceChar.
+static inline __m128i whitespaceMask128(__m128i chunk) {
+  __m128i isSpace = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+  __m128i aboveTab = _mm_cmpgt_epi8(chunk, _mm_set1_epi8('\t' - 1));
+  __m128i belowCr = _mm_cmplt_epi8(chunk, _mm_set1_epi8('\r' + 1));
+  return _mm_or_si128(isSpace, _mm_and_si128(aboveTab, belowCr));
+}
+
+static inline __m128i lineEndMask128(__m128i chunk) {
+  __m128i isLf = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+  __m128i isCr = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'));
+  __m128i isFf = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\f'));
+  return _mm_or_si128(isLf, _mm_or_si128(isCr, isFf));
+}
+
+static size_t skipWhitespaceSSE2(const char* data, size_t pos, size_t end) {
+  while (pos + 16 <= end) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(data + pos));
+    unsigned mask = ~(unsigned)_mm_movemask_epi8(whitespaceMask128(chunk)) & 0xFFFFu;
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return skipWhitespaceScalar(data, pos, end);
+}
+
+static size_t skipToLineEndSSE2(const char* data, size_t pos, size_t end) {
+  while (pos + 16 <= end) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(data + pos));
+    unsigned mask = (unsigned)_mm_movemask_epi8(lineEndMask128(chunk));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return skipToLineEndScalar(data, pos, end);
+}
+
+static size_t countNewlinesSSE2(const char* data, size_t pos, size_t end) {
+  const __m128i lf = _mm_set1_epi8('\n');
+  size_t count = 0;
+  while (pos + 16 <= end) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(data + pos));
+    count += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf)));
+    pos += 16;
+  }
+  return count + countNewlinesScalar(data, pos, end);
+}
+
+__attribute__((target("avx2")))
+static size_t skipWhitespaceAVX2(const char* data, size_t pos, size_t end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tabMinusOne = _mm256_set1_epi8('\t' - 1);
+  const __m256i crPlusOne = _mm256_set1_epi8('\r' + 1);
+  while (pos + 32 <= end) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + pos));
+    __m256i isSpace = _mm256_cmpeq_epi8(chunk, space);
+    __m256i aboveTab = _mm256_cmpgt_epi8(chunk, tabMinusOne);
+    __m256i belowCr = _mm256_cmpgt_epi8(crPlusOne, chunk);
+    __m256i isWhitespace = _mm256_or_si256(isSpace, _mm256_and_si256(aboveTab, belowCr));
+    unsigned mask = ~(unsigned)_mm256_movemask_epi8(isWhitespace);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 32;
+  }
+  return skipWhitespaceSSE2(data, pos, end);
+}
+
+__attribute__((target("avx2")))
+static size_t skipToLineEndAVX2(const char* data, size_t pos, size_t end) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i ff = _mm256_set1_epi8('\f');
+  while (pos + 32 <= end) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + pos));
+    __m256i isLineEnd = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lf),
+					_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr),
+							_mm256_cmpeq_epi8(chunk, ff)));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(isLineEnd);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 32;
+  }
+  return skipToLineEndSSE2(data, pos, end);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countNewlinesAVX2(const char* data, size_t pos, size_t end) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  size_t count = 0;
+  while (pos + 32 <= end) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + pos));
+    count += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf)));
+    pos += 32;
+  }
+  return count + countNewlinesSSE2(data, pos, end);
+}
+
+#endif
+
+bool isCharScanImplSupported(CharScanImpl impl) {
+  switch (impl) {
+  case CharScanImpl::Scalar:
+    return true;
+#ifdef DMM_HAVE_X86_SIMD
+  case CharScanImpl::SSE2:
+    return __builtin_cpu_supports("sse2");
+  case CharScanImpl::AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+static CharScanImpl detectCharScanImpl() {
+#ifdef DMM_HAVE_X86_SIMD
+  __builtin_cpu_init();
+#endif
+  if (isCharScanImplSupported(CharScanImpl::AVX2)) {
+    return CharScanImpl::AVX2;
+  } else if (isCharScanImplSupported(CharScanImpl::SSE2)) {
+    return CharScanImpl::SSE2;
+  }
+  return CharScanImpl::Scalar;
+}
+
+struct CharScanTable {
+  CharScanImpl Impl;
+  ScanFn SkipWhitespace;
+  ScanFn SkipToLineEnd;
+  ScanFn CountNewlines;
+};
+
+// The tables are constant-initialized and never modified; switching the
+// implementation swaps a single atomic pointer, so a concurrent scan always
+// sees one complete table.
+static constexpr CharScanTable ScalarTable = {CharScanImpl::Scalar, skipWhitespaceScalar, skipToLineEndScalar,
+						    countNewlinesScalar};
+#ifdef DMM_HAVE_X86_SIMD
+static constexpr CharScanTable SSE2Table = {CharScanImpl::SSE2, skipWhitespaceSSE2, skipToLineEndSSE2,
+						  countNewlinesSSE2};
+static constexpr CharScanTable AVX2Table = {CharScanImpl::AVX2, skipWhitespaceAVX2, skipToLineEndAVX2,
+						  countNewlinesAVX2};
+#endif
+
+static const CharScanTable& tableFor(CharScanImpl impl) {
+  switch (impl) {
+#ifdef DMM_HAVE_X86_SIMD
+  case CharScanImpl::SSE2:
+    return SSE2Table;
+  case CharScanImpl::AVX2:
+    return AVX2Table;
+#endif
+  default:
+    return ScalarTable;
+  }
+}
+
+// Until the first scan the active table forwards to resolvers that detect the
+// CPU once, so no dynamic initializer has to run before other static
+// initializers can scan.
+static size_t resolveSkipWhitespace(const char*, size_t, size_t);
+static size_t resolveSkipToLineEnd(const char*, size_t, size_t);
+static size_t resolveCountNewlines(const char*, size_t, size_t);
+static constexpr CharScanTable ResolverTable = {CharScanImpl::Scalar, resolveSkipWhitespace, resolveSkipToLineEnd,
+						resolveCountNewlines};
+static std::atomic<const CharScanTable*> ActiveTable{&ResolverTable};
+
+static const CharScanTable& activeTable() {
+  const CharScanTable* table = ActiveTable.load(std::memory_order_acquire);
+  if (table == &ResolverTable) {
+    static const CharScanTable& detected = tableFor(detectCharScanImpl());
+    ActiveTable.compare_exchange_strong(table, &detected, std::memory_order_acq_rel);
+    table = ActiveTable.load(std::memory_order_acquire);
+  }
+  return *table;
+}
+
+static size_t resolveSkipWhitespace(const char* data, size_t pos, size_t end) {
+  return activeTable().SkipWhitespace(data, pos, end);
+}
+
+static size_t resolveSkipToLineEnd(const char* data, size_t pos, size_t end) {
+  return activeTable().SkipToLineEnd(data, pos, end);
+}
+
+static size_t resolveCountNewlines(const char* data, size_t pos, size_t end) {
+  return activeTable().CountNewlines(data, pos, end);
+}
+
+size_t skipWhitespace(std::string_view buffer, size_t pos) {
+  return ActiveTable.load(std::memory_order_acquire)->SkipWhitespace(buffer.data(), pos, buffer.length());
+}
+
+size_t skipToLineEnd(std::string_view buffer, size_t pos) {
+  return ActiveTable.load(std::memory_order_acquire)->SkipToLineEnd(buffer.data(), pos, buffer.length());
+}
+
+size_t countNewlines(std::string_view buffer) {
+  return ActiveTable.load(std::memory_order_acquire)->CountNewlines(buffer.data(), 0, buffer.length());
+}
+
+CharScanImpl getCharScanImpl() {
+  return activeTable().Impl;
+}
+
+void setCharScanImpl(CharScanImpl impl) {
+  if (!isCharScanImplSupported(impl)) {
+    throw std::runtime_error("Character scan implementation not supported on this CPU");
+  }
+  ActiveTable.store(&tableFor(impl), std::memory_order_release);
+}
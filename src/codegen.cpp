@@ -0,0 +1,643 @@
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include "ast_visitor.h"
+#include "casting.h"
+#include "codegen.h"
+#include "diagnostics.h"
+#include "fusion.h"
+#include "interpreter.h"
+#include "shape_inference.h"
+
+// Runtime support called from generated code.
+extern "C" {
+
+static void dmmPrint(void* out, const double* data, const uint64_t* shape, uint64_t rank) {
+  Tensor tensor = Tensor::allocate(std::vector<size_t>(shape, shape + rank));
+  std::copy(data, data + tensor.size(), tensor.data());
+  *static_cast<std::ostream*>(out) << tensor << "\n";
+}
+
+// Generated code cannot unwind, so running out of memory is fatal.
+static void* dmmAlloc(uint64_t bytes) {
+  void* memory = std::aligned_alloc(Tensor::Alignment, (bytes + Tensor::Alignment - 1) & ~(Tensor::Alignment - 1));
+  if (memory == nullptr) {
+    std::cerr << "out of memory in native code" << std::endl;
+    std::abort();
+  }
+  return memory;
+}
+
+static void dmmFree(void* memory) {
+  std::free(memory);
+}
+}
+
+namespace {
+
+using SpecializationKey = std::pair<const FunctionNode*, std::vector<TensorShape>>;
+using EntryFunction = void (*)(double*, const double* const*);
+
+// Buffers of at most this many elements live on the stack.
+constexpr uint64_t MaxStackElements = 64;
+
+[[noreturn]] void fail(const Node& node, const std::string& message) {
+  throw InterpreterError(node.getOffset(), message);
+}
+
+void check(llvm::Error error) {
+  if (error) {
+    throw std::runtime_error(llvm::toString(std::move(error)));
+  }
+}
+
+template<typename T>
+T check(llvm::Expected<T> value) {
+  if (!value) {
+    throw std::runtime_error(llvm::toString(value.takeError()));
+  }
+  return std::move(*value);
+}
+
+// Builds one LLVM module from the specializations a call reaches. Functions
+// take the result buffer, or null if calls have no value, followed by one
+// buffer per argument.
+class ModuleBuilder {
+  llvm::LLVMContext& Context;
+  llvm::Module& IR;
+  std::ostream& Out;
+  // Names of the specializations compiled into earlier modules, and of the
+  // ones this module defines.
+  const std::map<SpecializationKey, std::string>& Compiled;
+  std::map<SpecializationKey, std::string>& Defined;
+  size_t& NumFunctions;
+  const FusionPlan* Plan;
+  std::vector<const ShapeInference::Specialization*> Pending;
+
+public:
+  llvm::Type* getDoubleTy() { return llvm::Type::getDoubleTy(Context); }
+  llvm::PointerType* getBufferTy() { return llvm::Type::getDoublePtrTy(Context); }
+  llvm::Type* getSizeTy() { return llvm::Type::getInt64Ty(Context); }
+
+  llvm::Function* getRuntimeFunction(const char* name, llvm::Type* result, std::vector<llvm::Type*> params) {
+    llvm::FunctionType* type = llvm::FunctionType::get(result, params, false);
+    return llvm::cast<llvm::Function>(IR.getOrInsertFunction(name, type).getCallee());
+  }
+
+  // Declares the function of a specialization, queueing it for code
+  // generation unless an earlier module has it.
+  llvm::Function* getFunction(const ShapeInference::Specialization& spec) {
+    SpecializationKey key(&spec.Function, spec.ArgShapes);
+    std::string name;
+    if (auto it = Compiled.find(key); it != Compiled.end()) {
+      name = it->second;
+    } else if (auto it = Defined.find(key); it != Defined.end()) {
+      name = it->second;
+    } else {
+      name = "dmm." + std::string(spec.Function.getPrototype().getName().str()) + "." +
+	std::to_string(NumFunctions++);
+      Defined.emplace(key, name);
+      Pending.push_back(&spec);
+    }
+    if (llvm::Function* function = IR.getFunction(name)) {
+      return function;
+    }
+    std::vector<llvm::Type*> params(spec.ArgShapes.size() + 1, getBufferTy());
+    llvm::FunctionType* type = llvm::FunctionType::get(llvm::Type::getVoidTy(Context), params, false);
+    llvm::Function* function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, IR);
+    function->addParamAttr(0, llvm::Attribute::NoAlias);
+    for (unsigned i = 1; i < function->arg_size(); i++) {
+      function->addParamAttr(i, llvm::Attribute::ReadOnly);
+    }
+    return function;
+  }
+
+  void generate(const ShapeInference::Specialization&);
+
+  // Generates the reached specializations and an entry point taking an
+  // array of argument buffers, named entryName.
+  void build(const ShapeInference::Specialization& root, const std::string& entryName) {
+    llvm::Function* target = getFunction(root);
+    while (!Pending.empty()) {
+      const ShapeInference::Specialization* spec = Pending.back();
+      Pending.pop_back();
+      generate(*spec);
+    }
+    llvm::Type* argsTy = llvm::PointerType::getUnqual(getBufferTy());
+    llvm::FunctionType* type =
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Context), {getBufferTy(), argsTy}, false);
+    llvm::Function* entry = llvm::Function::Create(type, llvm::Function::ExternalLinkage, entryName, IR);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(Context, "entry", entry));
+    std::vector<llvm::Value*> args{entry->getArg(0)};
+    for (size_t i = 0; i < root.ArgShapes.size(); i++) {
+      llvm::Value* slot = builder.CreateConstGEP1_64(getBufferTy(), entry->getArg(1), i);
+      args.push_back(builder.CreateLoad(getBufferTy(), slot));
+    }
+    builder.CreateCall(target, args);
+    builder.CreateRetVoid();
+  }
+
+  std::ostream& getOut() { return Out; }
+  const FusionPlan* getPlan() { return Plan; }
+  llvm::LLVMContext& getContext() { return Context; }
+  llvm::Module& getModule() { return IR; }
+
+  ModuleBuilder(llvm::LLVMContext& context, llvm::Module& ir, std::ostream& out,
+		const std::map<SpecializationKey, std::string>& compiled, std::map<SpecializationKey, std::string>& defined,
+		size_t& numFunctions, const FusionPlan* plan)
+    : Context(context), IR(ir), Out(out), Compiled(compiled), Defined(defined), NumFunctions(numFunctions),
+      Plan(plan) {}
+};
+
+// Generates the body of one specialization. Visiting an expression yields the
+// buffer holding its value, or null if it has none.
+class FunctionGenerator : public ConstASTVisitor<FunctionGenerator, llvm::Value*> {
+  ModuleBuilder& Builder;
+  const ShapeInference::Specialization& Spec;
+  llvm::Function* Function;
+  llvm::IRBuilder<> B;
+  std::unordered_map<Symbol, llvm::Value*> Variables;
+  std::vector<llvm::Value*> HeapBuffers;
+
+  const TensorShape& shapeOf(const ExprNode& expr) {
+    const TensorShape* shape = Spec.getShape(expr);
+    if (shape == nullptr || !shape->isKnown()) {
+      fail(expr, "the shape of this expression is not known statically");
+    }
+    return *shape;
+  }
+
+  const FusedExpr* findFused(const ExprNode& expr) {
+    return Builder.getPlan() ? Builder.getPlan()->find(expr) : nullptr;
+  }
+
+  llvm::Value* getSize(uint64_t value) { return llvm::ConstantInt::get(Builder.getSizeTy(), value); }
+
+  llvm::Value* allocate(uint64_t count) {
+    if (count <= MaxStackElements) {
+      llvm::BasicBlock& entry = Function->getEntryBlock();
+      llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+      llvm::AllocaInst* buffer = entryBuilder.CreateAlloca(Builder.getDoubleTy(), getSize(count));
+      buffer->setAlignment(llvm::Align(Tensor::Alignment));
+      return buffer;
+    }
+    llvm::Function* alloc =
+      Builder.getRuntimeFunction("dmm_alloc", llvm::Type::getInt8PtrTy(Builder.getContext()), {Builder.getSizeTy()});
+    alloc->setReturnDoesNotAlias();
+    llvm::Value* memory = B.CreateCall(alloc, {getSize(count * sizeof(double))});
+    HeapBuffers.push_back(memory);
+    return B.CreateBitCast(memory, Builder.getBufferTy());
+  }
+
+  llvm::Value* element(llvm::Value* buffer, llvm::Value* index) {
+    return B.CreateInBoundsGEP(Builder.getDoubleTy(), buffer, index);
+  }
+
+  void copy(llvm::Value* dest, llvm::Value* source, uint64_t count) {
+    B.CreateMemCpy(dest, llvm::MaybeAlign(sizeof(double)), source, llvm::MaybeAlign(sizeof(double)),
+		   count * sizeof(double));
+  }
+
+  // Emits for (i = 0; i < count; i++) body(i).
+  void emitLoop(uint64_t count, const std::function<void(llvm::Value*)>& body) {
+    if (count == 0) {
+      return;
+    }
+    llvm::BasicBlock* preheader = B.GetInsertBlock();
+    llvm::BasicBlock* loop = llvm::BasicBlock::Create(Builder.getContext(), "loop", Function);
+    llvm::BasicBlock* exit = llvm::BasicBlock::Create(Builder.getContext(), "loop.end", Function);
+    B.CreateBr(loop);
+    B.SetInsertPoint(loop);
+    llvm::PHINode* index = B.CreatePHI(Builder.getSizeTy(), 2, "i");
+    index->addIncoming(getSize(0), preheader);
+    body(index);
+    llvm::Value* next = B.CreateNUWAdd(index, getSize(1));
+    index->addIncoming(next, B.GetInsertBlock());
+    B.CreateCondBr(B.CreateICmpULT(next, getSize(count)), loop, exit);
+    B.SetInsertPoint(exit);
+  }
+
+  // Loops over the output in order; output dimension d steps input
+  // dimension rank - 1 - d.
+  void emitTransposeLoops(const std::vector<size_t>& dims, const std::vector<size_t>& inStrides,
+			  const std::vector<size_t>& outStrides, size_t d, llvm::Value* inOffset,
+			  llvm::Value* outOffset, llvm::Value* in, llvm::Value* out) {
+    size_t rank = dims.size();
+    if (d == rank) {
+      B.CreateStore(B.CreateLoad(Builder.getDoubleTy(), element(in, inOffset)), element(out, outOffset));
+      return;
+    }
+    emitLoop(dims[rank - 1 - d], [&](llvm::Value* index) {
+      emitTransposeLoops(dims, inStrides, outStrides, d + 1,
+			 B.CreateNUWAdd(inOffset, B.CreateNUWMul(index, getSize(inStrides[rank - 1 - d]))),
+			 B.CreateNUWAdd(outOffset, B.CreateNUWMul(index, getSize(outStrides[d]))), in, out);
+    });
+  }
+
+  llvm::Value* emitTranspose(const VariableExprNode& call, llvm::Value* input) {
+    const TensorShape& shape = shapeOf(*call.getArgs()[0]);
+    const std::vector<size_t>& dims = shape.getDims();
+    if (dims.size() < 2) {
+      return input;
+    }
+    size_t rank = dims.size();
+    std::vector<size_t> inStrides(rank, 1);
+    std::vector<size_t> outStrides(rank, 1);
+    for (size_t d = rank - 1; d > 0; d--) {
+      inStrides[d - 1] = inStrides[d] * dims[d];
+      outStrides[d - 1] = outStrides[d] * dims[rank - 1 - d];
+    }
+    llvm::Value* output = allocate(shape.getNumElements());
+    emitTransposeLoops(dims, inStrides, outStrides, 0, getSize(0), getSize(0), input, output);
+    return output;
+  }
+
+  llvm::Value* emitOperator(Op op, llvm::Value* a, llvm::Value* b) {
+    switch (op) {
+    case Op::Plus:
+      return B.CreateFAdd(a, b);
+    case Op::Minus:
+      return B.CreateFSub(a, b);
+    case Op::Times:
+      return B.CreateFMul(a, b);
+    case Op::Divide:
+      return B.CreateFDiv(a, b);
+    case Op::Modulus:
+      break;
+    }
+    return B.CreateFRem(a, b);
+  }
+
+  // Loops over output dimension d and the ones after it. Offsets holds the
+  // position of every leaf, which output dimension d steps by strides[d].
+  void emitFusedLoops(const std::vector<size_t>& dims, const std::vector<std::vector<size_t>>& strides, size_t d,
+		      std::vector<llvm::Value*> offsets, llvm::Value* outOffset,
+		      const std::function<void(const std::vector<llvm::Value*>&, llvm::Value*)>& body) {
+    if (d == dims.size()) {
+      body(offsets, outOffset);
+      return;
+    }
+    emitLoop(dims[d], [&](llvm::Value* index) {
+      std::vector<llvm::Value*> inner(offsets.size());
+      for (size_t i = 0; i < offsets.size(); i++) {
+	inner[i] = B.CreateNUWAdd(offsets[i], B.CreateNUWMul(index, getSize(strides[d][i])));
+      }
+      emitFusedLoops(dims, strides, d + 1, std::move(inner),
+		     B.CreateNUWAdd(B.CreateNUWMul(outOffset, getSize(dims[d])), index), body);
+    });
+  }
+
+  // A fused tree computes each output element in one pass over its leaves,
+  // with no buffers in between: a single loop when no leaf is transposed,
+  // otherwise a loop per output dimension.
+  llvm::Value* emitFused(const ExprNode& root, const FusedExpr& fused) {
+    std::vector<llvm::Value*> leaves;
+    for (const FusedExpr::Leaf& leaf : fused.Leaves) {
+      leaves.push_back(visit(*leaf.Expr));
+    }
+    const std::vector<size_t>& dims = shapeOf(root).getDims();
+    size_t rank = dims.size();
+    std::vector<std::vector<size_t>> strides(rank, std::vector<size_t>(leaves.size(), 0));
+    std::vector<llvm::Value*> scalars(leaves.size(), nullptr);
+    bool remapped = false;
+    for (size_t i = 0; i < leaves.size(); i++) {
+      const std::vector<size_t>& leafDims = shapeOf(*fused.Leaves[i].Expr).getDims();
+      if (leafDims.empty()) {
+	// Scalar leaves are loaded once, outside the loops.
+	scalars[i] = B.CreateLoad(Builder.getDoubleTy(), leaves[i]);
+	continue;
+      }
+      bool reversed = fused.Leaves[i].Transposed && rank >= 2;
+      remapped |= reversed;
+      size_t stride = 1;
+      for (size_t d = rank; d-- > 0;) {
+	strides[reversed ? rank - 1 - d : d][i] = stride;
+	stride *= leafDims[d];
+      }
+    }
+    uint64_t count = shapeOf(root).getNumElements();
+    llvm::Value* result = allocate(count);
+    auto body = [&](const std::vector<llvm::Value*>& offsets, llvm::Value* outOffset) {
+      std::vector<llvm::Value*> stack;
+      for (const FusedExpr::Step& step : fused.Steps) {
+	if (step.Kind == FusedExpr::StepKind::Leaf) {
+	  uint32_t i = step.Leaf;
+	  stack.push_back(scalars[i] ? scalars[i]
+				     : B.CreateLoad(Builder.getDoubleTy(), element(leaves[i], offsets[i])));
+	} else if (step.Kind == FusedExpr::StepKind::Binary) {
+	  llvm::Value* rhs = stack.back();
+	  stack.pop_back();
+	  stack.back() = emitOperator(step.Operator, stack.back(), rhs);
+	}
+      }
+      B.CreateStore(stack.back(), element(result, outOffset));
+    };
+    if (remapped) {
+      emitFusedLoops(dims, strides, 0, std::vector<llvm::Value*>(leaves.size(), getSize(0)), getSize(0), body);
+    } else {
+      emitLoop(count, [&](llvm::Value* index) { body(std::vector<llvm::Value*>(leaves.size(), index), index); });
+    }
+    return result;
+  }
+
+  llvm::Value* emitPrint(const ExprNode& arg, llvm::Value* value) {
+    const std::vector<size_t>& dims = shapeOf(arg).getDims();
+    std::vector<uint64_t> shape(dims.begin(), dims.end());
+    auto* shapeTy = llvm::ArrayType::get(Builder.getSizeTy(), shape.size());
+    auto* shapeData = new llvm::GlobalVariable(Builder.getModule(), shapeTy, true, llvm::GlobalValue::PrivateLinkage,
+					       llvm::ConstantDataArray::get(Builder.getContext(), shape));
+    llvm::Type* i8Ptr = llvm::Type::getInt8PtrTy(Builder.getContext());
+    llvm::Type* sizePtr = llvm::PointerType::getUnqual(Builder.getSizeTy());
+    llvm::Function* print = Builder.getRuntimeFunction(
+      "dmm_print", llvm::Type::getVoidTy(Builder.getContext()), {i8Ptr, Builder.getBufferTy(), sizePtr, Builder.getSizeTy()});
+    llvm::Value* out = B.CreateIntToPtr(getSize((uint64_t)(uintptr_t)&Builder.getOut()), i8Ptr);
+    B.CreateCall(print, {out, value, B.CreateBitCast(shapeData, sizePtr), getSize(shape.size())});
+    return nullptr;
+  }
+
+public:
+  llvm::Value* visitNumberExprNode(const NumberExprNode& node) {
+    llvm::Value* buffer = allocate(1);
+    B.CreateStore(llvm::ConstantFP::get(Builder.getDoubleTy(), node.getValue()), buffer);
+    return buffer;
+  }
+
+  llvm::Value* visitConstantTensorNode(const ConstantTensorNode& node) {
+    auto* data = llvm::ConstantDataArray::get(Builder.getContext(), node.getValues());
+    auto* global = new llvm::GlobalVariable(Builder.getModule(), data->getType(), true,
+					    llvm::GlobalValue::PrivateLinkage, data);
+    global->setAlignment(llvm::Align(Tensor::Alignment));
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return B.CreateBitCast(global, Builder.getBufferTy());
+  }
+
+  llvm::Value* visitArrayExprNode(const ArrayExprNode& node) {
+    std::vector<llvm::Value*> entries;
+    for (const auto& entry : node.getEntries()) {
+      entries.push_back(visit(*entry));
+    }
+    const TensorShape& shape = shapeOf(node);
+    llvm::Value* buffer = allocate(shape.getNumElements());
+    uint64_t entrySize = entries.empty() ? 0 : shape.getNumElements() / entries.size();
+    for (size_t i = 0; i < entries.size(); i++) {
+      copy(element(buffer, getSize(i * entrySize)), entries[i], entrySize);
+    }
+    return buffer;
+  }
+
+  llvm::Value* visitBinaryExprNode(const BinaryExprNode& node) {
+    if (const FusedExpr* fused = findFused(node)) {
+      return emitFused(node, *fused);
+    }
+    llvm::Value* lhs = visit(node.getLHS());
+    llvm::Value* rhs = visit(node.getRHS());
+    bool lhsScalar = shapeOf(node.getLHS()).getRank() == 0;
+    bool rhsScalar = shapeOf(node.getRHS()).getRank() == 0;
+    uint64_t count = shapeOf(node).getNumElements();
+    llvm::Value* result = allocate(count);
+    // Scalar operands are loaded once, outside the loop.
+    llvm::Value* lhsValue = lhsScalar ? B.CreateLoad(Builder.getDoubleTy(), lhs) : nullptr;
+    llvm::Value* rhsValue = rhsScalar ? B.CreateLoad(Builder.getDoubleTy(), rhs) : nullptr;
+    emitLoop(count, [&](llvm::Value* index) {
+      llvm::Value* a = lhsScalar ? lhsValue : B.CreateLoad(Builder.getDoubleTy(), element(lhs, index));
+      llvm::Value* b = rhsScalar ? rhsValue : B.CreateLoad(Builder.getDoubleTy(), element(rhs, index));
+      B.CreateStore(emitOperator(node.getOp(), a, b), element(result, index));
+    });
+    return result;
+  }
+
+  llvm::Value* visitVariableExprNode(const VariableExprNode& node) {
+    if (const FusedExpr* fused = findFused(node)) {
+      return emitFused(node, *fused);
+    }
+    if (node.getArgs().empty()) {
+      shapeOf(node);
+      return Variables.at(node.getName());
+    }
+    std::vector<llvm::Value*> args;
+    for (const auto& arg : node.getArgs()) {
+      args.push_back(visit(*arg));
+    }
+    std::string_view name = node.getName().str();
+    if (name == "print") {
+      return emitPrint(*node.getArgs()[0], args[0]);
+    }
+    if (name == "transpose") {
+      return emitTranspose(node, args[0]);
+    }
+    const ShapeInference::Specialization* callee = Spec.getCallee(node);
+    if (callee == nullptr) {
+      fail(node, "native code cannot call extern function '" + std::string(name) + "'");
+    }
+    llvm::Function* function = Builder.getFunction(*callee);
+    const TensorShape* shape = Spec.getShape(node);
+    llvm::Value* result = (shape != nullptr) ? allocate(shapeOf(node).getNumElements())
+					     : llvm::ConstantPointerNull::get(Builder.getBufferTy());
+    args.insert(args.begin(), result);
+    B.CreateCall(function, args);
+    return (shape != nullptr) ? result : nullptr;
+  }
+
+  // A declaration with a size only reshapes, which leaves the buffer as it is.
+  llvm::Value* visitAssgnNode(const AssgnNode& node) {
+    llvm::Value* value = visit(node.getExpr());
+    shapeOf(node.getExpr());
+    Variables[node.getName()] = value;
+    return nullptr;
+  }
+
+  void run() {
+    const auto& params = Spec.Function.getPrototype().getArgs();
+    for (size_t i = 0; i < params.size(); i++) {
+      Variables[params[i]] = Function->getArg(i + 1);
+    }
+    llvm::Value* last = nullptr;
+    const auto& body = Spec.Function.getBody();
+    for (const auto& stmt : body) {
+      last = visit(*stmt);
+    }
+    if (Spec.Result.has_value()) {
+      copy(Function->getArg(0), last, Spec.Result->getNumElements());
+    }
+    llvm::Function* free = Builder.getRuntimeFunction("dmm_free", llvm::Type::getVoidTy(Builder.getContext()),
+						      {llvm::Type::getInt8PtrTy(Builder.getContext())});
+    for (llvm::Value* buffer : HeapBuffers) {
+      B.CreateCall(free, {buffer});
+    }
+    B.CreateRetVoid();
+  }
+
+  FunctionGenerator(ModuleBuilder& builder, const ShapeInference::Specialization& spec, llvm::Function* function)
+    : Builder(builder), Spec(spec), Function(function),
+      B(llvm::BasicBlock::Create(builder.getContext(), "entry", function)) {}
+};
+
+void ModuleBuilder::generate(const ShapeInference::Specialization& spec) {
+  FunctionGenerator(*this, spec, getFunction(spec)).run();
+}
+
+void initializeNativeTarget() {
+  static std::once_flag flag;
+  std::call_once(flag, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+  });
+}
+
+} // namespace
+
+struct NativeEngine::State {
+  const Module& Source;
+  std::ostream& Out;
+  std::unordered_map<Symbol, const FunctionNode*> Functions;
+  std::unique_ptr<llvm::TargetMachine> Target;
+  std::unique_ptr<llvm::orc::LLJIT> JIT;
+  llvm::orc::ThreadSafeContext Context;
+  std::optional<FusionPlan> Plan;
+  std::map<SpecializationKey, std::string> Compiled;
+  std::map<SpecializationKey, std::pair<EntryFunction, std::optional<TensorShape>>> Entries;
+  std::string IR;
+  size_t NumFunctions = 0;
+
+  void optimize(llvm::Module& module) {
+    llvm::LoopAnalysisManager loops;
+    llvm::FunctionAnalysisManager functions;
+    llvm::CGSCCAnalysisManager cgscc;
+    llvm::ModuleAnalysisManager modules;
+    llvm::PassBuilder passes(Target.get());
+    passes.registerModuleAnalyses(modules);
+    passes.registerCGSCCAnalyses(cgscc);
+    passes.registerFunctionAnalyses(functions);
+    passes.registerLoopAnalyses(loops);
+    passes.crossRegisterProxies(loops, functions, cgscc, modules);
+    passes.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2).run(module, modules);
+  }
+
+  State(const Module& source, std::ostream& out, Fusion fusion)
+    : Source(source), Out(out), Context(std::make_unique<llvm::LLVMContext>()) {
+    initializeNativeTarget();
+    if (fusion == Fusion::Enabled) {
+      Plan.emplace(source);
+    }
+    llvm::orc::JITTargetMachineBuilder machine = check(llvm::orc::JITTargetMachineBuilder::detectHost());
+    Target = check(machine.createTargetMachine());
+    JIT = check(llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(machine)).create());
+    llvm::orc::JITDylib& library = JIT->getMainJITDylib();
+    llvm::orc::SymbolMap runtime;
+    auto define = [&](const char* name, void* address) {
+      runtime[JIT->mangleAndIntern(name)] =
+	llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(address), llvm::JITSymbolFlags::Exported);
+    };
+    define("dmm_print", reinterpret_cast<void*>(&dmmPrint));
+    define("dmm_alloc", reinterpret_cast<void*>(&dmmAlloc));
+    define("dmm_free", reinterpret_cast<void*>(&dmmFree));
+    check(library.define(llvm::orc::absoluteSymbols(std::move(runtime))));
+    // memcpy and whatever else the backend calls come from the process.
+    library.addGenerator(check(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      JIT->getDataLayout().getGlobalPrefix())));
+    for (const auto& definition : source.getDefinitions()) {
+      if (auto* function = dyn_cast<FunctionNode>(definition.get())) {
+	Functions.emplace(function->getPrototype().getName(), function);
+      } else {
+	Functions.emplace(cast<PrototypeNode>(*definition).getName(), nullptr);
+      }
+    }
+  }
+};
+
+NativeEngine::NativeEngine(const Module& module, std::ostream& out, Fusion fusion)
+  : Impl(std::make_unique<State>(module, out, fusion)) {}
+
+NativeEngine::~NativeEngine() = default;
+
+std::optional<Tensor> NativeEngine::call(Symbol name, const std::vector<Tensor>& args) {
+  State& state = *Impl;
+  auto it = state.Functions.find(name);
+  if (it == state.Functions.end() || it->second == nullptr) {
+    throw std::runtime_error("no function named '" + std::string(name.str()) + "'");
+  }
+  const FunctionNode& function = *it->second;
+  if (function.getPrototype().getArgs().size() != args.size()) {
+    throw std::runtime_error("'" + std::string(name.str()) + "' expects " +
+			     std::to_string(function.getPrototype().getArgs().size()) + " arguments");
+  }
+  std::vector<TensorShape> argShapes;
+  for (const Tensor& arg : args) {
+    argShapes.emplace_back(arg.getShape());
+  }
+  SpecializationKey key(&function, argShapes);
+  auto entry = state.Entries.find(key);
+  if (entry == state.Entries.end()) {
+    DiagnosticEngine diags;
+    ShapeInference inference(state.Source, diags);
+    const ShapeInference::Specialization& spec = inference.specialize(function, argShapes);
+    if (diags.hasErrors()) {
+      const Diagnostic& first = diags.getDiagnostics()[0];
+      throw InterpreterError(first.Offset, first.Message);
+    }
+    std::string entryName = "dmm.entry." + std::to_string(state.Entries.size());
+    std::map<SpecializationKey, std::string> defined;
+    size_t numFunctions = state.NumFunctions;
+    {
+      auto lock = state.Context.getLock();
+      auto module = std::make_unique<llvm::Module>("dmm", *state.Context.getContext());
+      module->setDataLayout(state.Target->createDataLayout());
+      module->setTargetTriple(state.Target->getTargetTriple().str());
+      ModuleBuilder(*state.Context.getContext(), *module, state.Out, state.Compiled, defined, numFunctions,
+		    state.Plan ? &*state.Plan : nullptr)
+	.build(spec, entryName);
+      std::string problems;
+      llvm::raw_string_ostream problemStream(problems);
+      if (llvm::verifyModule(*module, &problemStream)) {
+	throw std::runtime_error("generated invalid IR: " + problemStream.str());
+      }
+      state.optimize(*module);
+      llvm::raw_string_ostream irStream(state.IR);
+      module->print(irStream, nullptr);
+      irStream.flush();
+      check(state.JIT->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), state.Context)));
+    }
+    state.NumFunctions = numFunctions;
+    state.Compiled.insert(defined.begin(), defined.end());
+    auto address = check(state.JIT->lookup(entryName)).getAddress();
+    entry = state.Entries.emplace(key, std::make_pair(reinterpret_cast<EntryFunction>(address), spec.Result)).first;
+  }
+  const auto& [code, resultShape] = entry->second;
+  std::vector<const double*> argData;
+  for (const Tensor& arg : args) {
+    argData.push_back(arg.data());
+  }
+  if (!resultShape.has_value()) {
+    code(nullptr, argData.data());
+    return std::nullopt;
+  }
+  Tensor result = Tensor::allocate(resultShape->getDims());
+  code(result.data(), argData.data());
+  return result;
+}
+
+void NativeEngine::run() {
+  call(Symbol("main"), {});
+  Impl->Out.flush();
+}
+
+std::string NativeEngine::getIR() const {
+  return Impl->IR;
+}
@@ -0,0 +1,55 @@
+#include <ostream>
+#include <string>
+#include <utility>
+#include "diagnostics.h"
+#include "source_file.h"
+
+static const char* severityName(Severity level) {
+  return (level == Severity::Error) ? "error" : "warning";
+}
+
+void DiagnosticEngine::report(Severity level, uint32_t offset, std::string message) {
+  if (level == Severity::Error) {
+    NumErrors += 1;
+  }
+  Diagnostics.push_back(Diagnostic{level, offset, std::move(message)});
+}
+
+void DiagnosticEngine::error(uint32_t offset, std::string message) {
+  report(Severity::Error, offset, std::move(message));
+}
+
+const std::vector<Diagnostic>& DiagnosticEngine::getDiagnostics() const {
+  return Diagnostics;
+}
+
+size_t DiagnosticEngine::getNumErrors() const {
+  return NumErrors;
+}
+
+bool DiagnosticEngine::hasErrors() const {
+  return NumErrors > 0;
+}
+
+void DiagnosticEngine::append(DiagnosticEngine&& other) {
+  for (Diagnostic& diagnostic : other.Diagnostics) {
+    Diagnostics.push_back(std::move(diagnostic));
+  }
+  NumErrors += other.NumErrors;
+  other.Diagnostics.clear();
+  other.NumErrors = 0;
+}
+
+void DiagnosticEngine::print(std::ostream& out, const SourceFile& source) const {
+  for (const Diagnostic& diagnostic : Diagnostics) {
+    out << source.getName() << ":" << source.getLocation(diagnostic.Offset).str() << ": "
+	<< severityName(diagnostic.Level) << ": " << diagnostic.Message << "\n";
+  }
+}
+
+void DiagnosticEngine::print(std::ostream& out, const std::string& name) const {
+  for (const Diagnostic& diagnostic : Diagnostics) {
+    out << name << ":@" << diagnostic.Offset << ": " << severityName(diagnostic.Level) << ": "
+	<< diagnostic.Message << "\n";
+  }
+}
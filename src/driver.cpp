@@ -1,6 +1,168 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <optional>
+#include <vector>
+#include "ast_serializer.h"
+#ifdef DMM_HAVE_LLVM
+#include "codegen.h"
+#endif
+#include "diagnostics.h"
+#include "interpreter.h"
 #include "lexer.h"
 #include "parser.h"
+#include "source_file.h"
+#include "token_stream.h"
 
-int main() {
-  return 0;
+static void printUsage(const char* program) {
+  std::cerr << "usage: " << program << " [--stream] [-j threads] [--cache-dir dir] [--run] [--jit] <file.d-->... (use - for stdin)" << std::endl;
+}
+
+// Parses one definition at a time from a chunked reader and drops it again, so
+// memory stays bounded by the largest definition rather than the file.
+static size_t streamFile(const std::string& path, DiagnosticEngine& diags) {
+  bool isStdin = (path == "-");
+  int fd = isStdin ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error(path + ": cannot open: " + std::strerror(errno));
+  }
+  FdChunkReader reader(fd, path);
+  ScannerTokenStream stream(reader);
+  Parser parser(stream, nullptr, &diags);
+  size_t count = 0;
+  try {
+    while (parser.parseDefinition() != nullptr) {
+      count += 1;
+    }
+  } catch (...) {
+    if (!isStdin) {
+      ::close(fd);
+    }
+    throw;
+  }
+  if (!isStdin) {
+    ::close(fd);
+  }
+  return count;
+}
+
+// Runs main, reporting a runtime error at its source location.
+static bool runModule(const Module& module, const SourceFile& source, bool native) {
+  try {
+    if (native) {
+#ifdef DMM_HAVE_LLVM
+      NativeEngine(module, std::cout).run();
+#else
+      throw std::runtime_error("--jit needs a build with LLVM");
+#endif
+    } else {
+      Interpreter(module, std::cout).run();
+    }
+  } catch (const InterpreterError& e) {
+    std::cout.flush();
+    std::cerr << source.getName() << ":" << source.getLocation(e.getOffset()).str() << ": error: " << e.what()
+	      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Lexes and parses each file in turn, reporting every syntax error found; a
+// failing file is reported and the remaining files are still processed. With
+// --cache-dir, files parsed cleanly before are loaded from their cached AST.
+// With --run, the main function of each file that parsed cleanly is executed;
+// --jit runs it as native code instead.
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  int status = 0;
+  bool streaming = false;
+  bool running = false;
+  bool native = false;
+  unsigned numThreads = 1;
+  std::optional<ModuleCache> cache;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (std::strcmp(argv[i], "--stream") == 0) {
+      streaming = true;
+      continue;
+    }
+    if (std::strcmp(argv[i], "--run") == 0) {
+      running = true;
+      continue;
+    }
+    if (std::strcmp(argv[i], "--jit") == 0) {
+      running = true;
+      native = true;
+      continue;
+    }
+    if (std::strcmp(argv[i], "-j") == 0) {
+      if (i + 1 == argc) {
+	printUsage(argv[0]);
+	return 2;
+      }
+      numThreads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (std::strcmp(argv[i], "--cache-dir") == 0) {
+      if (i + 1 == argc) {
+	printUsage(argv[0]);
+	return 2;
+      }
+      cache.emplace(argv[++i]);
+      continue;
+    }
+    std::string path = argv[i];
+    try {
+      if (streaming) {
+	DiagnosticEngine diags;
+	std::cout << path << ": " << streamFile(path, diags) << " definitions" << std::endl;
+	diags.print(std::cerr, path);
+	status = diags.hasErrors() ? 1 : status;
+	continue;
+      }
+      SourceFile source = SourceFile::open(path);
+      if (cache) {
+	if (std::optional<Module> cached = cache->load(source.getText())) {
+	  std::cout << path << ": cached, " << cached->size() << " definitions" << std::endl;
+	  if (running) {
+	    status = runModule(*cached, source, native) ? status : 1;
+	  }
+	  continue;
+	}
+      }
+      std::vector<Token> tokens = Scanner::scanParallel(source, numThreads);
+      Module module = Parser::parseParallel(source, tokens, numThreads);
+      std::cout << path << ": " << tokens.size() << " tokens, "
+		<< module.size() << " definitions" << std::endl;
+      module.getDiagnostics().print(std::cerr, source);
+      status = module.getDiagnostics().hasErrors() ? 1 : status;
+      if (cache) {
+	try {
+	  cache->store(source.getText(), module);
+	} catch (const std::exception& e) {
+	  std::cerr << path << ": warning: " << e.what() << std::endl;
+	}
+      }
+      if (running && !module.getDiagnostics().hasErrors()) {
+	status = runModule(module, source, native) ? status : 1;
+      }
+    } catch (const std::exception& e) {
+      std::cerr << path << ": error: " << e.what() << std::endl;
+      status = 1;
+    }
+  }
+  return status;
 }
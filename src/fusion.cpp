@@ -0,0 +1,232 @@
+#include <algorithm>
+#include "casting.h"
+#include "fusion.h"
+#include "interpreter.h"
+#include "shape_inference.h"
+#include "tensor_ops.h"
+
+static bool isElementwise(const ExprNode& expr) {
+  if (isa<BinaryExprNode>(expr)) {
+    return true;
+  }
+  auto* call = dyn_cast<VariableExprNode>(&expr);
+  return call && call->getArgs().size() == 1 && call->getName().str() == "transpose";
+}
+
+static size_t countOperators(const ExprNode& expr) {
+  if (auto* binary = dyn_cast<BinaryExprNode>(&expr)) {
+    return 1 + countOperators(binary->getLHS()) + countOperators(binary->getRHS());
+  }
+  if (isElementwise(expr)) {
+    return 1 + countOperators(*cast<VariableExprNode>(expr).getArgs()[0]);
+  }
+  return 0;
+}
+
+void FusionPlan::build(const ExprNode& expr, bool transposed, FusedExpr& fused) {
+  FusedExpr::Step step;
+  if (auto* binary = dyn_cast<BinaryExprNode>(&expr)) {
+    build(binary->getLHS(), transposed, fused);
+    build(binary->getRHS(), transposed, fused);
+    step.Kind = FusedExpr::StepKind::Binary;
+    step.Operator = binary->getOp();
+    step.Offset = binary->getOffset();
+    fused.NumOperators += 1;
+  } else if (isElementwise(expr)) {
+    build(*cast<VariableExprNode>(expr).getArgs()[0], !transposed, fused);
+    step.Kind = FusedExpr::StepKind::Transpose;
+    fused.NumOperators += 1;
+  } else {
+    step.Kind = FusedExpr::StepKind::Leaf;
+    step.Leaf = fused.Leaves.size();
+    fused.Leaves.push_back({&expr, transposed});
+  }
+  fused.Steps.push_back(step);
+}
+
+void FusionPlan::collect(const ExprNode& expr) {
+  if (isElementwise(expr) && countOperators(expr) >= 2) {
+    FusedExpr& fused = Trees[&expr];
+    build(expr, false, fused);
+    for (const auto& leaf : fused.Leaves) {
+      collect(*leaf.Expr);
+    }
+  } else if (auto* binary = dyn_cast<BinaryExprNode>(&expr)) {
+    collect(binary->getLHS());
+    collect(binary->getRHS());
+  } else if (auto* call = dyn_cast<VariableExprNode>(&expr)) {
+    for (const auto& arg : call->getArgs()) {
+      collect(*arg);
+    }
+  } else if (auto* array = dyn_cast<ArrayExprNode>(&expr)) {
+    for (const auto& entry : array->getEntries()) {
+      collect(*entry);
+    }
+  }
+}
+
+FusionPlan::FusionPlan(const Module& module) {
+  for (const auto& definition : module.getDefinitions()) {
+    auto* function = dyn_cast<FunctionNode>(definition.get());
+    if (!function) {
+      continue;
+    }
+    for (const auto& stmt : function->getBody()) {
+      if (auto* assignment = dyn_cast<AssgnNode>(stmt.get())) {
+	collect(assignment->getExpr());
+      } else if (auto* expr = dyn_cast<ExprNode>(stmt.get())) {
+	collect(*expr);
+      }
+    }
+  }
+}
+
+const FusedExpr* FusionPlan::find(const ExprNode& expr) const {
+  auto it = Trees.find(&expr);
+  return it == Trees.end() ? nullptr : &it->second;
+}
+
+size_t FusionPlan::size() const {
+  return Trees.size();
+}
+
+namespace {
+// Where a tile reads an operand: one value for a scalar, otherwise one value
+// per element of the tile.
+struct Operand {
+  const double* Data;
+  bool Scalar;
+};
+} // namespace
+
+// Elements per tile; the scratch buffers of a tree stay well within L1.
+static constexpr size_t TileSize = 256;
+
+Tensor FusedExpr::evaluate(const std::function<Tensor(uint32_t)>& leafValue) const {
+  std::vector<Tensor> leaves(Leaves.size());
+  std::vector<std::vector<size_t>> shapes;
+  size_t maxDepth = 0;
+  for (const Step& step : Steps) {
+    switch (step.Kind) {
+    case StepKind::Leaf:
+      leaves[step.Leaf] = leafValue(step.Leaf);
+      shapes.push_back(leaves[step.Leaf].getShape());
+      maxDepth = std::max(maxDepth, shapes.size());
+      break;
+    case StepKind::Transpose:
+      std::reverse(shapes.back().begin(), shapes.back().end());
+      break;
+    case StepKind::Binary: {
+      std::vector<size_t> rhs = std::move(shapes.back());
+      shapes.pop_back();
+      std::vector<size_t>& lhs = shapes.back();
+      if (lhs != rhs && !lhs.empty() && !rhs.empty()) {
+	throw InterpreterError(step.Offset, std::string("operands of '") + (char)step.Operator +
+			       "' have shapes " + TensorShape(lhs).str() + " and " + TensorShape(rhs).str());
+      }
+      if (lhs.empty()) {
+	lhs = std::move(rhs);
+      }
+      break;
+    }
+    }
+  }
+
+  const std::vector<size_t>& dims = shapes.back();
+  Tensor result = Tensor::allocate(dims);
+  size_t total = result.size();
+  if (total == 0) {
+    return result;
+  }
+  // The stride of every output dimension in every leaf; zero for scalars.
+  size_t rank = dims.size();
+  std::vector<size_t> strides(leaves.size() * rank, 0);
+  bool remapped = false;
+  for (size_t i = 0; i < leaves.size(); i++) {
+    if (leaves[i].getRank() == 0) {
+      continue;
+    }
+    bool reversed = Leaves[i].Transposed && rank >= 2;
+    remapped |= reversed;
+    size_t stride = 1;
+    for (size_t d = rank; d-- > 0;) {
+      strides[i * rank + (reversed ? rank - 1 - d : d)] = stride;
+      stride *= leaves[i].getShape()[d];
+    }
+  }
+  // Without transposed leaves every leaf is read in order, so the output is
+  // one row; otherwise rows run along the last dimension.
+  size_t rowLength = remapped ? dims.back() : total;
+  std::vector<size_t> inner(leaves.size());
+  std::vector<size_t> base(leaves.size(), 0);
+  for (size_t i = 0; i < leaves.size(); i++) {
+    inner[i] = leaves[i].getRank() == 0 ? 0 : remapped ? strides[i * rank + rank - 1] : 1;
+  }
+  // The last binary operator writes into the output; trailing transposes
+  // have nothing left to do.
+  size_t last = Steps.size();
+  while (Steps[last - 1].Kind == StepKind::Transpose) {
+    last -= 1;
+  }
+  bool writesOutput = Steps[last - 1].Kind == StepKind::Binary;
+
+  std::vector<double> scratch(maxDepth * TileSize);
+  std::vector<Operand> stack;
+  stack.reserve(maxDepth);
+  std::vector<size_t> index(rank, 0);
+  double* out = result.data();
+  for (size_t row = 0; row < total; row += rowLength) {
+    for (size_t start = 0; start < rowLength; start += TileSize) {
+      size_t count = std::min(TileSize, rowLength - start);
+      double* dest = out + row + start;
+      stack.clear();
+      for (size_t s = 0; s < last; s++) {
+	const Step& step = Steps[s];
+	if (step.Kind == StepKind::Leaf) {
+	  const double* data = leaves[step.Leaf].data() + base[step.Leaf];
+	  size_t stride = inner[step.Leaf];
+	  if (stride <= 1) {
+	    stack.push_back({data + start * stride, stride == 0});
+	  } else {
+	    double* buffer = &scratch[stack.size() * TileSize];
+	    for (size_t k = 0; k < count; k++) {
+	      buffer[k] = data[(start + k) * stride];
+	    }
+	    stack.push_back({buffer, false});
+	  }
+	} else if (step.Kind == StepKind::Binary) {
+	  Operand rhs = stack.back();
+	  stack.pop_back();
+	  Operand& lhs = stack.back();
+	  double* target = s + 1 == last ? dest : &scratch[(stack.size() - 1) * TileSize];
+	  applyElementwise(step.Operator, lhs.Data, lhs.Scalar, rhs.Data, rhs.Scalar, target, count);
+	  lhs = {target, lhs.Scalar && rhs.Scalar};
+	}
+      }
+      if (!writesOutput) {
+	const Operand& value = stack.back();
+	if (value.Scalar) {
+	  std::fill(dest, dest + count, value.Data[0]);
+	} else {
+	  std::copy(value.Data, value.Data + count, dest);
+	}
+      }
+    }
+    if (remapped) {
+      for (size_t d = rank - 1; d-- > 0;) {
+	index[d] += 1;
+	for (size_t i = 0; i < leaves.size(); i++) {
+	  base[i] += strides[i * rank + d];
+	}
+	if (index[d] < dims[d]) {
+	  break;
+	}
+	for (size_t i = 0; i < leaves.size(); i++) {
+	  base[i] -= index[d] * strides[i * rank + d];
+	}
+	index[d] = 0;
+      }
+    }
+  }
+  return result;
+}
@@ -0,0 +1,68 @@
+#include <vector>
+#include "casting.h"
+#include "hash_cons.h"
+
+const Node* HashConsTable::intern(const Node& node) {
+  auto [it, end] = Nodes.equal_range(node.getHash());
+  for (; it != end; ++it) {
+    if (*it->second == node) {
+      return it->second;
+    }
+  }
+  Nodes.emplace(node.getHash(), &node);
+  return &node;
+}
+
+static void appendChildren(const Node& node, std::vector<const Node*>& nodes) {
+  auto append = [&nodes](const auto& children) {
+    for (const auto& child : children) {
+      nodes.push_back(child.get());
+    }
+  };
+  switch (node.getKind()) {
+  case NodeKind::VariableExpr:
+    append(cast<VariableExprNode>(node).getArgs());
+    break;
+  case NodeKind::BinaryExpr:
+    nodes.push_back(&cast<BinaryExprNode>(node).getLHS());
+    nodes.push_back(&cast<BinaryExprNode>(node).getRHS());
+    break;
+  case NodeKind::ArrayExpr:
+    append(cast<ArrayExprNode>(node).getEntries());
+    break;
+  case NodeKind::Assgn:
+    append(cast<AssgnNode>(node).getSize());
+    nodes.push_back(&cast<AssgnNode>(node).getExpr());
+    break;
+  case NodeKind::Function:
+    nodes.push_back(&cast<FunctionNode>(node).getPrototype());
+    append(cast<FunctionNode>(node).getBody());
+    break;
+  default:
+    break;
+  }
+}
+
+// Walks with an explicit stack, since expression chains can be deeper than
+// the call stack allows.
+size_t HashConsTable::internExpressions(const Node& root) {
+  std::vector<const Node*> pending{&root};
+  std::vector<const Node*> preorder;
+  while (!pending.empty()) {
+    const Node* node = pending.back();
+    pending.pop_back();
+    preorder.push_back(node);
+    appendChildren(*node, pending);
+  }
+  size_t numShared = 0;
+  for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+    if (isa<ExprNode>(*it) && intern(**it) != *it) {
+      numShared += 1;
+    }
+  }
+  return numShared;
+}
+
+size_t HashConsTable::size() const {
+  return Nodes.size();
+}
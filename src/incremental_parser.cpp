@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+#include <utility>
+#include "incremental_parser.h"
+#include "lexer.h"
+#include "token_stream.h"
+#include "utils.h"
+
+// True if scanning the text from pos on its own yields the same tokens as
+// scanning it in context: pos is not inside a comment and no token ending at
+// pos could have continued past it.
+bool IncrementalParser::isSafeBoundary(std::string_view text, size_t pos) {
+  if (pos == 0 || pos == text.size()) {
+    return true;
+  }
+  char prevChar = text[pos - 1];
+  if (std::isalnum((unsigned char)prevChar) || prevChar == '.') {
+    return false;
+  }
+  for (size_t i = pos; i > 0 && text[i - 1] != '\n'; i--) {
+    if (text[i - 1] == '#') {
+      return false;
+    }
+  }
+  return true;
+}
+
+IncrementalParser::Span IncrementalParser::parseSpan(std::string_view text, size_t start, uint64_t textHash) {
+  Span span{start, text.size(), textHash, nullptr, DiagnosticEngine()};
+  std::vector<LexToken> tokens = Scanner::scan(text);
+  VectorTokenStream stream(tokens);
+  Parser parser(stream, nullptr, &span.Diags);
+  // A span holds at most one 'def' or 'extern', so at most one definition.
+  while (std::unique_ptr<Node> definition = parser.parseDefinition()) {
+    span.Definition = std::move(definition);
+  }
+  return span;
+}
+
+void IncrementalParser::update(std::string newText) {
+  std::string_view oldView = Text;
+  std::string_view newView = newText;
+  size_t limit = std::min(oldView.size(), newView.size());
+  size_t prefix = std::mismatch(oldView.begin(), oldView.begin() + limit, newView.begin()).first - oldView.begin();
+  size_t suffix = 0;
+  while (suffix < limit - prefix && oldView[oldView.size() - 1 - suffix] == newView[newView.size() - 1 - suffix]) {
+    suffix += 1;
+  }
+  NumReparsed = 0;
+  if (prefix == oldView.size() && prefix == newView.size()) {
+    return;
+  }
+
+  // Spans [first, last) of the old text are replaced. The span before the
+  // edit is included so a token ending there can run into the edited text,
+  // and spans are added at the end until the region ends on a safe boundary.
+  auto spanAt = [this](size_t offset) {
+    auto it = std::upper_bound(Spans.begin(), Spans.end(), offset,
+			       [](size_t value, const Span& span) { return value < span.Start; });
+    return (size_t)(it - Spans.begin()) - 1;
+  };
+  size_t first = 0;
+  size_t last = Spans.size();
+  size_t damageEnd = oldView.size() - suffix;
+  if (!Spans.empty()) {
+    first = spanAt((prefix == 0) ? 0 : prefix - 1);
+    last = spanAt((damageEnd == 0) ? 0 : damageEnd - 1) + 1;
+  }
+  size_t regionStart = (first < Spans.size()) ? Spans[first].Start : 0;
+  size_t regionEnd = newView.size();
+  while (last < Spans.size()) {
+    regionEnd = Spans[last].Start + newView.size() - oldView.size();
+    if (isSafeBoundary(newView, regionEnd)) {
+      break;
+    }
+    last += 1;
+    regionEnd = newView.size();
+  }
+
+  // Old spans in the region can still be reused if their text reappears.
+  std::unordered_multimap<uint64_t, size_t> reusable;
+  for (size_t i = first; i < last; i++) {
+    reusable.emplace(Spans[i].Hash, i);
+  }
+  std::vector<size_t> pieceStarts{regionStart};
+  for (const Token& token : Scanner::scanRange(newView, regionStart, regionEnd)) {
+    if ((token.Type == TokenType::Def || token.Type == TokenType::Extern) && token.Offset != regionStart) {
+      pieceStarts.push_back(token.Offset);
+    }
+  }
+  pieceStarts.push_back(regionEnd);
+
+  std::vector<Span> replacement;
+  for (size_t i = 0; i + 1 < pieceStarts.size(); i++) {
+    size_t start = pieceStarts[i];
+    std::string_view text = newView.substr(start, pieceStarts[i + 1] - start);
+    if (text.empty()) {
+      continue;
+    }
+    // Spans are compared by text as well, so a collision only costs a compare.
+    uint64_t textHash = hashBytes(text);
+    auto [candidate, candidatesEnd] = reusable.equal_range(textHash);
+    while (candidate != candidatesEnd &&
+	   oldView.substr(Spans[candidate->second].Start, Spans[candidate->second].Length) != text) {
+      ++candidate;
+    }
+    if (candidate != candidatesEnd) {
+      Span& old = Spans[candidate->second];
+      replacement.push_back(Span{start, old.Length, old.Hash, std::move(old.Definition), std::move(old.Diags)});
+      reusable.erase(candidate);
+    } else {
+      replacement.push_back(parseSpan(text, start, textHash));
+      NumReparsed += 1;
+    }
+  }
+
+  for (size_t i = last; i < Spans.size(); i++) {
+    Spans[i].Start = Spans[i].Start + newView.size() - oldView.size();
+  }
+  Spans.erase(Spans.begin() + first, Spans.begin() + last);
+  Spans.insert(Spans.begin() + first, std::make_move_iterator(replacement.begin()),
+	       std::make_move_iterator(replacement.end()));
+  Text = std::move(newText);
+}
+
+const std::string& IncrementalParser::getText() const {
+  return Text;
+}
+
+size_t IncrementalParser::getNumSpans() const {
+  return Spans.size();
+}
+
+size_t IncrementalParser::getSpanStart(size_t index) const {
+  return Spans[index].Start;
+}
+
+const Node* IncrementalParser::getDefinition(size_t index) const {
+  return Spans[index].Definition.get();
+}
+
+const DiagnosticEngine& IncrementalParser::getDiagnostics(size_t index) const {
+  return Spans[index].Diags;
+}
+
+std::vector<const Node*> IncrementalParser::getDefinitions() const {
+  std::vector<const Node*> definitions;
+  for (const Span& span : Spans) {
+    if (span.Definition != nullptr) {
+      definitions.push_back(span.Definition.get());
+    }
+  }
+  return definitions;
+}
+
+DiagnosticEngine IncrementalParser::collectDiagnostics() const {
+  DiagnosticEngine diags;
+  for (const Span& span : Spans) {
+    for (const Diagnostic& diagnostic : span.Diags.getDiagnostics()) {
+      diags.report(diagnostic.Level, (uint32_t)(span.Start + diagnostic.Offset), diagnostic.Message);
+    }
+  }
+  return diags;
+}
+
+size_t IncrementalParser::getNumReparsed() const {
+  return NumReparsed;
+}
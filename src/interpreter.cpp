@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "ast_visitor.h"
+#include "casting.h"
+#include "fusion.h"
+#include "interpreter.h"
+#include "shape_inference.h"
+#include "tensor_ops.h"
+
+InterpreterError::InterpreterError(uint32_t offset, const std::string& message)
+  : std::runtime_error(message), Offset(offset) {}
+
+uint32_t InterpreterError::getOffset() const {
+  return Offset;
+}
+
+static std::string shapeString(const std::vector<size_t>& dims) {
+  return TensorShape(dims).str();
+}
+
+// Executes one call. Visiting an expression yields its value, or nullopt if
+// it has none; statements yield nullopt.
+class Interpreter::Evaluator : public ConstASTVisitor<Evaluator, std::optional<Tensor>> {
+  Interpreter& Interp;
+  std::unordered_map<Symbol, Tensor> Variables;
+
+  [[noreturn]] static void error(const Node& node, const std::string& message) {
+    throw InterpreterError(node.getOffset(), message);
+  }
+
+  // An operand of an operator, entry or argument, which must have a value.
+  Tensor evaluate(const ExprNode& expr) {
+    std::optional<Tensor> value = visit(expr);
+    if (!value.has_value()) {
+      error(expr, "expression has no value");
+    }
+    return std::move(*value);
+  }
+
+  static void checkArity(const VariableExprNode& call, size_t expected) {
+    if (call.getArgs().size() != expected) {
+      error(call, "'" + std::string(call.getName().str()) + "' expects " + std::to_string(expected) +
+	    " argument" + (expected == 1 ? "" : "s") + " but got " + std::to_string(call.getArgs().size()));
+    }
+  }
+
+  // A fused tree rooted at the node produces its value in one pass.
+  const FusedExpr* findFused(const ExprNode& node) const {
+    return Interp.Plan ? Interp.Plan->find(node) : nullptr;
+  }
+
+  Tensor evaluateFused(const FusedExpr& fused) {
+    return fused.evaluate([&](uint32_t leaf) { return evaluate(*fused.Leaves[leaf].Expr); });
+  }
+
+  std::optional<Tensor> evaluateCall(const VariableExprNode& call) {
+    std::vector<Tensor> args;
+    args.reserve(call.getArgs().size());
+    for (const auto& arg : call.getArgs()) {
+      args.push_back(evaluate(*arg));
+    }
+    std::string_view name = call.getName().str();
+    if (name == "print") {
+      checkArity(call, 1);
+      Interp.Out << args[0] << "\n";
+      return std::nullopt;
+    }
+    if (name == "transpose") {
+      checkArity(call, 1);
+      return transpose(args[0]);
+    }
+    auto it = Interp.Functions.find(call.getName());
+    if (it == Interp.Functions.end()) {
+      error(call, "unknown function '" + std::string(name) + "'");
+    }
+    if (auto* prototype = dyn_cast<PrototypeNode>(it->second)) {
+      checkArity(call, prototype->getArgs().size());
+      auto native = Interp.Natives.find(call.getName());
+      if (native == Interp.Natives.end()) {
+	error(call, "extern function '" + std::string(name) + "' has no implementation");
+      }
+      return native->second(args);
+    }
+    const auto& callee = cast<FunctionNode>(*it->second);
+    checkArity(call, callee.getPrototype().getArgs().size());
+    if (Interp.Depth == MaxCallDepth) {
+      error(call, "call depth exceeds " + std::to_string(MaxCallDepth));
+    }
+    return Interp.callFunction(callee, std::move(args));
+  }
+
+public:
+  std::optional<Tensor> visitNumberExprNode(const NumberExprNode& node) {
+    return Tensor::scalar(node.getValue());
+  }
+
+  std::optional<Tensor> visitConstantTensorNode(const ConstantTensorNode& node) {
+    return Tensor::fromValues(node.getShape(), node.getValues());
+  }
+
+  std::optional<Tensor> visitArrayExprNode(const ArrayExprNode& node) {
+    std::vector<Tensor> entries;
+    entries.reserve(node.getEntries().size());
+    for (const auto& entry : node.getEntries()) {
+      entries.push_back(evaluate(*entry));
+      if (entries.back().getShape() != entries.front().getShape()) {
+	error(*entry, "array entry has shape " + shapeString(entries.back().getShape()) +
+	      " but the previous entries have shape " + shapeString(entries.front().getShape()));
+      }
+    }
+    std::vector<size_t> dims{entries.size()};
+    if (!entries.empty()) {
+      dims.insert(dims.end(), entries[0].getShape().begin(), entries[0].getShape().end());
+    }
+    Tensor result = Tensor::allocate(std::move(dims));
+    double* out = result.data();
+    for (const Tensor& entry : entries) {
+      out = std::copy(entry.data(), entry.data() + entry.size(), out);
+    }
+    return result;
+  }
+
+  std::optional<Tensor> visitBinaryExprNode(const BinaryExprNode& node) {
+    if (const FusedExpr* fused = findFused(node)) {
+      return evaluateFused(*fused);
+    }
+    Tensor lhs = evaluate(node.getLHS());
+    Tensor rhs = evaluate(node.getRHS());
+    if (!canApplyElementwise(lhs, rhs)) {
+      error(node, std::string("operands of '") + (char)node.getOp() + "' have shapes " +
+	    shapeString(lhs.getShape()) + " and " + shapeString(rhs.getShape()));
+    }
+    return applyElementwise(node.getOp(), lhs, rhs);
+  }
+
+  std::optional<Tensor> visitVariableExprNode(const VariableExprNode& node) {
+    if (const FusedExpr* fused = findFused(node)) {
+      return evaluateFused(*fused);
+    }
+    if (!node.getArgs().empty()) {
+      return evaluateCall(node);
+    }
+    auto it = Variables.find(node.getName());
+    if (it == Variables.end()) {
+      error(node, "unknown variable '" + std::string(node.getName().str()) + "'");
+    }
+    return it->second;
+  }
+
+  // The parser records a missing size as <1>, which keeps the value's shape.
+  std::optional<Tensor> visitAssgnNode(const AssgnNode& node) {
+    Tensor value = evaluate(node.getExpr());
+    const auto& size = node.getSize();
+    if (node.isDecl() && !(size.size() == 1 && size[0]->getValue() == 1)) {
+      std::vector<size_t> dims;
+      size_t count = 1;
+      for (const auto& dim : size) {
+	double extent = dim->getValue();
+	if (extent < 1 || extent != std::floor(extent)) {
+	  error(*dim, "dimension must be a positive integer");
+	}
+	dims.push_back((size_t)extent);
+	count *= dims.back();
+      }
+      if (count != value.size()) {
+	error(node, "cannot reshape a value of shape " + shapeString(value.getShape()) + " to " +
+	      shapeString(dims));
+      }
+      value = value.reshape(std::move(dims));
+    }
+    Variables[node.getName()] = std::move(value);
+    return std::nullopt;
+  }
+
+  std::optional<Tensor> run(const FunctionNode& function, std::vector<Tensor> args) {
+    const auto& params = function.getPrototype().getArgs();
+    for (size_t i = 0; i < params.size(); i++) {
+      Variables[params[i]] = std::move(args[i]);
+    }
+    std::optional<Tensor> last;
+    for (const auto& stmt : function.getBody()) {
+      last = visit(*stmt);
+    }
+    return last;
+  }
+
+  Evaluator(Interpreter& interp) : Interp(interp) {}
+};
+
+Interpreter::Interpreter(const Module& module, std::ostream& out, Fusion fusion) : Out(out) {
+  if (fusion == Fusion::Enabled) {
+    Plan.emplace(module);
+  }
+  for (const auto& definition : module.getDefinitions()) {
+    Symbol name;
+    if (auto* function = dyn_cast<FunctionNode>(definition.get())) {
+      name = function->getPrototype().getName();
+    } else {
+      name = cast<PrototypeNode>(*definition).getName();
+    }
+    Functions.emplace(name, definition.get());
+  }
+}
+
+void Interpreter::defineExtern(Symbol name, NativeFunction function) {
+  Natives[name] = std::move(function);
+}
+
+std::optional<Tensor> Interpreter::callFunction(const FunctionNode& function, std::vector<Tensor> args) {
+  Depth += 1;
+  struct DepthGuard {
+    size_t& Depth;
+    ~DepthGuard() { Depth -= 1; }
+  } guard{Depth};
+  return Evaluator(*this).run(function, std::move(args));
+}
+
+std::optional<Tensor> Interpreter::call(Symbol name, std::vector<Tensor> args) {
+  auto it = Functions.find(name);
+  if (it == Functions.end() || !isa<FunctionNode>(it->second)) {
+    throw std::runtime_error("no function named '" + std::string(name.str()) + "'");
+  }
+  const auto& function = cast<FunctionNode>(*it->second);
+  if (function.getPrototype().getArgs().size() != args.size()) {
+    throw std::runtime_error("'" + std::string(name.str()) + "' expects " +
+			     std::to_string(function.getPrototype().getArgs().size()) + " arguments");
+  }
+  return callFunction(function, std::move(args));
+}
+
+void Interpreter::run() {
+  call(Symbol("main"), {});
+  Out.flush();
+}
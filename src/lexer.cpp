@@ -1,28 +1,34 @@
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <charconv>
 #include <cstdlib>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
+#include "char_scan.h"
 #include "lexer.h"
+#include "parallel.h"
+#include "source_file.h"
 
-bool isAcceptState(LexState state) {
-  return (int)state > 0;
+TokenType LexToken::getType() const {
+  return Type;
 }
 
-template <typename T>
-static void clearAndPush(std::stack<T>& fullStack, T&& item) {
-  while (!fullStack.empty()) {
-    fullStack.pop();
-  }
-  fullStack.push(item);
+std::string_view LexToken::getStr() const {
+  return SourceStr;
 }
 
-TokenType LexToken::getType() {
-  return Type;
+Symbol LexToken::getSymbol() const {
+  return Sym;
 }
 
-std::string LexToken::getStr() {
-  return SourceStr;
+double LexToken::getNumber() const {
+  return NumVal;
+}
+
+uint32_t LexToken::getOffset() const {
+  return Offset;
 }
 
 void LexToken::commonInit(TokenType type) {
@@ -41,7 +47,7 @@ void LexToken::commonInit(TokenType type) {
     SourceStr = "[";
     break;
   case TokenType::RightSquare:
-    SourceStr = "[";
+    SourceStr = "]";
     break;
   case TokenType::LeftAngle:
     SourceStr = "<";
@@ -80,577 +86,320 @@ void LexToken::commonInit(TokenType type) {
 }
 
 bool LexToken::operator==(const LexToken& other) const{
-  return ((Type == other.Type) && (SourceStr.length() == other.SourceStr.length()) &&
-	  (SourceStr.compare(other.SourceStr) == 0));
+  return ((Type == other.Type) && (SourceStr == other.SourceStr));
 }
 
 LexToken::LexToken(TokenType type) {
   commonInit(type);
 }
 
-LexToken::LexToken(TokenType type, std::string sourceStr) {
+LexToken::LexToken(TokenType type, std::string_view sourceStr, uint32_t offset) : Offset(offset) {
   commonInit(type);
-  if (SourceStr == "") {
+  if (SourceStr.empty()) {
     SourceStr = sourceStr;
   }
-}
-
-Scanner* Scanner::Instance = nullptr;
-
-Scanner& Scanner::getInstance() {
-  if (nullptr == Instance) {
-    Instance = new Scanner;
+  // Identifier and operator text is re-pointed at stable storage so these
+  // tokens stay valid after the buffer they were scanned from is gone.
+  if (type == TokenType::Identifier) {
+    Sym = Symbol(SourceStr);
+    SourceStr = Sym.str();
+  } else if (type == TokenType::Operator) {
+    static constexpr std::string_view operatorChars = "+-*/%";
+    size_t index = operatorChars.find(SourceStr[0]);
+    if (index != std::string_view::npos) {
+      SourceStr = operatorChars.substr(index, 1);
+    }
+  } else if (type == TokenType::Number) {
+    // Locale-independent and allocation-free; the DFA guarantees the text is
+    // digits with an optional fraction.
+    std::from_chars(SourceStr.data(), SourceStr.data() + SourceStr.length(), NumVal);
   }
-  return *Instance;
 }
 
-void Scanner::initialzeTransitionTable() {
-  Scanner scanner = Scanner::getInstance();
-  std::map<Lexeme, LexState> state0Transitions = {
-    {Lexeme::D, LexState::S1},           {Lexeme::E, LexState::S4},
-    {Lexeme::F, LexState::S13},          {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},          {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},          {Lexeme::V, LexState::S10},
-    {Lexeme::A, LexState::S13},          {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S14},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::S16}, {Lexeme::RightSquare, LexState::S17},
-    {Lexeme::LeftAngle, LexState::S18},  {Lexeme::RightAngle, LexState::S19},
-    {Lexeme::LeftParen, LexState::S20},  {Lexeme::RightParen, LexState::S21},
-    {Lexeme::LeftBrace, LexState::S22},  {Lexeme::RightBrace, LexState::S23},
-    {Lexeme::Equal, LexState::S24},      {Lexeme::Operator, LexState::S25},
-    {Lexeme::Semicolon, LexState::S26},  {Lexeme::Comma, LexState::S27},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state1Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S2},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state2Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S3},          {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state3Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state4Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S5},          {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state5Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S6},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state6Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S7},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state7Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S8},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state8Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S9},          {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state9Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S3},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state10Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S11},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state11Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S12},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state12Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state13Transitions = {
-    {Lexeme::D, LexState::S13},         {Lexeme::E, LexState::S13},
-    {Lexeme::F, LexState::S13},         {Lexeme::X, LexState::S13},
-    {Lexeme::T, LexState::S13},         {Lexeme::R, LexState::S13},
-    {Lexeme::N, LexState::S13},         {Lexeme::V, LexState::S13},
-    {Lexeme::A, LexState::S13},         {Lexeme::OtherChar, LexState::S13},
-    {Lexeme::Numeric, LexState::S13},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state14Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::S14},   {Lexeme::Dot, LexState::S15},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state15Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::S15},   {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state16Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state17Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state18Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state19Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state20Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state21Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state22Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state23Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state24Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state25Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state26Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> state27Transitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::LeftBrace, LexState::SE},  {Lexeme::RightBrace, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
-  std::map<Lexeme, LexState> stateETransitions = {
-    {Lexeme::D, LexState::SE},          {Lexeme::E, LexState::SE},
-    {Lexeme::F, LexState::SE},          {Lexeme::X, LexState::SE},
-    {Lexeme::T, LexState::SE},          {Lexeme::R, LexState::SE},
-    {Lexeme::N, LexState::SE},          {Lexeme::V, LexState::SE},
-    {Lexeme::A, LexState::SE},          {Lexeme::OtherChar, LexState::SE},
-    {Lexeme::Numeric, LexState::SE},    {Lexeme::Dot, LexState::SE},
-    {Lexeme::LeftSquare, LexState::SE}, {Lexeme::RightSquare, LexState::SE},
-    {Lexeme::LeftAngle, LexState::SE},  {Lexeme::RightAngle, LexState::SE},
-    {Lexeme::LeftParen, LexState::SE},  {Lexeme::RightParen, LexState::SE},
-    {Lexeme::Equal, LexState::SE},      {Lexeme::Operator, LexState::SE},
-    {Lexeme::Semicolon, LexState::SE},  {Lexeme::Comma, LexState::SE},
-    {Lexeme::Invalid, LexState::SE}};
+namespace {
 
-  TransitionTable = {{LexState::S0, std::move(state0Transitions)},
-		     {LexState::S1, std::move(state1Transitions)},
-		     {LexState::S2, std::move(state2Transitions)},
-		     {LexState::S3, std::move(state3Transitions)},
-		     {LexState::S4, std::move(state4Transitions)},
-		     {LexState::S5, std::move(state5Transitions)},
-		     {LexState::S6, std::move(state6Transitions)},
-		     {LexState::S7, std::move(state7Transitions)},
-		     {LexState::S8, std::move(state8Transitions)},
-		     {LexState::S9, std::move(state9Transitions)},
-		     {LexState::S10, std::move(state10Transitions)},
-		     {LexState::S11, std::move(state11Transitions)},
-		     {LexState::S12, std::move(state12Transitions)},
-		     {LexState::S13, std::move(state13Transitions)},
-		     {LexState::S14, std::move(state14Transitions)},
-		     {LexState::S15, std::move(state15Transitions)},
-		     {LexState::S16, std::move(state16Transitions)},
-		     {LexState::S17, std::move(state17Transitions)},
-		     {LexState::S18, std::move(state18Transitions)},
-		     {LexState::S19, std::move(state19Transitions)},
-		     {LexState::S20, std::move(state20Transitions)},
-		     {LexState::S21, std::move(state21Transitions)},
-		     {LexState::S22, std::move(state22Transitions)},
-		     {LexState::S23, std::move(state23Transitions)},
-		     {LexState::S24, std::move(state24Transitions)},
-		     {LexState::S25, std::move(state25Transitions)},
-		     {LexState::S26, std::move(state26Transitions)},
-		     {LexState::S27, std::move(state27Transitions)},
-		     {LexState::SE, std::move(stateETransitions)}};
-}
+typedef std::array<std::array<LexState, NumLexemes>, NumLexStates> TransitionArray;
+typedef std::array<std::array<LexState, 256>, NumLexStates> CharTransitionArray;
 
-void Scanner::initializeStateTable() {
-  TokenTypeTable = {
-    {LexState::S0, TokenType::Invalid},     {LexState::S1, TokenType::Identifier},
-    {LexState::S2, TokenType::Identifier},  {LexState::S3, TokenType::Def},
-    {LexState::S4, TokenType::Identifier},  {LexState::S5, TokenType::Identifier},
-    {LexState::S6, TokenType::Identifier},  {LexState::S7, TokenType::Identifier},
-    {LexState::S8, TokenType::Identifier},  {LexState::S9, TokenType::Extern},
-    {LexState::S10, TokenType::Identifier}, {LexState::S11, TokenType::Identifier},
-    {LexState::S12, TokenType::Var},        {LexState::S13, TokenType::Identifier},
-    {LexState::S14, TokenType::Number},     {LexState::S15, TokenType::Number},
-    {LexState::S16, TokenType::LeftSquare}, {LexState::S17, TokenType::RightSquare},
-    {LexState::S18, TokenType::LeftAngle},  {LexState::S19, TokenType::RightAngle},
-    {LexState::S20, TokenType::LeftParen},  {LexState::S21, TokenType::RightParen},
-    {LexState::S22, TokenType::LeftBrace},  {LexState::S23, TokenType::RightBrace},
-    {LexState::S24, TokenType::Equal},      {LexState::S25, TokenType::Operator},
-    {LexState::S26, TokenType::Semicolon},  {LexState::S27, TokenType::Comma},
-    {LexState::SE, TokenType::Invalid}};
+constexpr bool isIdentifierLexeme(Lexeme type) {
+  return (type <= Lexeme::OtherChar) || (type == Lexeme::Numeric);
 }
 
-void Scanner::initializeLexemeTypeTable() {
-  LexemeTypeTable = {
-    {'d', Lexeme::D},          {'e', Lexeme::E},          {'f', Lexeme::F},
-    {'x', Lexeme::X},          {'t', Lexeme::T},          {'r', Lexeme::R},
-    {'n', Lexeme::N},          {'v', Lexeme::V},          {'a', Lexeme::A},
-    {'.', Lexeme::Dot},        {'[', Lexeme::LeftSquare}, {']', Lexeme::RightSquare},
-    {'<', Lexeme::LeftAngle},  {'>', Lexeme::RightAngle}, {'(', Lexeme::LeftParen},
-    {')', Lexeme::RightParen}, {'{', Lexeme::LeftBrace},  {'}', Lexeme::RightBrace},
-    {'=', Lexeme::Equal},      {'+', Lexeme::Operator},   {'-', Lexeme::Operator},
-    {'*', Lexeme::Operator},   {'/', Lexeme::Operator},   {';', Lexeme::Semicolon},
-    {',', Lexeme::Comma}};
+constexpr void addTransition(TransitionArray& table, LexState from, Lexeme type, LexState to) {
+  table[(size_t)from][(size_t)type] = to;
 }
 
-Lexeme Scanner::getLexeme(char input) {
-  if (LexemeTypeTable.find(input) != LexemeTypeTable.end()) {
-    return LexemeTypeTable[input];
+// Identifier states S1-S13 continue as an identifier (S13) on any letter or
+// digit; only the letters spelling out a keyword branch off the path.
+constexpr TransitionArray buildTransitionTable() {
+  TransitionArray table{};
+  for (auto& row : table) {
+    for (auto& next : row) {
+      next = LexState::SE;
+    }
+  }
+  for (size_t state = (size_t)LexState::S1; state <= (size_t)LexState::S13; state++) {
+    for (size_t type = 0; type < NumLexemes; type++) {
+      if (isIdentifierLexeme((Lexeme)type)) {
+	table[state][type] = LexState::S13;
+      }
+    }
+  }
+  for (size_t type = 0; type <= (size_t)Lexeme::OtherChar; type++) {
+    table[(size_t)LexState::S0][type] = LexState::S13;
   }
-  Lexeme type;
-  if (isalpha((int)input)) {
-    type = Lexeme::OtherChar;
-  } else if (isdigit((int)input)) {
-    type = Lexeme::Numeric;
-  } else {
+  addTransition(table, LexState::S0, Lexeme::D, LexState::S1);
+  addTransition(table, LexState::S0, Lexeme::E, LexState::S4);
+  addTransition(table, LexState::S0, Lexeme::V, LexState::S10);
+  addTransition(table, LexState::S0, Lexeme::Numeric, LexState::S14);
+  addTransition(table, LexState::S0, Lexeme::LeftSquare, LexState::S16);
+  addTransition(table, LexState::S0, Lexeme::RightSquare, LexState::S17);
+  addTransition(table, LexState::S0, Lexeme::LeftAngle, LexState::S18);
+  addTransition(table, LexState::S0, Lexeme::RightAngle, LexState::S19);
+  addTransition(table, LexState::S0, Lexeme::LeftParen, LexState::S20);
+  addTransition(table, LexState::S0, Lexeme::RightParen, LexState::S21);
+  addTransition(table, LexState::S0, Lexeme::LeftBrace, LexState::S22);
+  addTransition(table, LexState::S0, Lexeme::RightBrace, LexState::S23);
+  addTransition(table, LexState::S0, Lexeme::Equal, LexState::S24);
+  addTransition(table, LexState::S0, Lexeme::Operator, LexState::S25);
+  addTransition(table, LexState::S0, Lexeme::Semicolon, LexState::S26);
+  addTransition(table, LexState::S0, Lexeme::Comma, LexState::S27);
+  // def
+  addTransition(table, LexState::S1, Lexeme::E, LexState::S2);
+  addTransition(table, LexState::S2, Lexeme::F, LexState::S3);
+  // extern
+  addTransition(table, LexState::S4, Lexeme::X, LexState::S5);
+  addTransition(table, LexState::S5, Lexeme::T, LexState::S6);
+  addTransition(table, LexState::S6, Lexeme::E, LexState::S7);
+  addTransition(table, LexState::S7, Lexeme::R, LexState::S8);
+  addTransition(table, LexState::S8, Lexeme::N, LexState::S9);
+  // var
+  addTransition(table, LexState::S10, Lexeme::A, LexState::S11);
+  addTransition(table, LexState::S11, Lexeme::R, LexState::S12);
+  // Numbers
+  addTransition(table, LexState::S14, Lexeme::Numeric, LexState::S14);
+  addTransition(table, LexState::S14, Lexeme::Dot, LexState::S15);
+  addTransition(table, LexState::S15, Lexeme::Numeric, LexState::S15);
+  return table;
+}
+
+constexpr std::array<Lexeme, 256> buildLexemeTypeTable() {
+  std::array<Lexeme, 256> table{};
+  for (auto& type : table) {
     type = Lexeme::Invalid;
   }
-  return type;
+  for (unsigned char c = 'a'; c <= 'z'; c++) {
+    table[c] = Lexeme::OtherChar;
+    table[c - 'a' + 'A'] = Lexeme::OtherChar;
+  }
+  for (unsigned char c = '0'; c <= '9'; c++) {
+    table[c] = Lexeme::Numeric;
+  }
+  table['d'] = Lexeme::D;          table['e'] = Lexeme::E;          table['f'] = Lexeme::F;
+  table['x'] = Lexeme::X;          table['t'] = Lexeme::T;          table['r'] = Lexeme::R;
+  table['n'] = Lexeme::N;          table['v'] = Lexeme::V;          table['a'] = Lexeme::A;
+  table['.'] = Lexeme::Dot;        table['['] = Lexeme::LeftSquare; table[']'] = Lexeme::RightSquare;
+  table['<'] = Lexeme::LeftAngle;  table['>'] = Lexeme::RightAngle; table['('] = Lexeme::LeftParen;
+  table[')'] = Lexeme::RightParen; table['{'] = Lexeme::LeftBrace;  table['}'] = Lexeme::RightBrace;
+  table['='] = Lexeme::Equal;      table['+'] = Lexeme::Operator;   table['-'] = Lexeme::Operator;
+  table['*'] = Lexeme::Operator;   table['/'] = Lexeme::Operator;   table['%'] = Lexeme::Operator;
+  table[';'] = Lexeme::Semicolon;  table[','] = Lexeme::Comma;
+  return table;
 }
 
-std::vector<LexToken> Scanner::scan(std::string inputBuffer) {
-  Scanner scanner = Scanner::getInstance();
-  scanner.initialzeTransitionTable();
-  scanner.initializeStateTable();
-  scanner.initializeLexemeTypeTable();
+// Folds the character class lookup into the transition table so that each
+// scanned character costs a single indexed load.
+constexpr CharTransitionArray buildCharTransitionTable() {
+  constexpr TransitionArray transitions = buildTransitionTable();
+  constexpr std::array<Lexeme, 256> lexemeTypes = buildLexemeTypeTable();
+  CharTransitionArray table{};
+  for (size_t state = 0; state < NumLexStates; state++) {
+    for (size_t c = 0; c < 256; c++) {
+      table[state][c] = transitions[state][(size_t)lexemeTypes[c]];
+    }
+  }
+  return table;
+}
+
+constexpr std::array<TokenType, NumLexStates> TokenTypeTable = {
+  TokenType::Invalid,    TokenType::Identifier,  TokenType::Identifier, TokenType::Def,
+  TokenType::Identifier, TokenType::Identifier,  TokenType::Identifier, TokenType::Identifier,
+  TokenType::Identifier, TokenType::Extern,      TokenType::Identifier, TokenType::Identifier,
+  TokenType::Var,        TokenType::Identifier,  TokenType::Number,     TokenType::Number,
+  TokenType::LeftSquare, TokenType::RightSquare, TokenType::LeftAngle,  TokenType::RightAngle,
+  TokenType::LeftParen,  TokenType::RightParen,  TokenType::LeftBrace,  TokenType::RightBrace,
+  TokenType::Equal,      TokenType::Operator,    TokenType::Semicolon,  TokenType::Comma,
+  TokenType::Invalid};
+
+constexpr CharTransitionArray TransitionTable = buildCharTransitionTable();
 
+inline LexState nextState(LexState state, char input) {
+  return TransitionTable[(size_t)state][(unsigned char)input];
+}
+
+inline TokenType tokenTypeOf(LexState state) {
+  return TokenTypeTable[(size_t)state];
+}
+
+}
+
+TokenType Scanner::scanToken(std::string_view inputBuffer, size_t tokenStart, size_t& tokenLength) {
+  // Maximal munch: run the DFA until it rejects, remembering only the last
+  // accepting state and where it ended.
+  const char* data = inputBuffer.data();
+  size_t length = inputBuffer.length();
+  size_t bufferPos = tokenStart;
   LexState currState = LexState::S0;
-  char currChar;
-  std::string lexeme;
-  size_t bufferPos = 0;
-  std::stack<LexState> stateStack;
-  std::vector<LexToken> tokens;
-  bool inComment = false;
-  while (bufferPos < inputBuffer.length()) {
-    currChar = inputBuffer[bufferPos];
-    if (currChar == '\f' || currChar == '\n' || currChar == '\r') {
-      inComment = false;
-      bufferPos += 1;
-    } else if (currChar == '#') {
-      inComment = true;
-      bufferPos += 1;
+  LexState acceptState = LexState::SE;
+  size_t acceptEnd = tokenStart;
+  while (bufferPos < length) {
+    currState = nextState(currState, data[bufferPos]);
+    if (currState == LexState::SE) {
+      break;
+    }
+    bufferPos += 1;
+    if (tokenTypeOf(currState) != TokenType::Invalid) {
+      acceptState = currState;
+      acceptEnd = bufferPos;
+    }
+  }
+  tokenLength = acceptEnd - tokenStart;
+  return tokenTypeOf(acceptState);
+}
 
-    } else if (isspace(currChar)) {
-      bufferPos += 1;
-    } else if (inComment) {
-      bufferPos += 1;
+std::runtime_error Scanner::invalidLexemeError(SourceLocation location, char lexeme) {
+  std::stringstream diag;
+  diag << location.str() << ": Invalid lexeme " << lexeme;
+  return std::runtime_error(diag.str());
+}
+// Runs the longest-match DFA over the buffer from bufferPos on and reports
+// every token as an offset/length pair into it, so callers decide how tokens
+// are materialized. The location of an invalid lexeme is only worked out
+// once one is found.
+template <typename EmitFn>
+static void scanBuffer(std::string_view inputBuffer, size_t bufferPos, EmitFn&& emit) {
+  const char* data = inputBuffer.data();
+  size_t length = inputBuffer.length();
+  while (bufferPos < length) {
+    char currChar = data[bufferPos];
+    if (currChar == '#') {
+      bufferPos = skipToLineEnd(inputBuffer, bufferPos + 1);
+    } else if (isWhitespaceChar(currChar)) {
+      bufferPos = skipWhitespace(inputBuffer, bufferPos + 1);
     } else {
-      lexeme = "";
-      currState = LexState::S0;
-      clearAndPush(stateStack, std::move(LexState::SE));
-      while (currState != LexState::SE) {
-	lexeme += currChar;
-	if (scanner.TokenTypeTable[currState] != TokenType::Invalid) {
-	  clearAndPush(stateStack, std::move(LexState::SE));
-	}
-	stateStack.push(currState);
-	Lexeme type = scanner.getLexeme(currChar);
-	currState = scanner.TransitionTable[currState][type];
-	bufferPos += 1;
-	currChar = inputBuffer[bufferPos];
-      }
-      while (scanner.TokenTypeTable[currState] == TokenType::Invalid) {
-	currState = stateStack.top();
-	stateStack.pop();
-	if (!stateStack.empty()) {
-	  lexeme = lexeme.substr(0, lexeme.length() - 1);
-	  bufferPos = bufferPos - 1;
-	} else {
-	  break;
-	}
-      }
-      if (scanner.TokenTypeTable[currState] != TokenType::Invalid) {
-	LexToken token(scanner.TokenTypeTable[currState], lexeme);
-	tokens.push_back(token);
-      } else {
-	std::stringstream diag;
-	diag << "Invalid lexeme";
-	diag << lexeme;
-	throw std::runtime_error(diag.str());
+      size_t tokenLength;
+      TokenType type = Scanner::scanToken(inputBuffer, bufferPos, tokenLength);
+      if (type == TokenType::Invalid) {
+	throw Scanner::invalidLexemeError(LineTable::locate(inputBuffer, bufferPos), currChar);
       }
+      emit(type, bufferPos, tokenLength);
+      bufferPos += tokenLength;
     }
   }
-  tokens.push_back(LexToken(TokenType::Eof));
+}
+
+// Splits the buffer into about numPieces pieces, each ending right after a
+// newline. A newline ends any comment and any token, so the pieces can be
+// scanned independently and their tokens concatenated.
+static std::vector<size_t> splitAtNewlines(std::string_view inputBuffer, size_t numPieces) {
+  std::vector<size_t> bounds = {0};
+  for (size_t k = 1; k < numPieces; k++) {
+    size_t target = std::max(bounds.back(), inputBuffer.length() / numPieces * k);
+    size_t newline = inputBuffer.find('\n', target);
+    if (newline == std::string_view::npos) {
+      break;
+    }
+    if (newline + 1 > bounds.back() && newline + 1 < inputBuffer.length()) {
+      bounds.push_back(newline + 1);
+    }
+  }
+  bounds.push_back(inputBuffer.length());
+  return bounds;
+}
+
+template <typename TokenT, typename MakeFn>
+static std::vector<TokenT> scanPieces(std::string_view inputBuffer, unsigned numThreads, MakeFn&& make) {
+  // Pieces below a few hundred kilobytes cost more to hand out than to scan.
+  constexpr size_t MinPieceSize = size_t(1) << 18;
+  numThreads = resolveThreadCount(numThreads);
+  size_t numPieces = std::min<size_t>((size_t)numThreads * 4, inputBuffer.length() / MinPieceSize + 1);
+  std::vector<size_t> bounds = splitAtNewlines(inputBuffer, numPieces);
+  numPieces = bounds.size() - 1;
+  std::vector<std::vector<TokenT>> pieces(numPieces);
+  parallelFor(numPieces, numThreads, [&](size_t i) {
+    pieces[i].reserve((bounds[i + 1] - bounds[i]) / 4 + 1);
+    scanBuffer(inputBuffer.substr(0, bounds[i + 1]), bounds[i], [&](TokenType type, size_t offset, size_t length) {
+      pieces[i].push_back(make(type, offset, length));
+    });
+  });
+  size_t numTokens = 1;
+  for (const auto& piece : pieces) {
+    numTokens += piece.size();
+  }
+  std::vector<TokenT> tokens;
+  tokens.reserve(numTokens);
+  for (const auto& piece : pieces) {
+    tokens.insert(tokens.end(), piece.begin(), piece.end());
+  }
+  return tokens;
+}
+
+static void checkScannable(const SourceFile& source) {
+  if (source.getText().length() >= UINT32_MAX) {
+    std::stringstream diag;
+    diag << "Source file too large: " << source.getName();
+    throw std::runtime_error(diag.str());
+  }
+}
+
+std::vector<LexToken> Scanner::scan(std::string_view inputBuffer) {
+  std::vector<LexToken> tokens;
+  scanBuffer(inputBuffer, 0, [&](TokenType type, size_t offset, size_t length) {
+    tokens.emplace_back(type, inputBuffer.substr(offset, length), (uint32_t)offset);
+  });
+  tokens.push_back(LexToken(TokenType::Eof, "", (uint32_t)inputBuffer.length()));
+  return tokens;
+}
+
+std::vector<Token> Scanner::scan(const SourceFile& source) {
+  checkScannable(source);
+  std::string_view inputBuffer = source.getText();
+  std::vector<Token> tokens;
+  // Tokens average well over two bytes of source, so this is normally the only
+  // allocation; pages past the final size are reserved but never touched.
+  tokens.reserve(inputBuffer.length() / 2 + 1);
+  scanBuffer(inputBuffer, 0, [&](TokenType type, size_t offset, size_t length) {
+    tokens.push_back(Token{type, (uint32_t)offset, (uint32_t)length});
+  });
+  tokens.push_back(Token{TokenType::Eof, (uint32_t)inputBuffer.length(), 0});
+  return tokens;
+}
+
+std::vector<Token> Scanner::scanRange(std::string_view inputBuffer, size_t begin, size_t end) {
+  std::vector<Token> tokens;
+  scanBuffer(inputBuffer.substr(0, end), begin, [&](TokenType type, size_t offset, size_t length) {
+    tokens.push_back(Token{type, (uint32_t)offset, (uint32_t)length});
+  });
+  tokens.push_back(Token{TokenType::Eof, (uint32_t)end, 0});
+  return tokens;
+}
+
+std::vector<LexToken> Scanner::scanParallel(std::string_view inputBuffer, unsigned numThreads) {
+  std::vector<LexToken> tokens = scanPieces<LexToken>(inputBuffer, numThreads,
+    [&](TokenType type, size_t offset, size_t length) {
+      return LexToken(type, inputBuffer.substr(offset, length), (uint32_t)offset);
+    });
+  tokens.push_back(LexToken(TokenType::Eof, "", (uint32_t)inputBuffer.length()));
+  return tokens;
+}
+
+std::vector<Token> Scanner::scanParallel(const SourceFile& source, unsigned numThreads) {
+  checkScannable(source);
+  std::string_view inputBuffer = source.getText();
+  std::vector<Token> tokens = scanPieces<Token>(inputBuffer, numThreads,
+    [](TokenType type, size_t offset, size_t length) {
+      return Token{type, (uint32_t)offset, (uint32_t)length};
+    });
+  tokens.push_back(Token{TokenType::Eof, (uint32_t)inputBuffer.length(), 0});
   return tokens;
 }
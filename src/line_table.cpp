@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "char_scan.h"
+#include "line_table.h"
+
+std::string SourceLocation::str() const {
+  return std::to_string(Line) + ":" + std::to_string(Column);
+}
+
+SourceLocation LineTable::locate(std::string_view buffer, size_t offset) {
+  std::string_view before = buffer.substr(0, offset);
+  size_t lineStart = before.rfind('\n');
+  lineStart = (lineStart == std::string_view::npos) ? 0 : lineStart + 1;
+  return SourceLocation{(uint32_t)(countNewlines(before) + 1), (uint32_t)(before.length() - lineStart + 1)};
+}
+
+// Counting first sizes the table exactly; memchr then finds each line start.
+LineTable::LineTable(std::string_view buffer) {
+  LineStarts.reserve(countNewlines(buffer) + 1);
+  LineStarts.push_back(0);
+  const char* data = buffer.data();
+  const char* end = data + buffer.length();
+  const char* pos = data;
+  while (pos < end) {
+    const char* newline = (const char*)std::memchr(pos, '\n', (size_t)(end - pos));
+    if (newline == nullptr) {
+      break;
+    }
+    pos = newline + 1;
+    LineStarts.push_back((uint32_t)(pos - data));
+  }
+}
+
+SourceLocation LineTable::getLocation(size_t offset) const {
+  auto next = std::upper_bound(LineStarts.begin(), LineStarts.end(), (uint32_t)offset);
+  size_t line = (size_t)(next - LineStarts.begin());
+  return SourceLocation{(uint32_t)line, (uint32_t)(offset - LineStarts[line - 1] + 1)};
+}
+
+size_t LineTable::getNumLines() const {
+  return LineStarts.size();
+}
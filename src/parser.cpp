@@ -1,73 +1,417 @@
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <map>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
+#include "arena.h"
+#include "ast_visitor.h"
+#include "casting.h"
+#include "diagnostics.h"
 #include "lexer.h"
+#include "parallel.h"
 #include "parser.h"
+#include "source_file.h"
+#include "token_stream.h"
 
-bool operator==(const std::vector<std::unique_ptr<Node>>& n1, const std::vector<std::unique_ptr<Node>>& n2) {
-  std::cout << "Called vec" << std::endl;
-  if (n1.size() != n2.size()) {
+// Allocation header, sized to keep the node itself maximally aligned.
+static constexpr size_t NodeHeaderSize = alignof(std::max_align_t);
+static constexpr uintptr_t HeapNodeTag = 0;
+static constexpr uintptr_t ArenaNodeTag = 1;
+
+void* Node::operator new(size_t size) {
+  char* base = (char*)::operator new(size + NodeHeaderSize);
+  *(uintptr_t*)base = HeapNodeTag;
+  return base + NodeHeaderSize;
+}
+
+void* Node::operator new(size_t size, Arena& arena) {
+  char* base = (char*)arena.allocate(size + NodeHeaderSize, NodeHeaderSize);
+  *(uintptr_t*)base = ArenaNodeTag;
+  return base + NodeHeaderSize;
+}
+
+void Node::operator delete(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  char* base = (char*)ptr - NodeHeaderSize;
+  if (*(uintptr_t*)base == HeapNodeTag) {
+    ::operator delete(base);
+  }
+}
+
+void Node::operator delete(void*, Arena&) {
+}
+
+namespace {
+
+// Compares a node against another node already known to have the same kind.
+class StructuralEquality : public ConstASTVisitor<StructuralEquality, bool> {
+  const Node& Other;
+
+public:
+  bool visitNumberExprNode(const NumberExprNode& node) {
+    return node.getValue() == cast<NumberExprNode>(Other).getValue();
+  }
+
+  bool visitVariableExprNode(const VariableExprNode& node) {
+    const VariableExprNode& other = cast<VariableExprNode>(Other);
+    return (node.getName() == other.getName()) && (node.getArgs() == other.getArgs());
+  }
+
+  bool visitBinaryExprNode(const BinaryExprNode& node) {
+    const BinaryExprNode& other = cast<BinaryExprNode>(Other);
+    return ((node.getOp() == other.getOp()) &&
+	    (node.getLHS() == other.getLHS()) &&
+	    (node.getRHS() == other.getRHS()));
+  }
+
+  bool visitArrayExprNode(const ArrayExprNode& node) {
+    return node.getEntries() == cast<ArrayExprNode>(Other).getEntries();
+  }
+
+  bool visitConstantTensorNode(const ConstantTensorNode& node) {
+    const ConstantTensorNode& other = cast<ConstantTensorNode>(Other);
+    return (node.getShape() == other.getShape()) && (node.getValues() == other.getValues());
+  }
+
+  bool visitAssgnNode(const AssgnNode& node) {
+    const AssgnNode& other = cast<AssgnNode>(Other);
+    return ((node.getName() == other.getName()) &&
+	    (node.getSize() == other.getSize()) &&
+	    (node.getExpr() == other.getExpr()) &&
+	    (node.isDecl() == other.isDecl()));
+  }
+
+  bool visitPrototypeNode(const PrototypeNode& node) {
+    const PrototypeNode& other = cast<PrototypeNode>(Other);
+    return (node.getName() == other.getName()) && (node.getArgs() == other.getArgs());
+  }
+
+  bool visitFunctionNode(const FunctionNode& node) {
+    const FunctionNode& other = cast<FunctionNode>(Other);
+    return (node.getPrototype() == other.getPrototype()) && (node.getBody() == other.getBody());
+  }
+
+  bool visitNode(const Node&) {
     return false;
   }
-  for (size_t i = 0; i < n1.size(); i++) {
-    if (!(*n1[i] == *n2[i])) {
+
+  StructuralEquality(const Node& other) : Other(other) {}
+};
+
+// Flattens a literal made only of numbers into its shape and row-major
+// values. Fails for non-constant or ragged literals.
+bool flattenLiteral(const Node& node, std::vector<size_t>& shape, std::vector<double>& values) {
+  if (auto* number = dyn_cast<NumberExprNode>(&node)) {
+    shape.clear();
+    values.push_back(number->getValue());
+    return true;
+  } else if (auto* tensor = dyn_cast<ConstantTensorNode>(&node)) {
+    shape = tensor->getShape();
+    values.insert(values.end(), tensor->getValues().begin(), tensor->getValues().end());
+    return true;
+  } else if (auto* array = dyn_cast<ArrayExprNode>(&node)) {
+    std::vector<size_t> entryShape;
+    for (size_t i = 0; i < array->getEntries().size(); i++) {
+      std::vector<size_t> shapeOfEntry;
+      if (!flattenLiteral(*array->getEntries()[i], shapeOfEntry, values)) {
+	return false;
+      }
+      if (i > 0 && shapeOfEntry != entryShape) {
+	return false;
+      }
+      entryShape = std::move(shapeOfEntry);
+    }
+    shape.assign(1, array->getEntries().size());
+    shape.insert(shape.end(), entryShape.begin(), entryShape.end());
+    return true;
+  }
+  return false;
+}
+
+bool isTensorLiteralKind(NodeKind kind) {
+  return (kind == NodeKind::ArrayExpr) || (kind == NodeKind::ConstantTensorExpr);
+}
+
+// Rotate-xor-multiply step; cheap enough to run for every node built, and
+// collisions only cost a structural comparison.
+uint64_t combineHash(uint64_t seed, uint64_t value) {
+  return (((seed << 5) | (seed >> 59)) ^ value) * 0x517cc1b727220a95ull;
+}
+
+uint64_t kindSeed(NodeKind kind) {
+  return ((uint64_t)kind + 1) * 0x9e3779b97f4a7c15ull;
+}
+
+uint64_t numberHash(double value) {
+  // 0.0 and -0.0 compare equal, so they must hash alike.
+  if (value == 0) {
+    value = 0;
+  }
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return combineHash(kindSeed(NodeKind::NumberExpr), bits);
+}
+
+// Hash of the nested ArrayExpr of NumberExprs a constant tensor stands for.
+uint64_t nestedLiteralHash(const std::vector<size_t>& shape, size_t dim, const double*& value, const double* end) {
+  if (dim == shape.size()) {
+    return (value < end) ? numberHash(*value++) : 0;
+  }
+  uint64_t hash = kindSeed(NodeKind::ArrayExpr);
+  for (size_t i = 0; i < shape[dim]; i++) {
+    hash = combineHash(hash, nestedLiteralHash(shape, dim + 1, value, end));
+  }
+  return hash;
+}
+
+// Combines a node's own fields with the already computed hashes of its
+// children.
+class StructuralHash : public ConstASTVisitor<StructuralHash, uint64_t> {
+  template<typename T>
+  static uint64_t combineChildren(uint64_t hash, const std::vector<std::unique_ptr<T>>& children) {
+    for (const auto& child : children) {
+      hash = combineHash(hash, child->getHash());
+    }
+    return hash;
+  }
+
+public:
+  uint64_t visitNumberExprNode(const NumberExprNode& node) {
+    return numberHash(node.getValue());
+  }
+
+  uint64_t visitVariableExprNode(const VariableExprNode& node) {
+    uint64_t hash = combineHash(kindSeed(NodeKind::VariableExpr), node.getName().getId());
+    return combineChildren(hash, node.getArgs());
+  }
+
+  uint64_t visitBinaryExprNode(const BinaryExprNode& node) {
+    uint64_t hash = combineHash(kindSeed(NodeKind::BinaryExpr), (uint64_t)node.getOp());
+    return combineHash(combineHash(hash, node.getLHS().getHash()), node.getRHS().getHash());
+  }
+
+  uint64_t visitArrayExprNode(const ArrayExprNode& node) {
+    return combineChildren(kindSeed(NodeKind::ArrayExpr), node.getEntries());
+  }
+
+  uint64_t visitConstantTensorNode(const ConstantTensorNode& node) {
+    const double* value = node.getValues().data();
+    return nestedLiteralHash(node.getShape(), 0, value, value + node.getValues().size());
+  }
+
+  uint64_t visitAssgnNode(const AssgnNode& node) {
+    uint64_t hash = combineHash(kindSeed(NodeKind::Assgn), node.getName().getId());
+    hash = combineHash(combineChildren(hash, node.getSize()), node.getExpr().getHash());
+    return combineHash(hash, node.isDecl() ? 1 : 0);
+  }
+
+  uint64_t visitPrototypeNode(const PrototypeNode& node) {
+    uint64_t hash = combineHash(kindSeed(NodeKind::Prototype), node.getName().getId());
+    for (Symbol arg : node.getArgs()) {
+      hash = combineHash(hash, arg.getId());
+    }
+    return hash;
+  }
+
+  uint64_t visitFunctionNode(const FunctionNode& node) {
+    uint64_t hash = combineHash(kindSeed(NodeKind::Function), node.getPrototype().getHash());
+    return combineChildren(hash, node.getBody());
+  }
+};
+
+}
+
+BinaryExprNode::~BinaryExprNode() {
+  std::vector<std::unique_ptr<ExprNode>> pending;
+  auto detach = [&](std::unique_ptr<ExprNode>& child) {
+    if (child && child->getKind() == NodeKind::BinaryExpr) {
+      pending.push_back(std::move(child));
+    }
+  };
+  detach(LHS);
+  detach(RHS);
+  while (!pending.empty()) {
+    std::unique_ptr<ExprNode> node = std::move(pending.back());
+    pending.pop_back();
+    auto& binary = static_cast<BinaryExprNode&>(*node);
+    detach(binary.LHS);
+    detach(binary.RHS);
+  }
+}
+
+void Node::initHash() {
+  Hash = StructuralHash().visit(*this);
+}
+
+bool Node::operator==(const Node& other) const {
+  if (Hash != other.Hash) {
+    return false;
+  }
+  if (Kind != other.Kind) {
+    if (!isTensorLiteralKind(Kind) || !isTensorLiteralKind(other.Kind)) {
       return false;
     }
+    std::vector<size_t> shape, otherShape;
+    std::vector<double> values, otherValues;
+    return (flattenLiteral(*this, shape, values) &&
+	    flattenLiteral(other, otherShape, otherValues) &&
+	    (shape == otherShape) && (values == otherValues));
+  }
+  return StructuralEquality(other).visit(*this);
+}
+
+Module::Module(NodeAllocation allocation)
+  : NodeArena((allocation == NodeAllocation::Arena) ? std::make_unique<Arena>() : nullptr) {}
+
+Arena* Module::getArena() {
+  return NodeArena.get();
+}
+
+std::vector<std::unique_ptr<Node>>& Module::getDefinitions() {
+  return Definitions;
+}
+
+const std::vector<std::unique_ptr<Node>>& Module::getDefinitions() const {
+  return Definitions;
+}
+
+size_t Module::size() const {
+  return Definitions.size();
+}
+
+std::unique_ptr<Node>& Module::operator[](size_t index) {
+  return Definitions[index];
+}
+
+std::vector<std::unique_ptr<Node>>::iterator Module::begin() {
+  return Definitions.begin();
+}
+
+std::vector<std::unique_ptr<Node>>::iterator Module::end() {
+  return Definitions.end();
+}
+
+void Module::append(Module&& other) {
+  if (other.NodeArena != nullptr) {
+    MergedArenas.push_back(std::move(other.NodeArena));
   }
-  return true;
+  for (auto& arena : other.MergedArenas) {
+    MergedArenas.push_back(std::move(arena));
+  }
+  other.MergedArenas.clear();
+  for (auto& definition : other.Definitions) {
+    Definitions.push_back(std::move(definition));
+  }
+  other.Definitions.clear();
+  Diags.append(std::move(other.Diags));
 }
 
-Parser* Parser::Instance = nullptr;
+DiagnosticEngine& Module::getDiagnostics() {
+  return Diags;
+}
+
+const DiagnosticEngine& Module::getDiagnostics() const {
+  return Diags;
+}
 
-Parser& Parser::getInstance() {
-  if (nullptr == Instance) {
-    Instance = new Parser;
+// Binary operator precedence indexed by the operator character; -1 marks
+// characters that are not binary operators.
+static constexpr std::array<int8_t, 256> buildBinopPrecedenceTable() {
+  std::array<int8_t, 256> table{};
+  for (auto& prec : table) {
+    prec = -1;
   }
-  return *Instance;
+  table[(unsigned char)Op::Plus] = 10;
+  table[(unsigned char)Op::Minus] = 10;
+  table[(unsigned char)Op::Times] = 20;
+  table[(unsigned char)Op::Divide] = 20;
+  table[(unsigned char)Op::Modulus] = 20;
+  return table;
 }
 
-void Parser::reset() {
-  TokenPos = 0;
-  Tokens.clear();
+static constexpr std::array<int8_t, 256> BinopPrecedence = buildBinopPrecedenceTable();
+
+static inline int precedenceOf(char op) {
+  return BinopPrecedence[(unsigned char)op];
 }
 
-void Parser::syncTo(TokenType syncToken) {
-  if (syncToken == TokenType::Invalid) {
-    return;
+Parser::Parser(TokenStream& tokens, Arena* nodeArena, DiagnosticEngine* diags)
+  : NodeArena(nodeArena), Tokens(tokens), Diags((diags != nullptr) ? *diags : OwnDiags) {}
+
+DiagnosticEngine& Parser::getDiagnostics() {
+  return Diags;
+}
+
+static std::string describe(TokenType type) {
+  switch (type) {
+  case TokenType::Identifier:
+    return "identifier";
+  case TokenType::Number:
+    return "number";
+  case TokenType::Operator:
+    return "operator";
+  case TokenType::Eof:
+    return "end of file";
+  default:
+    return "'" + std::string(LexToken(type).getStr()) + "'";
   }
-  bool syncronized = false;
-  LexToken nextToken = peakNextToken();
-  while (!(nextToken.getType() == syncToken)) {
-    nextToken = getNextToken();
+}
+
+static std::string describe(const LexToken& token) {
+  if (token.getType() == TokenType::Eof) {
+    return "end of file";
   }
+  return "'" + std::string(token.getStr()) + "'";
 }
 
-LexToken& Parser::peakNextToken() {
-  return Tokens[TokenPos];
+void Parser::syntaxError(const LexToken& token, const std::string& message) {
+  Diags.error(token.getOffset(), message + " but found " + describe(token));
+  throw SyntaxError();
 }
 
-LexToken& Parser::getNextToken() {
-  if (TokenPos > Tokens.size()) {
-    // error
-    // exit
+// Panic mode inside a function body: drop the rest of the statement up to and
+// including its ';', but never past the end of the body or the definition.
+void Parser::recoverInStatement() {
+  while (!accept(TokenType::Semicolon) && !accept(TokenType::RightBrace) && !accept(TokenType::Def) &&
+	 !accept(TokenType::Extern) && !accept(TokenType::Eof)) {
+    getNextToken();
+  }
+  if (accept(TokenType::Semicolon)) {
+    getNextToken();
   }
-  LexToken& token = Tokens[TokenPos];
-  TokenPos += 1;
-  return token;
 }
 
-LexToken& Parser::expect(TokenType expectedTokenType, TokenType syncTokenType) {
-  LexToken& nextToken = getNextToken();
-  if (!(nextToken.getType() == expectedTokenType)) {
-    // error!
-    syncTo(syncTokenType);
+// Panic mode at the top level: drop tokens until the next definition.
+void Parser::recoverAtTopLevel() {
+  while (!accept(TokenType::Def) && !accept(TokenType::Extern) && !accept(TokenType::Eof)) {
+    getNextToken();
   }
-  return nextToken;
+}
+
+const LexToken& Parser::peakNextToken() {
+  return Tokens.peek();
+}
+
+LexToken Parser::getNextToken() {
+  return Tokens.next();
+}
+
+// Reports a mismatch without consuming the offending token, so recovery can
+// still synchronize on it.
+LexToken Parser::expect(TokenType expectedTokenType) {
+  if (!accept(expectedTokenType)) {
+    syntaxError(peakNextToken(), "expected " + describe(expectedTokenType));
+  }
+  return getNextToken();
 }
 
 bool Parser::accept(TokenType tokenType) {
@@ -75,85 +419,143 @@ bool Parser::accept(TokenType tokenType) {
 }
 
 std::unique_ptr<AssgnNode> Parser::parseVarDecl() {
-  expect(TokenType::Var, TokenType::Identifier);
-  LexToken idToken = expect(TokenType::Identifier, TokenType::Equal);
-  std::string id = idToken.getStr();
+  uint32_t offset = expect(TokenType::Var).getOffset();
+  LexToken idToken = expect(TokenType::Identifier);
+  Symbol id = idToken.getSymbol();
   std::vector<std::unique_ptr<NumberExprNode>> size;
   if (accept(TokenType::LeftAngle)) {
     size = parseSize();
   } else {
-    size.push_back(std::make_unique<NumberExprNode>(1));
+    size.push_back(makeNode<NumberExprNode>(idToken.getOffset(), 1));
   }
-  expect(TokenType::Equal, TokenType::Invalid);
+  expect(TokenType::Equal);
   std::unique_ptr<ExprNode> expr = parseExpr();
-  return std::make_unique<AssgnNode>(id, std::move(size), std::move(expr), true);
+  return makeNode<AssgnNode>(offset, id, std::move(size), std::move(expr), true);
 }
 
-std::unique_ptr<ArrayExprNode> Parser::parseArray() {
-  expect(TokenType::LeftSquare, TokenType::Invalid);
+// All-constant literals, nested or not, are collected straight into one
+// buffer without building a node per element. Elements already collected are
+// turned back into nodes only if a non-constant or ragged entry turns up.
+std::unique_ptr<ExprNode> Parser::parseArray() {
+  uint32_t offset = expect(TokenType::LeftSquare).getOffset();
   std::vector<std::unique_ptr<ExprNode>> arr;
-  std::unique_ptr<ExprNode> expr = parseExpr();
-  arr.push_back(std::move(expr));
-  while (accept(TokenType::Comma)) {
-    expect(TokenType::Comma, TokenType::Invalid);
-    expr = parseExpr();
+  std::vector<double> values;
+  std::vector<uint32_t> entryOffsets;
+  std::vector<size_t> entryShape;
+  size_t numEntries = 0;
+  bool isConstant = true;
+  auto demote = [&]() {
+    size_t entrySize = values.size() / numEntries;
+    for (size_t i = 0; i < numEntries; i++) {
+      if (entryShape.empty()) {
+	arr.push_back(makeNode<NumberExprNode>(entryOffsets[i], values[i]));
+      } else {
+	std::vector<double> entryValues(values.begin() + i * entrySize, values.begin() + (i + 1) * entrySize);
+	arr.push_back(makeNode<ConstantTensorNode>(entryOffsets[i], entryShape, std::move(entryValues)));
+      }
+    }
+    values.clear();
+    isConstant = false;
+  };
+  do {
+    if (numEntries > 0 || !arr.empty()) {
+      expect(TokenType::Comma);
+    }
+    TokenType following = Tokens.peek(1).getType();
+    if (isConstant && accept(TokenType::Number) &&
+	(following == TokenType::Comma || following == TokenType::RightSquare)) {
+      LexToken numToken = expect(TokenType::Number);
+      if (numEntries == 0 || entryShape.empty()) {
+	values.push_back(numToken.getNumber());
+	entryOffsets.push_back(numToken.getOffset());
+	numEntries += 1;
+	continue;
+      }
+      demote();
+      arr.push_back(makeNode<NumberExprNode>(numToken.getOffset(), numToken.getNumber()));
+      continue;
+    }
+    std::unique_ptr<ExprNode> expr = parseExpr();
+    if (isConstant) {
+      if (auto* tensor = dyn_cast<ConstantTensorNode>(expr.get())) {
+	if (numEntries == 0 || tensor->getShape() == entryShape) {
+	  entryShape = tensor->getShape();
+	  values.insert(values.end(), tensor->getValues().begin(), tensor->getValues().end());
+	  entryOffsets.push_back(tensor->getOffset());
+	  numEntries += 1;
+	  continue;
+	}
+      }
+      if (numEntries > 0) {
+	demote();
+      } else {
+	isConstant = false;
+      }
+    }
     arr.push_back(std::move(expr));
+  } while (accept(TokenType::Comma));
+  expect(TokenType::RightSquare);
+  if (isConstant) {
+    std::vector<size_t> shape;
+    shape.reserve(entryShape.size() + 1);
+    shape.push_back(numEntries);
+    shape.insert(shape.end(), entryShape.begin(), entryShape.end());
+    return makeNode<ConstantTensorNode>(offset, std::move(shape), std::move(values));
   }
-  expect(TokenType::RightSquare, TokenType::Invalid);
-  return std::make_unique<ArrayExprNode>(std::move(arr));
+  return makeNode<ArrayExprNode>(offset, std::move(arr));
 }
 
 std::vector<std::unique_ptr<NumberExprNode>> Parser::parseSize() {
-  expect(TokenType::LeftAngle, TokenType::Invalid);
+  expect(TokenType::LeftAngle);
   std::vector<std::unique_ptr<NumberExprNode>> size;
-  LexToken numToken = expect(TokenType::Number, TokenType::Invalid);
-  size.push_back(std::make_unique<NumberExprNode>(std::stod(numToken.getStr())));
+  LexToken numToken = expect(TokenType::Number);
+  size.push_back(makeNode<NumberExprNode>(numToken.getOffset(), numToken.getNumber()));
   while (accept(TokenType::Comma)) {
-    expect(TokenType::Comma, TokenType::Invalid);
-    numToken = expect(TokenType::Number, TokenType::Invalid);
-    size.push_back(std::make_unique<NumberExprNode>(std::stod(numToken.getStr())));
+    expect(TokenType::Comma);
+    numToken = expect(TokenType::Number);
+    size.push_back(makeNode<NumberExprNode>(numToken.getOffset(), numToken.getNumber()));
   }
-  expect(TokenType::RightAngle, TokenType::Invalid);
+  expect(TokenType::RightAngle);
   return size;
 }
 
 std::unique_ptr<AssgnNode> Parser::parseAssgn() {
-  LexToken idToken = expect(TokenType::Identifier, TokenType::Invalid);
-  std::string id = idToken.getStr();
-  expect(TokenType::Equal, TokenType::Invalid);
+  LexToken idToken = expect(TokenType::Identifier);
+  Symbol id = idToken.getSymbol();
+  expect(TokenType::Equal);
   std::unique_ptr<ExprNode> expr = parseExpr();
   std::vector<std::unique_ptr<NumberExprNode>> size;
-  size.push_back(std::make_unique<NumberExprNode>(1));
-  return std::make_unique<AssgnNode>(id, std::move(size), std::move(expr), false);
+  size.push_back(makeNode<NumberExprNode>(idToken.getOffset(), 1));
+  return makeNode<AssgnNode>(idToken.getOffset(), id, std::move(size), std::move(expr), false);
 }
 
 std::unique_ptr<NumberExprNode> Parser::parseNumberExpr() {
-  LexToken numToken = expect(TokenType::Number, TokenType::Invalid);
-  double val = std::stod(numToken.getStr());
-  return std::make_unique<NumberExprNode>(val);
+  LexToken numToken = expect(TokenType::Number);
+  double val = numToken.getNumber();
+  return makeNode<NumberExprNode>(numToken.getOffset(), val);
 }
 
 std::unique_ptr<ExprNode> Parser::parseParenExpr() {
-  expect(TokenType::LeftParen, TokenType::Invalid);
+  expect(TokenType::LeftParen);
   std::unique_ptr<ExprNode> expr = parseExpr();
-  expect(TokenType::RightParen, TokenType::Invalid);
+  expect(TokenType::RightParen);
   return expr;
 }
 
 std::unique_ptr<ExprNode> Parser::parseIdentifier() {
-  LexToken idToken = expect(TokenType::Identifier, TokenType::Invalid);
-  std::string id = idToken.getStr();
+  LexToken idToken = expect(TokenType::Identifier);
+  Symbol id = idToken.getSymbol();
   std::vector<std::unique_ptr<ExprNode>> args;
   if (accept(TokenType::LeftParen)) {
-    expect(TokenType::LeftParen, TokenType::Invalid);
+    expect(TokenType::LeftParen);
     args.push_back(parseExpr());
     while (accept(TokenType::Comma)) {
-      expect(TokenType::Comma, TokenType::Invalid);
+      expect(TokenType::Comma);
       args.push_back(parseExpr());
     }
-    expect(TokenType::RightParen, TokenType::Invalid);
+    expect(TokenType::RightParen);
   }
-  return std::make_unique<VariableExprNode>(id, std::move(args));
+  return makeNode<VariableExprNode>(idToken.getOffset(), id, std::move(args));
 }
 
 std::unique_ptr<ExprNode> Parser::parsePrimary() {
@@ -162,8 +564,10 @@ std::unique_ptr<ExprNode> Parser::parsePrimary() {
     expr = parseNumberExpr();
   } else if (accept(TokenType::LeftParen)) {
     expr = parseParenExpr();
-  } else {
+  } else if (accept(TokenType::Identifier)) {
     expr = parseIdentifier();
+  } else {
+    syntaxError(peakNextToken(), "expected expression");
   }
   return expr;
 }
@@ -190,13 +594,13 @@ std::unique_ptr<StmtNode> Parser::parseStmt() {
   } else if (accept(TokenType::Var)) {
     stmt = parseVarDecl();
   } else {
-    if (Tokens[TokenPos + 1].getType() == TokenType::Equal) {
+    if (Tokens.peek(1).getType() == TokenType::Equal) {
       stmt = parseAssgn();
     } else {
       stmt = parseExpr();
     }
   }
-  expect(TokenType::Semicolon, TokenType::Semicolon);
+  expect(TokenType::Semicolon);
   return stmt;
 }
 
@@ -204,78 +608,202 @@ std::vector<std::unique_ptr<StmtNode>> Parser::parseStmtList() {
   std::vector<std::unique_ptr<StmtNode>> stmts;
   while (accept(TokenType::Var) || \
 	 accept(TokenType::LeftSquare) || \
+	 accept(TokenType::LeftParen) || \
 	 accept(TokenType::Identifier) || \
 	 accept(TokenType::Number)) {
-    stmts.push_back(parseStmt());
+    try {
+      stmts.push_back(parseStmt());
+    } catch (const SyntaxError&) {
+      recoverInStatement();
+    }
   }
   return stmts;
 }
 
-std::unique_ptr<BinaryExprNode> Parser::parseBinOpRhs(int prec, std::unique_ptr<ExprNode> LHS) {
-  LexToken opToken = expect(TokenType::Operator, TokenType::Invalid);
-  Op op = (Op)(opToken.getStr().c_str()[0]);
-  std::unique_ptr<ExprNode> rhs = parsePrimary();
-  if (accept(TokenType::Operator)) {
-      LexToken lookaheadOpToken =  expect(TokenType::Operator, TokenType::Invalid);
-      Op lookaheadOp = (Op)(lookaheadOpToken.getStr().c_str()[0]);
-      if (BinopPrecedence[lookaheadOp] > BinopPrecedence[op]) {
-	std::unique_ptr<ExprNode> newRhs = parseBinOpRhs(1 + BinopPrecedence[lookaheadOp], std::move(rhs));
-	rhs.swap(newRhs);
-      }
+// Precedence climbing without recursion: operands and operators wait on
+// explicit stacks until an operator of lower or equal precedence arrives, so
+// the stacks never hold more than one entry per precedence level no matter
+// how long the chain is. Equal precedence reduces first, which makes every
+// operator left-associative.
+std::unique_ptr<ExprNode> Parser::parseBinOpRhs(int minPrec, std::unique_ptr<ExprNode> lhs) {
+  std::vector<std::unique_ptr<ExprNode>> operands;
+  std::vector<Op> ops;
+  std::vector<uint32_t> opOffsets;
+  operands.push_back(std::move(lhs));
+  auto reduce = [&]() {
+    std::unique_ptr<ExprNode> rhs = std::move(operands.back());
+    operands.pop_back();
+    operands.back() = makeNode<BinaryExprNode>(opOffsets.back(), ops.back(), std::move(operands.back()),
+					       std::move(rhs));
+    ops.pop_back();
+    opOffsets.pop_back();
+  };
+  while (accept(TokenType::Operator)) {
+    char opChar = peakNextToken().getStr()[0];
+    int prec = precedenceOf(opChar);
+    if (prec < minPrec) {
+      break;
     }
-  return std::make_unique<BinaryExprNode>(op, std::move(LHS), std::move(rhs));
+    uint32_t opOffset = getNextToken().getOffset();
+    while (!ops.empty() && precedenceOf((char)ops.back()) >= prec) {
+      reduce();
+    }
+    ops.push_back((Op)opChar);
+    opOffsets.push_back(opOffset);
+    operands.push_back(parsePrimary());
+  }
+  while (!ops.empty()) {
+    reduce();
+  }
+  return std::move(operands.back());
 }
 
 std::unique_ptr<PrototypeNode> Parser::parsePrototype() {
-  LexToken idToken = expect(TokenType::Identifier, TokenType::LeftParen);
-  std::string id = idToken.getStr();
-  expect(TokenType::LeftParen, TokenType::Invalid);
-  std::vector<std::string> args;
+  LexToken idToken = expect(TokenType::Identifier);
+  Symbol id = idToken.getSymbol();
+  expect(TokenType::LeftParen);
+  std::vector<Symbol> args;
   if(accept(TokenType::Identifier)) {
-    LexToken argToken = expect(TokenType::Identifier, TokenType::RightParen);
-    args.push_back(argToken.getStr());
+    LexToken argToken = expect(TokenType::Identifier);
+    args.push_back(argToken.getSymbol());
     while (accept(TokenType::Comma)) {
-      expect(TokenType::Comma, TokenType::Invalid);
-      argToken = expect(TokenType::Identifier, TokenType::RightParen);
-      args.push_back(argToken.getStr());
+      expect(TokenType::Comma);
+      argToken = expect(TokenType::Identifier);
+      args.push_back(argToken.getSymbol());
     }
   }
-  expect(TokenType::RightParen, TokenType::Invalid);
-  return std::make_unique<PrototypeNode>(id, std::move(args));
+  expect(TokenType::RightParen);
+  return makeNode<PrototypeNode>(idToken.getOffset(), id, std::move(args));
 }
 
 std::unique_ptr<PrototypeNode> Parser::parseExtern() {
-  expect(TokenType::Extern, TokenType::LeftParen);
+  expect(TokenType::Extern);
   std::unique_ptr<PrototypeNode> prototype = parsePrototype();
   return prototype;
 }
 
 std::unique_ptr<FunctionNode> Parser::parseFunction() {
-  expect(TokenType::Def, TokenType::LeftParen);
+  uint32_t offset = expect(TokenType::Def).getOffset();
   std::unique_ptr<PrototypeNode> prototype = parsePrototype();
-  expect(TokenType::LeftBrace, TokenType::Semicolon);
+  expect(TokenType::LeftBrace);
   std::vector<std::unique_ptr<StmtNode>> stmtList = parseStmtList();
-  expect(TokenType::RightBrace, TokenType::Invalid);
-  return std::make_unique<FunctionNode>(std::move(prototype), std::move(stmtList));
-}
-
-std::vector<std::unique_ptr<Node>> Parser::parse(std::vector<LexToken> tokens) {
-  Parser parser = Parser::getInstance();
-  parser.Tokens = tokens;
-  parser.TokenPos = 0;
-  parser.BinopPrecedence = {{Op::Plus, 10}, {Op::Minus, 10}, {Op::Times, 20}, {Op::Divide, 20}, {Op::Modulus, 20}};
-  std::vector<std::unique_ptr<Node>> externFuncsAndDefs;
-  std::unique_ptr<Node> func;
-
-  while (!(parser.accept(TokenType::Eof))) {
-    if (parser.accept(TokenType::Extern)) {
-      func = parser.parseExtern();
-    } else if (parser.accept(TokenType::Def)) {
-      func = parser.parseFunction();
-    } else {
-      break;
+  expect(TokenType::RightBrace);
+  return makeNode<FunctionNode>(offset, std::move(prototype), std::move(stmtList));
+}
+
+std::unique_ptr<Node> Parser::parseDefinition() {
+  while (true) {
+    // Stray semicolons between definitions, as in "};", are allowed.
+    while (accept(TokenType::Semicolon)) {
+      getNextToken();
     }
+    try {
+      if (accept(TokenType::Extern)) {
+	return parseExtern();
+      } else if (accept(TokenType::Def)) {
+	return parseFunction();
+      } else if (accept(TokenType::Eof)) {
+	return nullptr;
+      }
+      LexToken stray = getNextToken();
+      syntaxError(stray, "expected 'def' or 'extern'");
+    } catch (const SyntaxError&) {
+      recoverAtTopLevel();
+    }
+  }
+}
+Module Parser::parse(TokenStream& tokens, NodeAllocation allocation) {
+  Module module(allocation);
+  Parser parser(tokens, module.getArena(), &module.getDiagnostics());
+  std::vector<std::unique_ptr<Node>>& externFuncsAndDefs = module.getDefinitions();
+  while (std::unique_ptr<Node> func = parser.parseDefinition()) {
     externFuncsAndDefs.push_back(std::move(func));
   }
-  return externFuncsAndDefs;
+  return module;
+}
+
+Module Parser::parse(const std::vector<LexToken>& tokens, NodeAllocation allocation) {
+  VectorTokenStream stream(tokens);
+  return parse(stream, allocation);
+}
+
+Module Parser::parse(const SourceFile& source, const std::vector<Token>& tokens, NodeAllocation allocation) {
+  CompactTokenStream stream(source, tokens);
+  return parse(stream, allocation);
+}
+
+std::vector<size_t> Parser::findDefinitionStarts(const std::vector<Token>& tokens) {
+  std::vector<size_t> starts;
+  size_t depth = 0;
+  for (size_t i = 0; i < tokens.size(); i++) {
+    TokenType type = tokens[i].Type;
+    if (type == TokenType::LeftBrace) {
+      depth += 1;
+    } else if (type == TokenType::RightBrace) {
+      depth -= (depth > 0) ? 1 : 0;
+    } else if (depth == 0 && (type == TokenType::Def || type == TokenType::Extern)) {
+      starts.push_back(i);
+    }
+  }
+  return starts;
+}
+
+Module Parser::parseParallel(const SourceFile& source, const std::vector<Token>& tokens, unsigned numThreads,
+			     NodeAllocation allocation) {
+  numThreads = resolveThreadCount(numThreads);
+  std::vector<size_t> starts = findDefinitionStarts(tokens);
+  if (numThreads == 1 || starts.size() < 2 || starts[0] != 0) {
+    return parse(source, tokens, allocation);
+  }
+  // Batch consecutive definitions into chunks of roughly equal token count,
+  // several per thread so that uneven definitions still balance out.
+  size_t eofPos = tokens.size() - 1;
+  size_t targetTokens = std::max<size_t>(1, eofPos / ((size_t)numThreads * 8));
+  std::vector<size_t> chunkStarts;
+  for (size_t start : starts) {
+    if (chunkStarts.empty() || start - chunkStarts.back() >= targetTokens) {
+      chunkStarts.push_back(start);
+    }
+  }
+  chunkStarts.push_back(eofPos);
+  size_t numChunks = chunkStarts.size() - 1;
+
+  std::vector<Module> results;
+  results.reserve(numChunks);
+  for (size_t i = 0; i < numChunks; i++) {
+    results.emplace_back(allocation);
+  }
+  // A chunk is clean when its definitions consumed exactly its tokens without
+  // peeking past its end; anything else is left to the sequential parser.
+  std::vector<char> clean(numChunks, 0);
+  parallelFor(numChunks, numThreads, [&](size_t i) {
+    try {
+      CompactTokenStream stream(source, tokens, chunkStarts[i], chunkStarts[i + 1]);
+      Parser parser(stream, results[i].getArena(), &results[i].getDiagnostics());
+      bool overran = false;
+      while (std::unique_ptr<Node> definition = parser.parseDefinition()) {
+	overran = overran || stream.reachedEnd();
+	results[i].getDefinitions().push_back(std::move(definition));
+      }
+      clean[i] = !overran && stream.peek().getType() == TokenType::Eof;
+    } catch (...) {
+      // Left unclean; the sequential reparse below reports the error.
+    }
+  });
+
+  Module module(allocation);
+  for (size_t i = 0; i < numChunks; i++) {
+    if (clean[i]) {
+      module.append(std::move(results[i]));
+      continue;
+    }
+    // Reparse from here on exactly as parse() would have seen it.
+    CompactTokenStream stream(source, tokens, chunkStarts[i]);
+    Parser parser(stream, module.getArena(), &module.getDiagnostics());
+    while (std::unique_ptr<Node> definition = parser.parseDefinition()) {
+      module.getDefinitions().push_back(std::move(definition));
+    }
+    break;
+  }
+  return module;
 }
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <tuple>
+#include <utility>
+#include "ast_visitor.h"
+#include "casting.h"
+#include "shape_inference.h"
+
+TensorShape::TensorShape(std::vector<size_t> dims) : Dims(std::move(dims)), Known(true) {}
+
+TensorShape TensorShape::scalar() {
+  return TensorShape(std::vector<size_t>{});
+}
+
+bool TensorShape::isKnown() const {
+  return Known;
+}
+
+const std::vector<size_t>& TensorShape::getDims() const {
+  return Dims;
+}
+
+size_t TensorShape::getRank() const {
+  return Dims.size();
+}
+
+size_t TensorShape::getNumElements() const {
+  size_t count = 1;
+  for (size_t dim : Dims) {
+    count *= dim;
+  }
+  return count;
+}
+
+std::string TensorShape::str() const {
+  if (!Known) {
+    return "<?>";
+  }
+  std::stringstream out;
+  out << "<";
+  for (size_t i = 0; i < Dims.size(); i++) {
+    out << (i > 0 ? ", " : "") << Dims[i];
+  }
+  out << ">";
+  return out.str();
+}
+
+bool TensorShape::operator==(const TensorShape& other) const {
+  return (Known == other.Known) && (Dims == other.Dims);
+}
+
+bool TensorShape::operator!=(const TensorShape& other) const {
+  return !(*this == other);
+}
+
+bool TensorShape::operator<(const TensorShape& other) const {
+  return std::tie(Known, Dims) < std::tie(other.Known, other.Dims);
+}
+
+ShapeInference::Specialization::Specialization(const FunctionNode& function, std::vector<TensorShape> argShapes)
+  : Function(function), ArgShapes(std::move(argShapes)) {}
+
+const TensorShape* ShapeInference::Specialization::getShape(const ExprNode& expr) const {
+  auto it = ExprShapes.find(&expr);
+  return (it != ExprShapes.end()) ? &it->second : nullptr;
+}
+
+const ShapeInference::Specialization*
+ShapeInference::Specialization::getCallee(const VariableExprNode& call) const {
+  auto it = Callees.find(&call);
+  return (it != Callees.end()) ? it->second : nullptr;
+}
+
+// Infers one specialization's body. Visiting an expression yields its shape,
+// or nullopt if it has no value; statements yield nullopt.
+class ShapeInference::BodyInference : public ConstASTVisitor<BodyInference, std::optional<TensorShape>> {
+  ShapeInference& Inference;
+  Specialization& Spec;
+  std::unordered_map<Symbol, TensorShape> Variables;
+
+  void error(const Node& node, const std::string& message) {
+    Inference.Diags.error(node.getOffset(), message);
+  }
+
+  std::optional<TensorShape> infer(const ExprNode& expr) {
+    std::optional<TensorShape> shape = visit(expr);
+    if (shape.has_value()) {
+      Spec.ExprShapes[&expr] = *shape;
+    }
+    return shape;
+  }
+
+  // An operand of an operator, entry or argument, which must have a value.
+  TensorShape inferValue(const ExprNode& expr) {
+    std::optional<TensorShape> shape = infer(expr);
+    if (!shape.has_value()) {
+      error(expr, "expression has no value");
+      return TensorShape();
+    }
+    return *shape;
+  }
+
+  bool checkArity(const VariableExprNode& call, size_t expected) {
+    if (call.getArgs().size() == expected) {
+      return true;
+    }
+    error(call, "'" + std::string(call.getName().str()) + "' expects " + std::to_string(expected) +
+	  " argument" + (expected == 1 ? "" : "s") + " but got " + std::to_string(call.getArgs().size()));
+    return false;
+  }
+
+  std::optional<TensorShape> inferCall(const VariableExprNode& call) {
+    std::vector<TensorShape> argShapes;
+    for (const auto& arg : call.getArgs()) {
+      argShapes.push_back(inferValue(*arg));
+    }
+    std::string_view name = call.getName().str();
+    if (name == "print") {
+      checkArity(call, 1);
+      return std::nullopt;
+    }
+    if (name == "transpose") {
+      if (!checkArity(call, 1) || !argShapes[0].isKnown()) {
+	return TensorShape();
+      }
+      std::vector<size_t> dims = argShapes[0].getDims();
+      std::reverse(dims.begin(), dims.end());
+      return TensorShape(std::move(dims));
+    }
+    auto it = Inference.Functions.find(call.getName());
+    if (it == Inference.Functions.end()) {
+      error(call, "unknown function '" + std::string(name) + "'");
+      return TensorShape();
+    }
+    if (auto* prototype = dyn_cast<PrototypeNode>(it->second)) {
+      checkArity(call, prototype->getArgs().size());
+      return TensorShape();
+    }
+    const auto& callee = cast<FunctionNode>(*it->second);
+    if (!checkArity(call, callee.getPrototype().getArgs().size())) {
+      return TensorShape();
+    }
+    const Specialization& calleeSpec = Inference.specialize(callee, argShapes);
+    Spec.Callees[&call] = &calleeSpec;
+    // A recursive call sees its own specialization before it is finished.
+    if (calleeSpec.InProgress) {
+      return TensorShape();
+    }
+    return calleeSpec.Result;
+  }
+
+public:
+  std::optional<TensorShape> visitNumberExprNode(const NumberExprNode&) {
+    return TensorShape::scalar();
+  }
+
+  std::optional<TensorShape> visitConstantTensorNode(const ConstantTensorNode& node) {
+    return TensorShape(node.getShape());
+  }
+
+  std::optional<TensorShape> visitArrayExprNode(const ArrayExprNode& node) {
+    std::optional<TensorShape> entryShape;
+    bool known = true;
+    for (const auto& entry : node.getEntries()) {
+      TensorShape shape = inferValue(*entry);
+      known = known && shape.isKnown();
+      if (known && entryShape.has_value() && shape != *entryShape) {
+	error(*entry, "array entry has shape " + shape.str() + " but the previous entries have shape " +
+	      entryShape->str());
+	known = false;
+      }
+      entryShape = shape;
+    }
+    if (!known) {
+      return TensorShape();
+    }
+    std::vector<size_t> dims{node.getEntries().size()};
+    if (entryShape.has_value()) {
+      dims.insert(dims.end(), entryShape->getDims().begin(), entryShape->getDims().end());
+    }
+    return TensorShape(std::move(dims));
+  }
+
+  std::optional<TensorShape> visitBinaryExprNode(const BinaryExprNode& node) {
+    TensorShape lhs = inferValue(node.getLHS());
+    TensorShape rhs = inferValue(node.getRHS());
+    if (!lhs.isKnown() || !rhs.isKnown()) {
+      return TensorShape();
+    }
+    if (lhs == rhs || rhs.getRank() == 0) {
+      return lhs;
+    }
+    if (lhs.getRank() == 0) {
+      return rhs;
+    }
+    error(node, std::string("operands of '") + (char)node.getOp() + "' have shapes " + lhs.str() + " and " +
+	  rhs.str());
+    return TensorShape();
+  }
+
+  std::optional<TensorShape> visitVariableExprNode(const VariableExprNode& node) {
+    if (!node.getArgs().empty()) {
+      return inferCall(node);
+    }
+    auto it = Variables.find(node.getName());
+    if (it == Variables.end()) {
+      error(node, "unknown variable '" + std::string(node.getName().str()) + "'");
+      return TensorShape();
+    }
+    return it->second;
+  }
+
+  // The parser records a missing size as <1>, which takes the value's shape.
+  std::optional<TensorShape> visitAssgnNode(const AssgnNode& node) {
+    TensorShape shape = inferValue(node.getExpr());
+    const auto& size = node.getSize();
+    if (node.isDecl() && !(size.size() == 1 && size[0]->getValue() == 1)) {
+      std::vector<size_t> dims;
+      for (const auto& dim : size) {
+	double value = dim->getValue();
+	if (value < 1 || value != std::floor(value)) {
+	  error(*dim, "dimension must be a positive integer");
+	  Variables[node.getName()] = TensorShape();
+	  return std::nullopt;
+	}
+	dims.push_back((size_t)value);
+      }
+      TensorShape declared(std::move(dims));
+      if (shape.isKnown() && shape.getNumElements() != declared.getNumElements()) {
+	error(node, "cannot reshape a value of shape " + shape.str() + " to " + declared.str());
+      }
+      shape = declared;
+    }
+    Variables[node.getName()] = shape;
+    return std::nullopt;
+  }
+
+  void run() {
+    const auto& params = Spec.Function.getPrototype().getArgs();
+    for (size_t i = 0; i < params.size(); i++) {
+      Variables[params[i]] = Spec.ArgShapes[i];
+    }
+    const auto& body = Spec.Function.getBody();
+    std::optional<TensorShape> last;
+    for (const auto& stmt : body) {
+      last = isa<ExprNode>(stmt.get()) ? infer(cast<ExprNode>(*stmt)) : visit(*stmt);
+    }
+    Spec.Result = last;
+  }
+
+  BodyInference(ShapeInference& inference, Specialization& spec) : Inference(inference), Spec(spec) {}
+};
+
+ShapeInference::ShapeInference(const Module& module, DiagnosticEngine& diags)
+  : Diags(diags), Definitions(module.getDefinitions()) {
+  for (const auto& definition : Definitions) {
+    Symbol name;
+    if (auto* function = dyn_cast<FunctionNode>(definition.get())) {
+      name = function->getPrototype().getName();
+    } else {
+      name = cast<PrototypeNode>(*definition).getName();
+    }
+    Functions.emplace(name, definition.get());
+  }
+}
+
+void ShapeInference::run() {
+  for (const auto& definition : Definitions) {
+    auto* function = dyn_cast<FunctionNode>(definition.get());
+    if (function != nullptr && function->getPrototype().getArgs().empty()) {
+      specialize(*function, {});
+    }
+  }
+}
+
+const ShapeInference::Specialization& ShapeInference::specialize(const FunctionNode& function,
+								  const std::vector<TensorShape>& argShapes) {
+  auto key = std::make_pair(&function, argShapes);
+  auto it = Specializations.find(key);
+  if (it != Specializations.end()) {
+    return *it->second;
+  }
+  // Recursion with new argument shapes could go on growing them forever, so
+  // it falls back to the specialization for unknown shapes.
+  std::vector<TensorShape> unknownShapes(argShapes.size());
+  if (NumActive[&function] > 0 && argShapes != unknownShapes) {
+    return specialize(function, unknownShapes);
+  }
+  Specialization& spec = *Specializations.emplace(key, std::make_unique<Specialization>(function, argShapes))
+    .first->second;
+  spec.InProgress = true;
+  NumActive[&function] += 1;
+  BodyInference(*this, spec).run();
+  NumActive[&function] -= 1;
+  spec.InProgress = false;
+  return spec;
+}
+
+const ShapeInference::Specialization* ShapeInference::specialize(Symbol name,
+								  const std::vector<TensorShape>& argShapes) {
+  auto it = Functions.find(name);
+  if (it == Functions.end() || !isa<FunctionNode>(it->second)) {
+    return nullptr;
+  }
+  const auto& function = cast<FunctionNode>(*it->second);
+  if (function.getPrototype().getArgs().size() != argShapes.size()) {
+    return nullptr;
+  }
+  return &specialize(function, argShapes);
+}
+
+size_t ShapeInference::getNumSpecializations() const {
+  return Specializations.size();
+}
@@ -0,0 +1,157 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include "lexer.h"
+#include "source_file.h"
+
+static std::runtime_error fileError(const std::string& path, const char* what) {
+  std::stringstream diag;
+  diag << path << ": " << what << ": " << std::strerror(errno);
+  return std::runtime_error(diag.str());
+}
+
+// Used for pipes, character devices and empty files, which cannot be mapped.
+static std::string readAll(int fd, const std::string& path) {
+  std::string buffer;
+  char chunk[1 << 16];
+  while (true) {
+    ssize_t count = ::read(fd, chunk, sizeof(chunk));
+    if (count == 0) {
+      break;
+    } else if (count < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      throw fileError(path, "read failed");
+    }
+    buffer.append(chunk, (size_t)count);
+  }
+  return buffer;
+}
+
+SourceFile SourceFile::open(const std::string& path) {
+  bool isStdin = (path == "-");
+  int fd = isStdin ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw fileError(path, "cannot open");
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    int savedErrno = errno;
+    if (!isStdin) {
+      ::close(fd);
+    }
+    errno = savedErrno;
+    throw fileError(path, "cannot stat");
+  }
+  if (S_ISREG(info.st_mode) && info.st_size > 0) {
+    void* data = ::mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      ::madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+      if (!isStdin) {
+	::close(fd);
+      }
+      SourceFile source(path, "");
+      source.MappedData = (const char*)data;
+      source.MappedSize = (size_t)info.st_size;
+      return source;
+    }
+  }
+  std::string buffer;
+  try {
+    buffer = readAll(fd, path);
+  } catch (...) {
+    if (!isStdin) {
+      ::close(fd);
+    }
+    throw;
+  }
+  if (!isStdin) {
+    ::close(fd);
+  }
+  return SourceFile(path, std::move(buffer));
+}
+
+SourceFile::SourceFile(std::string name, std::string buffer)
+  : Name(std::move(name)), Buffer(std::move(buffer)) {}
+
+SourceFile::SourceFile(SourceFile&& other) noexcept
+  : Name(std::move(other.Name)), Buffer(std::move(other.Buffer)),
+    MappedData(other.MappedData), MappedSize(other.MappedSize),
+    Lines(other.Lines.exchange(nullptr)) {
+  other.MappedData = nullptr;
+  other.MappedSize = 0;
+}
+
+SourceFile& SourceFile::operator=(SourceFile&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    Name = std::move(other.Name);
+    Buffer = std::move(other.Buffer);
+    MappedData = other.MappedData;
+    MappedSize = other.MappedSize;
+    other.MappedData = nullptr;
+    other.MappedSize = 0;
+    delete Lines.exchange(other.Lines.exchange(nullptr));
+  }
+  return *this;
+}
+
+SourceFile::~SourceFile() {
+  unmap();
+  delete Lines.load();
+}
+
+void SourceFile::unmap() {
+  if (MappedData != nullptr) {
+    ::munmap((void*)MappedData, MappedSize);
+    MappedData = nullptr;
+    MappedSize = 0;
+  }
+}
+
+bool SourceFile::isMapped() const {
+  return MappedData != nullptr;
+}
+
+const std::string& SourceFile::getName() const {
+  return Name;
+}
+
+std::string_view SourceFile::getText() const {
+  if (isMapped()) {
+    return std::string_view(MappedData, MappedSize);
+  }
+  return Buffer;
+}
+
+std::string_view SourceFile::getStr(const Token& token) const {
+  return getText().substr(token.Offset, token.Length);
+}
+
+LexToken SourceFile::getToken(const Token& token) const {
+  return LexToken(token.Type, getStr(token), token.Offset);
+}
+
+SourceLocation SourceFile::getLocation(size_t offset) const {
+  const LineTable* lines = Lines.load(std::memory_order_acquire);
+  if (lines == nullptr) {
+    // Threads racing to build the table keep whichever one was published
+    // first.
+    const LineTable* built = new LineTable(getText());
+    if (Lines.compare_exchange_strong(lines, built, std::memory_order_acq_rel)) {
+      lines = built;
+    } else {
+      delete built;
+    }
+  }
+  return lines->getLocation(offset);
+}
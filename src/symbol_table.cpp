@@ -0,0 +1,117 @@
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include "symbol_table.h"
+
+SymbolTable::SymbolTable()
+  : Pages(new std::atomic<Entry*>[MaxPages]()), Slots(1024, 0) {
+  intern("");
+}
+
+SymbolTable& SymbolTable::global() {
+  static SymbolTable table;
+  return table;
+}
+
+// FNV-1a; identifiers are short, so a simple byte loop is fast enough.
+uint32_t SymbolTable::hash(std::string_view name) {
+  uint32_t h = 2166136261u;
+  for (char c : name) {
+    h ^= (unsigned char)c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+const SymbolTable::Entry& SymbolTable::entry(uint32_t id) const {
+  Entry* page = Pages[id >> PageBits].load(std::memory_order_acquire);
+  return page[id & (PageSize - 1)];
+}
+
+const char* SymbolTable::copyToArena(std::string_view name) {
+  if (name.length() > BlockLeft) {
+    size_t blockSize = (name.length() > BlockSize) ? name.length() : BlockSize;
+    Blocks.push_back(std::make_unique<char[]>(blockSize));
+    BlockPos = Blocks.back().get();
+    BlockLeft = blockSize;
+  }
+  char* data = BlockPos;
+  if (!name.empty()) {
+    std::memcpy(data, name.data(), name.length());
+  }
+  BlockPos += name.length();
+  BlockLeft -= name.length();
+  return data;
+}
+
+void SymbolTable::grow() {
+  std::vector<uint32_t> slots(Slots.size() * 2, 0);
+  size_t mask = slots.size() - 1;
+  for (uint32_t slot : Slots) {
+    if (slot == 0) {
+      continue;
+    }
+    size_t pos = entry(slot - 1).Hash & mask;
+    while (slots[pos] != 0) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = slot;
+  }
+  Slots.swap(slots);
+}
+
+uint32_t SymbolTable::intern(std::string_view name) {
+  uint32_t h = hash(name);
+  // Entries never change once published, so a per-thread cache of recent ids
+  // can be checked without the lock; parser threads mostly hit it.
+  static thread_local std::array<uint32_t, 1024> recent{};
+  uint32_t& cached = recent[h & (recent.size() - 1)];
+  if (cached < NumPublished.load(std::memory_order_acquire)) {
+    const Entry& candidate = entry(cached);
+    if (candidate.Hash == h && std::string_view(candidate.Data, candidate.Length) == name) {
+      return cached;
+    }
+  }
+  std::lock_guard<std::mutex> lock(Mutex);
+  size_t mask = Slots.size() - 1;
+  size_t pos = h & mask;
+  // Slots hold id + 1 so that zero marks an empty slot.
+  while (Slots[pos] != 0) {
+    const Entry& candidate = entry(Slots[pos] - 1);
+    if (candidate.Hash == h && std::string_view(candidate.Data, candidate.Length) == name) {
+      cached = Slots[pos] - 1;
+      return cached;
+    }
+    pos = (pos + 1) & mask;
+  }
+  uint32_t id = NumSymbols;
+  if ((id >> PageBits) >= MaxPages) {
+    throw std::runtime_error("Symbol table is full");
+  }
+  if ((id & (PageSize - 1)) == 0) {
+    OwnedPages.push_back(std::make_unique<Entry[]>(PageSize));
+    Pages[id >> PageBits].store(OwnedPages.back().get(), std::memory_order_release);
+  }
+  Entry* page = Pages[id >> PageBits].load(std::memory_order_relaxed);
+  page[id & (PageSize - 1)] = Entry{copyToArena(name), (uint32_t)name.length(), h};
+  NumSymbols += 1;
+  NumPublished.store(NumSymbols, std::memory_order_release);
+  Slots[pos] = id + 1;
+  if (NumSymbols * 2 > Slots.size()) {
+    grow();
+  }
+  cached = id;
+  return id;
+}
+
+std::string_view SymbolTable::str(uint32_t id) const {
+  const Entry& e = entry(id);
+  return std::string_view(e.Data, e.Length);
+}
+
+size_t SymbolTable::size() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return NumSymbols;
+}
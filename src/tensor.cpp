@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include "tensor.h"
+
+static_assert(sizeof(std::atomic<size_t>) + sizeof(size_t) <= Tensor::Alignment,
+	      "the buffer header must fit before the first element");
+
+static size_t countElements(const std::vector<size_t>& shape) {
+  size_t count = 1;
+  for (size_t dim : shape) {
+    count *= dim;
+  }
+  return count;
+}
+
+Tensor::Header* Tensor::getHeader() const {
+  return reinterpret_cast<Header*>(reinterpret_cast<char*>(Data) - Alignment);
+}
+
+void Tensor::release() {
+  if (Data == nullptr) {
+    return;
+  }
+  Header* header = getHeader();
+  if (header->RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    header->~Header();
+    ::operator delete(header, std::align_val_t(Alignment));
+  }
+  Data = nullptr;
+}
+
+Tensor Tensor::allocate(std::vector<size_t> shape) {
+  size_t size = countElements(shape);
+  void* memory = ::operator new(Alignment + size * sizeof(double), std::align_val_t(Alignment));
+  Header* header = new (memory) Header;
+  header->RefCount.store(1, std::memory_order_relaxed);
+  header->Size = size;
+  Tensor tensor;
+  tensor.Data = reinterpret_cast<double*>(static_cast<char*>(memory) + Alignment);
+  tensor.Shape = std::move(shape);
+  return tensor;
+}
+
+Tensor Tensor::scalar(double value) {
+  Tensor tensor = allocate({});
+  tensor.Data[0] = value;
+  return tensor;
+}
+
+Tensor Tensor::fromValues(std::vector<size_t> shape, const std::vector<double>& values) {
+  if (countElements(shape) != values.size()) {
+    throw std::runtime_error("tensor shape does not match its number of values");
+  }
+  Tensor tensor = allocate(std::move(shape));
+  std::copy(values.begin(), values.end(), tensor.Data);
+  return tensor;
+}
+
+const std::vector<size_t>& Tensor::getShape() const {
+  return Shape;
+}
+
+size_t Tensor::getRank() const {
+  return Shape.size();
+}
+
+size_t Tensor::size() const {
+  return (Data != nullptr) ? getHeader()->Size : 0;
+}
+
+const double* Tensor::data() const {
+  return Data;
+}
+
+double* Tensor::data() {
+  return Data;
+}
+
+Tensor Tensor::reshape(std::vector<size_t> shape) const {
+  if (countElements(shape) != size()) {
+    throw std::runtime_error("reshape must keep the number of elements");
+  }
+  Tensor tensor(*this);
+  tensor.Shape = std::move(shape);
+  return tensor;
+}
+
+size_t Tensor::getUseCount() const {
+  return (Data != nullptr) ? getHeader()->RefCount.load(std::memory_order_relaxed) : 0;
+}
+
+static void printDims(std::ostream& out, const std::vector<size_t>& shape, size_t dim, const double*& values) {
+  if (dim == shape.size()) {
+    out << *values++;
+    return;
+  }
+  out << "[";
+  for (size_t i = 0; i < shape[dim]; i++) {
+    out << (i > 0 ? ", " : "");
+    printDims(out, shape, dim + 1, values);
+  }
+  out << "]";
+}
+
+void Tensor::print(std::ostream& out) const {
+  const double* values = Data;
+  if (values != nullptr) {
+    printDims(out, Shape, 0, values);
+  }
+}
+
+std::ostream& operator<<(std::ostream& out, const Tensor& tensor) {
+  tensor.print(out);
+  return out;
+}
+
+Tensor::Tensor(const Tensor& other) : Data(other.Data), Shape(other.Shape) {
+  if (Data != nullptr) {
+    getHeader()->RefCount.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Tensor::Tensor(Tensor&& other) noexcept : Data(std::exchange(other.Data, nullptr)), Shape(std::move(other.Shape)) {}
+
+Tensor& Tensor::operator=(const Tensor& other) {
+  if (this != &other) {
+    Tensor copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+Tensor& Tensor::operator=(Tensor&& other) noexcept {
+  if (this != &other) {
+    release();
+    Data = std::exchange(other.Data, nullptr);
+    Shape = std::move(other.Shape);
+  }
+  return *this;
+}
+
+Tensor::~Tensor() {
+  release();
+}
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "tensor_ops.h"
+
+bool canApplyElementwise(const Tensor& lhs, const Tensor& rhs) {
+  return lhs.getShape() == rhs.getShape() || lhs.getRank() == 0 || rhs.getRank() == 0;
+}
+
+template<typename Fn>
+static void applySpan(const double* a, bool aScalar, const double* b, bool bScalar, double* out, size_t count,
+		      Fn fn) {
+  if (aScalar && bScalar) {
+    double value = fn(a[0], b[0]);
+    std::fill(out, out + count, value);
+  } else if (bScalar) {
+    double scalar = b[0];
+    for (size_t i = 0; i < count; i++) {
+      out[i] = fn(a[i], scalar);
+    }
+  } else if (aScalar) {
+    double scalar = a[0];
+    for (size_t i = 0; i < count; i++) {
+      out[i] = fn(scalar, b[i]);
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = fn(a[i], b[i]);
+    }
+  }
+}
+
+void applyElementwise(Op op, const double* a, bool aScalar, const double* b, bool bScalar, double* out,
+		      size_t count) {
+  switch (op) {
+  case Op::Plus:
+    return applySpan(a, aScalar, b, bScalar, out, count, [](double x, double y) { return x + y; });
+  case Op::Minus:
+    return applySpan(a, aScalar, b, bScalar, out, count, [](double x, double y) { return x - y; });
+  case Op::Times:
+    return applySpan(a, aScalar, b, bScalar, out, count, [](double x, double y) { return x * y; });
+  case Op::Divide:
+    return applySpan(a, aScalar, b, bScalar, out, count, [](double x, double y) { return x / y; });
+  case Op::Modulus:
+    break;
+  }
+  applySpan(a, aScalar, b, bScalar, out, count, [](double x, double y) { return std::fmod(x, y); });
+}
+
+Tensor applyElementwise(Op op, const Tensor& lhs, const Tensor& rhs) {
+  Tensor result = Tensor::allocate(lhs.getRank() >= rhs.getRank() ? lhs.getShape() : rhs.getShape());
+  applyElementwise(op, lhs.data(), lhs.getRank() == 0, rhs.data(), rhs.getRank() == 0, result.data(),
+		   result.size());
+  return result;
+}
+
+Tensor transpose(const Tensor& input) {
+  const std::vector<size_t>& dims = input.getShape();
+  if (dims.size() < 2) {
+    return input;
+  }
+  std::vector<size_t> reversed(dims.rbegin(), dims.rend());
+  Tensor result = Tensor::allocate(reversed);
+  const double* in = input.data();
+  double* out = result.data();
+  if (dims.size() == 2) {
+    size_t rows = dims[0];
+    size_t cols = dims[1];
+    for (size_t j = 0; j < cols; j++) {
+      for (size_t i = 0; i < rows; i++) {
+	*out++ = in[i * cols + j];
+      }
+    }
+    return result;
+  }
+  // Walk the output in order; output dimension d steps input dimension
+  // rank - 1 - d, whose stride is strides[rank - 1 - d].
+  size_t rank = dims.size();
+  std::vector<size_t> strides(rank, 1);
+  for (size_t d = rank - 1; d > 0; d--) {
+    strides[d - 1] = strides[d] * dims[d];
+  }
+  std::vector<size_t> index(rank, 0);
+  size_t offset = 0;
+  for (size_t n = result.size(); n > 0; n--) {
+    *out++ = in[offset];
+    for (size_t d = rank; d-- > 0;) {
+      size_t stride = strides[rank - 1 - d];
+      if (++index[d] < reversed[d]) {
+	offset += stride;
+	break;
+      }
+      offset -= stride * (reversed[d] - 1);
+      index[d] = 0;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+#include "char_scan.h"
+#include "source_file.h"
+#include "token_stream.h"
+
+TokenStream::TokenStream()
+  : Lookahead{{LexToken(TokenType::Eof), LexToken(TokenType::Eof),
+	       LexToken(TokenType::Eof), LexToken(TokenType::Eof)}} {}
+
+const LexToken& TokenStream::peek(size_t ahead) {
+  if (ahead >= MaxLookahead) {
+    throw std::logic_error("TokenStream lookahead exceeded");
+  }
+  while (Count <= ahead) {
+    Lookahead[(Head + Count) % MaxLookahead] = pull();
+    Count += 1;
+  }
+  return Lookahead[(Head + ahead) % MaxLookahead];
+}
+
+LexToken TokenStream::next() {
+  LexToken token = peek();
+  Head = (Head + 1) % MaxLookahead;
+  Count -= 1;
+  return token;
+}
+
+VectorTokenStream::VectorTokenStream(const std::vector<LexToken>& tokens) : Tokens(tokens) {}
+
+LexToken VectorTokenStream::pull() {
+  if (Pos >= Tokens.size()) {
+    return LexToken(TokenType::Eof, "", Tokens.empty() ? 0 : Tokens.back().getOffset());
+  }
+  return Tokens[Pos++];
+}
+
+CompactTokenStream::CompactTokenStream(const SourceFile& source, const std::vector<Token>& tokens,
+				       size_t begin, size_t end)
+  : Source(source), Tokens(tokens), Pos(begin), End(std::min(end, tokens.size())) {}
+
+LexToken CompactTokenStream::pull() {
+  if (Pos >= End) {
+    Pos = End + 1;
+    return LexToken(TokenType::Eof, "", Tokens.empty() ? 0 : Tokens[std::min(End, Tokens.size() - 1)].Offset);
+  }
+  return Source.getToken(Tokens[Pos++]);
+}
+
+bool CompactTokenStream::reachedEnd() const {
+  return Pos > End;
+}
+
+FdChunkReader::FdChunkReader(int fd, std::string name) : Fd(fd), Name(std::move(name)) {}
+
+size_t FdChunkReader::read(char* dest, size_t size) {
+  while (true) {
+    ssize_t count = ::read(Fd, dest, size);
+    if (count >= 0) {
+      return (size_t)count;
+    }
+    if (errno != EINTR) {
+      std::stringstream diag;
+      diag << Name << ": read failed: " << std::strerror(errno);
+      throw std::runtime_error(diag.str());
+    }
+  }
+}
+
+StringChunkReader::StringChunkReader(std::string_view text, size_t maxChunk)
+  : Text(text), MaxChunk(maxChunk) {}
+
+size_t StringChunkReader::read(char* dest, size_t size) {
+  size_t count = std::min({size, MaxChunk, Text.length() - Pos});
+  std::memcpy(dest, Text.data() + Pos, count);
+  Pos += count;
+  return count;
+}
+
+ScannerTokenStream::ScannerTokenStream(ChunkReader& reader, size_t chunkSize)
+  : Reader(reader), ChunkSize(chunkSize) {}
+
+// Drops the consumed prefix of the window and appends the next chunk. The
+// window only grows past one chunk while a single token straddles chunks.
+bool ScannerTokenStream::refill() {
+  std::string_view consumed(Window.data(), Pos);
+  size_t lastNewline = consumed.rfind('\n');
+  if (lastNewline != std::string_view::npos) {
+    LinesBefore += countNewlines(consumed);
+    LastLineStart = WindowOffset + lastNewline + 1;
+  }
+  WindowOffset += Pos;
+  Window.erase(0, Pos);
+  Pos = 0;
+  size_t oldSize = Window.size();
+  Window.resize(oldSize + ChunkSize);
+  size_t count = Reader.read(&Window[oldSize], ChunkSize);
+  Window.resize(oldSize + count);
+  AtEof = (count == 0);
+  return !AtEof;
+}
+
+LexToken ScannerTokenStream::pull() {
+  while (true) {
+    if (Pos == Window.size()) {
+      if (AtEof || !refill()) {
+	return LexToken(TokenType::Eof, "", (uint32_t)(WindowOffset + Pos));
+      }
+    }
+    if (InComment) {
+      Pos = skipToLineEnd(Window, Pos);
+      if (Pos == Window.size()) {
+	continue;
+      }
+      InComment = false;
+    }
+    char currChar = Window[Pos];
+    if (currChar == '#') {
+      InComment = true;
+      Pos += 1;
+      continue;
+    }
+    if (isWhitespaceChar(currChar)) {
+      Pos = skipWhitespace(Window, Pos + 1);
+      continue;
+    }
+    size_t tokenLength;
+    TokenType type = Scanner::scanToken(Window, Pos, tokenLength);
+    if (type == TokenType::Invalid) {
+      throw Scanner::invalidLexemeError(locate(Pos), Window[Pos]);
+    }
+    // A token running into the end of the window may continue in the next
+    // chunk, so rescan it once more input is available.
+    if (Pos + tokenLength == Window.size() && !AtEof) {
+      refill();
+      continue;
+    }
+    std::string_view text(Window.data() + Pos, tokenLength);
+    Pos += tokenLength;
+    if (type == TokenType::Number) {
+      std::string& slot = NumberText[NextNumberSlot];
+      NextNumberSlot = (NextNumberSlot + 1) % NumberText.size();
+      slot.assign(text);
+      text = slot;
+    }
+    return LexToken(type, text, (uint32_t)(WindowOffset + Pos - tokenLength));
+  }
+}
+
+SourceLocation ScannerTokenStream::locate(size_t pos) const {
+  SourceLocation location = LineTable::locate(Window, pos);
+  if (location.Line == 1) {
+    location.Column = (uint32_t)(WindowOffset + pos - LastLineStart + 1);
+  }
+  location.Line += (uint32_t)LinesBefore;
+  return location;
+}
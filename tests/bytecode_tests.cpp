@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bytecode.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+// Output of running main, followed by the location and message of the error
+// that stopped it, if any.
+template<typename Runner>
+static std::string runProgram(const SourceFile& source, const Module& module) {
+  std::stringstream out;
+  try {
+    Runner runner(module, out);
+    runner.run();
+  } catch (const InterpreterError& e) {
+    out << source.getLocation(e.getOffset()).str() << ": " << e.what();
+  }
+  return out.str();
+}
+
+struct CompiledRunner {
+  BytecodeModule Program;
+  BytecodeVM VM;
+  void run() { VM.run(); }
+  CompiledRunner(const Module& module, std::ostream& out) : Program(BytecodeModule::compile(module)), VM(Program, out) {}
+};
+
+TEST(BytecodeTests, TestMatchesInterpreter) {
+  for (const auto* bodies : {&ProgramBodies, &FailingProgramBodies}) {
+    for (const std::string& body : *bodies) {
+      SourceFile source("program.d--", makeProgram(body));
+      Module module = Parser::parse(source, Scanner::scan(source));
+      ASSERT_FALSE(module.getDiagnostics().hasErrors()) << body;
+      std::string expected = runProgram<Interpreter>(source, module);
+      ASSERT_EQ(runProgram<CompiledRunner>(source, module), expected) << body;
+    }
+  }
+}
+
+TEST(BytecodeTests, TestRegisterAllocation) {
+  std::string inputBuffer = R"(
+def f(a, b) {
+  var c = a * b + a;
+  c = transpose(c) - 1;
+  [c, c];
+}
+)";
+  BytecodeModule program =
+    BytecodeModule::compile(Parser::parse(Scanner::scan(inputBuffer)), Fusion::Disabled);
+  std::stringstream out;
+  program.disassemble(out);
+  // Assignments write variables directly and the temporaries of one
+  // statement are reused by the next.
+  std::string expected = "def f (2 params, 6 registers)\n"
+			 "  r3 = mul r0, r1\n"
+			 "  r2 = add r3, r0\n"
+			 "  r3 = transpose r2\n"
+			 "  r4 = loadconst 1\n"
+			 "  r2 = sub r3, r4\n"
+			 "  r3 = move r2\n"
+			 "  r4 = move r2\n"
+			 "  r5 = pack r3..5\n"
+			 "  return r5\n";
+  ASSERT_EQ(out.str(), expected);
+}
+
+TEST(BytecodeTests, TestCallsShareBuffers) {
+  std::string inputBuffer = R"(
+extern sum(a)
+def id(a) {
+  var b<4> = a;
+  b;
+}
+def total(a) {
+  sum(id(a)) * 2;
+}
+)";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  BytecodeModule program = BytecodeModule::compile(module);
+  std::stringstream out;
+  BytecodeVM vm(program, out);
+  Tensor tensor = Tensor::fromValues({2, 2}, {1, 2, 3, 4});
+  std::optional<Tensor> result = vm.call(Symbol("id"), {tensor});
+  ASSERT_TRUE(result.has_value());
+  ASSERT_EQ(result->data(), tensor.data());
+  ASSERT_EQ(result->getShape(), std::vector<size_t>{4});
+  ASSERT_EQ(tensor.getUseCount(), 2u);
+
+  ASSERT_THROW(vm.call(Symbol("total"), {tensor}), InterpreterError);
+  // A failed call leaves nothing behind.
+  ASSERT_EQ(tensor.getUseCount(), 2u);
+  vm.defineExtern(Symbol("sum"), [](const std::vector<Tensor>& args) {
+    double total = 0;
+    for (size_t i = 0; i < args[0].size(); i++) {
+      total += args[0].data()[i];
+    }
+    return Tensor::scalar(total);
+  });
+  result = vm.call(Symbol("total"), {tensor});
+  ASSERT_EQ(result->size(), 1u);
+  ASSERT_EQ(result->data()[0], 20);
+  ASSERT_THROW(vm.call(Symbol("sum"), {tensor}), std::runtime_error);
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "codegen.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+TEST(CodegenTests, TestMatchesInterpreter) {
+  for (const std::string& body : ProgramBodies) {
+    Module module = Parser::parse(Scanner::scan(makeProgram(body)));
+    ASSERT_FALSE(module.getDiagnostics().hasErrors()) << body;
+    std::stringstream expected;
+    Interpreter(module, expected).run();
+    std::stringstream actual;
+    NativeEngine(module, actual).run();
+    ASSERT_EQ(actual.str(), expected.str()) << body;
+  }
+}
+
+TEST(CodegenTests, TestCallsCompileEachSpecialization) {
+  Module module = Parser::parse(Scanner::scan(ProgramFunctions));
+  std::stringstream out;
+  Interpreter interp(module, out);
+  NativeEngine engine(module, out);
+  for (size_t side : {1, 3, 16, 3}) {
+    std::vector<Tensor> args = {makeTensor({side, side}, 1), makeTensor({side, side}, 2)};
+    std::optional<Tensor> expected = interp.call(Symbol("step"), args);
+    std::optional<Tensor> actual = engine.call(Symbol("step"), args);
+    ASSERT_TRUE(actual.has_value());
+    expectSame(*actual, *expected);
+  }
+  ASSERT_FALSE(engine.call(Symbol("noValue"), {Tensor::scalar(1)}).has_value());
+  ASSERT_NE(engine.getIR().find("define void @dmm.step."), std::string::npos);
+  ASSERT_THROW(engine.call(Symbol("step"), {}), std::runtime_error);
+}
+
+static size_t countOccurrences(const std::string& text, const std::string& pattern) {
+  size_t count = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1)) {
+    count += 1;
+  }
+  return count;
+}
+
+TEST(CodegenTests, TestFusedTreesMatchUnfused) {
+  Module module = Parser::parse(Scanner::scan(ElementwiseFunctions));
+  std::stringstream out;
+  NativeEngine fused(module, out);
+  NativeEngine unfused(module, out, Fusion::Disabled);
+  std::vector<std::pair<const char*, std::vector<Tensor>>> calls = {
+    {"chain", {makeTensor({3, 70}, 1), makeTensor({3, 70}, 2), Tensor::scalar(3), makeTensor({3, 70}, 4)}},
+    {"mixed", {makeTensor({5, 30}, 1), makeTensor({30, 5}, 2), makeTensor({30, 5}, 3)}},
+    {"mixed", {makeTensor({2, 3, 4}, 1), makeTensor({4, 3, 2}, 2), Tensor::scalar(5)}}};
+  for (const auto& [name, args] : calls) {
+    std::optional<Tensor> expected = unfused.call(Symbol(name), args);
+    ASSERT_TRUE(expected.has_value());
+    expectSame(*fused.call(Symbol(name), args), *expected);
+  }
+  // Only the output of each tree is allocated, not the temporaries.
+  std::string chainIR = fused.getIR().substr(0, fused.getIR().find("define void @dmm.entry.0"));
+  ASSERT_EQ(countOccurrences(chainIR, "call i8* @dmm_alloc"), 1u);
+  std::string unfusedIR = unfused.getIR().substr(0, unfused.getIR().find("define void @dmm.entry.0"));
+  ASSERT_EQ(countOccurrences(unfusedIR, "call i8* @dmm_alloc"), 3u);
+}
+
+TEST(CodegenTests, TestErrorsBeforeRunning) {
+  std::vector<std::pair<std::string, std::string>> cases = {
+    {"print(1);\n  var a = [[1, 2, 3], [4, 5, 6]];\n  print(a * transpose(a));",
+     "6:11: operands of '*' have shapes <2, 3> and <3, 2>"},
+    {"print(1);\n  print(x);", "5:9: unknown variable 'x'"},
+    {"print(1);\n  print(sum([1, 2]) + 1);", "5:9: native code cannot call extern function 'sum'"},
+    {"print(1);\n  loop(1);", "5:3: the shape of this expression is not known statically"}};
+  for (const auto& [body, expected] : cases) {
+    SourceFile source("errors.d--", "extern sum(a)\ndef loop(a) { loop(a); }\ndef main() {\n  " + body + "\n}\n");
+    Module module = Parser::parse(source, Scanner::scan(source));
+    ASSERT_FALSE(module.getDiagnostics().hasErrors()) << body;
+    std::stringstream out;
+    try {
+      NativeEngine(module, out).run();
+      FAIL() << body;
+    } catch (const InterpreterError& e) {
+      ASSERT_EQ(source.getLocation(e.getOffset()).str() + ": " + e.what(), expected);
+    }
+    ASSERT_EQ(out.str(), "");
+  }
+}
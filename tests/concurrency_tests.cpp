@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "char_scan.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+#include "test_utils.h"
+#include "token_stream.h"
+
+// Buffers share most identifiers and differ in a few, so threads race on both
+// existing and new symbols.
+static std::string makeBuffer(size_t index) {
+  std::string buffer = "extern scale" + std::to_string(index % 5) + "(a)\n";
+  for (size_t i = 0; i < 40; i++) {
+    buffer += "# buffer " + std::to_string(index) + "\n";
+    buffer += "def f" + std::to_string(i) + "(a, b) {\n";
+    buffer += "  var x<2, 2> = [[1, 2], [3, " + std::to_string(index) + "]];\n";
+    buffer += "  var y = [a, b, unique" + std::to_string(index * 40 + i) + "];\n";
+    buffer += "  print(transpose(x) * a);\n}\n";
+  }
+  return buffer;
+}
+
+// Compiles many buffers at once through every scanning and parsing entry
+// point while another thread keeps switching the character scan routines.
+// Build with -DDMM_SANITIZE_THREAD=ON to have TSan check for races.
+TEST(ConcurrencyTests, TestConcurrentCompilations) {
+  const size_t numBuffers = 64;
+  const size_t numThreads = 8;
+  std::vector<std::string> buffers;
+  for (size_t i = 0; i < numBuffers; i++) {
+    buffers.push_back(makeBuffer(i));
+  }
+  std::vector<Module> expected;
+  for (const std::string& buffer : buffers) {
+    expected.push_back(Parser::parse(Scanner::scan(buffer), NodeAllocation::Heap));
+  }
+
+  std::atomic<bool> done{false};
+  std::thread switcher([&done]() {
+    CharScanImpl previous = getCharScanImpl();
+    while (!done.load()) {
+      for (CharScanImpl impl : {CharScanImpl::Scalar, CharScanImpl::SSE2, CharScanImpl::AVX2}) {
+	if (isCharScanImplSupported(impl)) {
+	  setCharScanImpl(impl);
+	  std::this_thread::yield();
+	}
+      }
+    }
+    setCharScanImpl(previous);
+  });
+
+  std::atomic<size_t> failures{0};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < numBuffers; i += numThreads) {
+	const std::string& buffer = buffers[i];
+	Module fromVector = Parser::parse(Scanner::scan(buffer));
+	SourceFile source("buffer" + std::to_string(i) + ".d--", buffer);
+	std::vector<Token> tokens = Scanner::scanParallel(source, 2);
+	Module fromSource = Parser::parseParallel(source, tokens, 2);
+	StringChunkReader reader(buffer, 97);
+	ScannerTokenStream stream(reader, 97);
+	Module streamed(NodeAllocation::Heap);
+	Parser parser(stream);
+	while (std::unique_ptr<Node> definition = parser.parseDefinition()) {
+	  streamed.getDefinitions().push_back(std::move(definition));
+	}
+	if (!sameDefinitions(fromVector, expected[i]) || !sameDefinitions(fromSource, expected[i]) ||
+	    !sameDefinitions(streamed, expected[i])) {
+	  failures += 1;
+	}
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  done = true;
+  switcher.join();
+  ASSERT_EQ(failures.load(), 0u);
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bytecode.h"
+#include "casting.h"
+#include "fusion.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+#include "tensor.h"
+#include "test_utils.h"
+
+TEST(FusionTests, TestFindsMaximalTrees) {
+  std::string inputBuffer = R"(
+def f(a, b, c) {
+  var d = a + b * c - 1;
+  print(transpose(a) * transpose(b));
+  print(a * b);
+  f(a * b + c, transpose(a), b);
+}
+)";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  FusionPlan plan(module);
+  ASSERT_EQ(plan.size(), 3u);
+  const auto& body = cast<FunctionNode>(*module.getDefinitions()[0]).getBody();
+
+  const FusedExpr* chain = plan.find(cast<AssgnNode>(*body[0]).getExpr());
+  ASSERT_NE(chain, nullptr);
+  ASSERT_EQ(chain->NumOperators, 3u);
+  ASSERT_EQ(chain->Leaves.size(), 4u);
+  ASSERT_EQ(chain->Steps.size(), 7u);
+  ASSERT_EQ(chain->Steps[3].Kind, FusedExpr::StepKind::Binary);
+  ASSERT_EQ(chain->Steps[3].Operator, Op::Times);
+  ASSERT_EQ(chain->Steps.back().Operator, Op::Minus);
+
+  const auto& print = cast<VariableExprNode>(*body[1]);
+  ASSERT_EQ(plan.find(print), nullptr);
+  const FusedExpr* transposes = plan.find(*print.getArgs()[0]);
+  ASSERT_NE(transposes, nullptr);
+  ASSERT_EQ(transposes->NumOperators, 3u);
+  ASSERT_TRUE(transposes->Leaves[0].Transposed);
+  ASSERT_TRUE(transposes->Leaves[1].Transposed);
+
+  // A lone operator is left alone, and so is the tree of a single transpose.
+  ASSERT_EQ(plan.find(*cast<VariableExprNode>(*body[2]).getArgs()[0]), nullptr);
+  const auto& call = cast<VariableExprNode>(*body[3]);
+  ASSERT_NE(plan.find(*call.getArgs()[0]), nullptr);
+  ASSERT_EQ(plan.find(*call.getArgs()[1]), nullptr);
+}
+
+TEST(FusionTests, TestMatchesUnfused) {
+  Module module = Parser::parse(Scanner::scan(ElementwiseFunctions));
+  std::stringstream out;
+  Interpreter fused(module, out);
+  Interpreter unfused(module, out, Fusion::Disabled);
+  BytecodeModule program = BytecodeModule::compile(module);
+  BytecodeVM vm(program, out);
+  // Rows longer than a tile, scalar operands and a rank-3 transpose.
+  std::vector<std::vector<Tensor>> chainArgs = {
+    {makeTensor({3, 700}, 1), makeTensor({3, 700}, 2), Tensor::scalar(3), makeTensor({3, 700}, 4)},
+    {Tensor::scalar(1), Tensor::scalar(2), Tensor::scalar(3), Tensor::scalar(4)},
+    {makeTensor({2, 3, 4}, 1), Tensor::scalar(-2), makeTensor({2, 3, 4}, 3), Tensor::scalar(0.25)}};
+  std::vector<std::vector<Tensor>> mixedArgs = {
+    {makeTensor({5, 300}, 1), makeTensor({300, 5}, 2), makeTensor({300, 5}, 3)},
+    {makeTensor({2, 3, 4}, 1), makeTensor({4, 3, 2}, 2), Tensor::scalar(5)},
+    {makeTensor({7}, 1), makeTensor({7}, 2), makeTensor({7}, 3)}};
+  for (auto [name, argLists] : {std::make_pair("chain", chainArgs), std::make_pair("mixed", mixedArgs)}) {
+    for (const std::vector<Tensor>& args : argLists) {
+      std::optional<Tensor> expected = unfused.call(Symbol(name), args);
+      ASSERT_TRUE(expected.has_value());
+      expectSame(*fused.call(Symbol(name), args), *expected);
+      expectSame(*vm.call(Symbol(name), args), *expected);
+    }
+  }
+}
+
+TEST(FusionTests, TestErrorsMatchUnfused) {
+  // Shape errors in a tree are raised at the same node, and before the
+  // leaves after it have run.
+  std::vector<std::string> bodies = {
+    "var a = [[1, 2, 3], [4, 5, 6]];\n  print(a * transpose(a) + noisy(a));",
+    "var a = [[1, 2, 3], [4, 5, 6]];\n  print(transpose(a) * 2 + transpose(noisy(a)) - a);",
+    "var a = [[1, 2, 3], [4, 5, 6]];\n  print(noisy(a) - a * noisy([1, 2]));",
+    "var a = [1, 2];\n  print(a + a * x);",
+    "var a = [1, 2];\n  print(a + a * print(a));"};
+  std::string functions = R"(def noisy(a) {
+  print(a);
+  a;
+}
+)";
+  for (const std::string& body : bodies) {
+    SourceFile source("program.d--", functions + "def main() {\n  " + body + "\n}\n");
+    Module module = Parser::parse(source, Scanner::scan(source));
+    ASSERT_FALSE(module.getDiagnostics().hasErrors()) << body;
+    std::vector<std::string> outputs;
+    size_t failures = 0;
+    for (int i = 0; i < 3; i++) {
+      std::stringstream out;
+      try {
+	if (i == 0) {
+	  Interpreter(module, out, Fusion::Disabled).run();
+	} else if (i == 1) {
+	  Interpreter(module, out).run();
+	} else {
+	  BytecodeModule program = BytecodeModule::compile(module);
+	  BytecodeVM(program, out).run();
+	}
+      } catch (const InterpreterError& e) {
+	failures += 1;
+	out << source.getLocation(e.getOffset()).str() << ": " << e.what();
+      }
+      outputs.push_back(out.str());
+    }
+    ASSERT_EQ(failures, 3u) << body;
+    ASSERT_EQ(outputs[1], outputs[0]) << body;
+    ASSERT_EQ(outputs[2], outputs[0]) << body;
+  }
+}
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+#include "tensor.h"
+
+static std::string runProgram(const std::string& inputBuffer) {
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  std::stringstream out;
+  Interpreter(module, out).run();
+  return out.str();
+}
+
+TEST(InterpreterTests, TestRunsMain) {
+  std::string inputBuffer = R"(
+def scale(a, factor) {
+  a * factor;
+}
+def main() {
+  var a = [[1, 2, 3], [4, 5, 6]];
+  var b<2, 3> = [1, 2, 3, 4, 5, 6];
+  print(transpose(a) * transpose(b));
+  print(scale(a, 2) - 1 + b / 4);
+  print(a % 4);
+  var c<3, 2> = a;
+  print(c);
+  c = [c, c];
+  print(transpose(c));
+  print(7 % 3);
+}
+)";
+  std::string expected =
+    "[[1, 16], [4, 25], [9, 36]]\n"
+    "[[1.25, 3.5, 5.75], [8, 10.25, 12.5]]\n"
+    "[[1, 2, 3], [0, 1, 2]]\n"
+    "[[1, 2], [3, 4], [5, 6]]\n"
+    "[[[1, 1], [3, 3], [5, 5]], [[2, 2], [4, 4], [6, 6]]]\n"
+    "1\n";
+  ASSERT_EQ(runProgram(inputBuffer), expected);
+}
+
+TEST(InterpreterTests, TestTensorsAreSharedNotCopied) {
+  Tensor tensor = Tensor::fromValues({2, 2}, {1, 2, 3, 4});
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(tensor.data()) % Tensor::Alignment, 0u);
+  Tensor reshaped = tensor.reshape({4});
+  ASSERT_EQ(reshaped.data(), tensor.data());
+  ASSERT_EQ(tensor.getUseCount(), 2u);
+  ASSERT_THROW(tensor.reshape({3}), std::runtime_error);
+
+  std::string inputBuffer = R"(
+def id(a) {
+  var b<4> = a;
+  b;
+}
+def main() {
+  print(id([[1, 2], [3, 4]]));
+}
+)";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  std::stringstream out;
+  Interpreter interp(module, out);
+  std::optional<Tensor> result = interp.call(Symbol("id"), {tensor});
+  ASSERT_TRUE(result.has_value());
+  ASSERT_EQ(result->data(), tensor.data());
+  ASSERT_EQ(result->getShape(), std::vector<size_t>{4});
+  ASSERT_EQ(tensor.getUseCount(), 3u);
+  result.reset();
+  ASSERT_EQ(tensor.getUseCount(), 2u);
+  ASSERT_FALSE(interp.call(Symbol("main"), {}).has_value());
+  ASSERT_THROW(interp.call(Symbol("id"), {}), std::runtime_error);
+}
+
+TEST(InterpreterTests, TestExternFunctions) {
+  std::string inputBuffer = R"(
+extern sum(a)
+def main() {
+  print(sum([1, 2, 3]) * 2);
+}
+)";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  std::stringstream out;
+  Interpreter interp(module, out);
+  ASSERT_THROW(interp.run(), InterpreterError);
+  interp.defineExtern(Symbol("sum"), [](const std::vector<Tensor>& args) {
+    double total = 0;
+    for (size_t i = 0; i < args[0].size(); i++) {
+      total += args[0].data()[i];
+    }
+    return Tensor::scalar(total);
+  });
+  interp.run();
+  ASSERT_EQ(out.str(), "12\n");
+}
+
+TEST(InterpreterTests, TestRuntimeErrors) {
+  std::vector<std::pair<std::string, std::string>> cases = {
+    {"var a = [[1, 2, 3], [4, 5, 6]];\n  print(a * transpose(a));", "4:11: operands of '*' have shapes <2, 3> and <3, 2>"},
+    {"var a<4> = [1, 2, 3];", "3:3: cannot reshape a value of shape <3> to <4>"},
+    {"var a<2.5> = 1;", "3:9: dimension must be a positive integer"},
+    {"print([[1, 2], [1]]);", "3:18: array entry has shape <1> but the previous entries have shape <2>"},
+    {"print(x);", "3:9: unknown variable 'x'"},
+    {"missing(1);", "3:3: unknown function 'missing'"},
+    {"print(1, 2);", "3:3: 'print' expects 1 argument but got 2"},
+    {"var a = print(1) + 1;", "3:11: expression has no value"},
+    {"loop(1);", "1:15: call depth exceeds 1000"}};
+  for (const auto& [body, expected] : cases) {
+    SourceFile source("errors.d--", "def loop(a) { loop(a); }\ndef main() {\n  " + body + "\n}\n");
+    Module module = Parser::parse(source, Scanner::scan(source));
+    ASSERT_FALSE(module.getDiagnostics().hasErrors()) << body;
+    std::stringstream out;
+    try {
+      Interpreter(module, out).run();
+      FAIL() << body;
+    } catch (const InterpreterError& e) {
+      ASSERT_EQ(source.getLocation(e.getOffset()).str() + ": " + e.what(), expected);
+    }
+  }
+}
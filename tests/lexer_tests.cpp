@@ -1,5 +1,11 @@
 #include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "char_scan.h"
+#include "line_table.h"
 #include "lexer.h"
+#include "source_file.h"
+#include "token_stream.h"
 #include "token_constraint.h"
 
 TEST(LexerTests, TestValidBuffer) {
@@ -96,3 +102,239 @@ def main() {
 )";
   ASSERT_THROW(Scanner::scan(inputBuffer), std::runtime_error);
 }
+
+TEST(LexerTests, TestKeywords) {
+  std::string inputBuffer = "extern exter externs def var vary ex1";
+  std::vector<LexToken> expectedOutput = {{LexToken(TokenType::Extern)},
+					  {LexToken(TokenType::Identifier, "exter")},
+					  {LexToken(TokenType::Identifier, "externs")},
+					  {LexToken(TokenType::Def)},
+					  {LexToken(TokenType::Var)},
+					  {LexToken(TokenType::Identifier, "vary")},
+					  {LexToken(TokenType::Identifier, "ex1")},
+					  {LexToken(TokenType::Eof)}};
+
+  std::vector<LexToken> actualOutput = Scanner::scan(inputBuffer);
+  ASSERT_TRUE(TokenConstraint::SatisfiedBy(actualOutput, expectedOutput));
+}
+
+TEST(LexerTests, TestOperators) {
+  std::string inputBuffer = "a+b-c*d/e%f";
+  std::vector<LexToken> expectedOutput;
+  for (size_t i = 0; i < inputBuffer.size(); i++) {
+    TokenType type = (i % 2 == 1) ? TokenType::Operator : TokenType::Identifier;
+    expectedOutput.push_back(LexToken(type, std::string_view(inputBuffer).substr(i, 1)));
+  }
+  expectedOutput.push_back(LexToken(TokenType::Eof));
+
+  std::vector<LexToken> actualOutput = Scanner::scan(inputBuffer);
+  ASSERT_TRUE(TokenConstraint::SatisfiedBy(actualOutput, expectedOutput));
+}
+
+TEST(LexerTests, TestCompactTokens) {
+  SourceFile source("compact.d--", "var abc<2> = [1.5, 2]; # trailing comment\n");
+  std::vector<LexToken> expectedOutput = {{LexToken(TokenType::Var)},
+					  {LexToken(TokenType::Identifier, "abc")},
+					  {LexToken(TokenType::LeftAngle)},
+					  {LexToken(TokenType::Number, "2")},
+					  {LexToken(TokenType::RightAngle)},
+					  {LexToken(TokenType::Equal)},
+					  {LexToken(TokenType::LeftSquare)},
+					  {LexToken(TokenType::Number, "1.5")},
+					  {LexToken(TokenType::Comma)},
+					  {LexToken(TokenType::Number, "2")},
+					  {LexToken(TokenType::RightSquare)},
+					  {LexToken(TokenType::Semicolon)},
+					  {LexToken(TokenType::Eof)}};
+
+  std::vector<Token> compactTokens = Scanner::scan(source);
+  std::vector<LexToken> actualOutput;
+  for (const Token& token : compactTokens) {
+    actualOutput.push_back(source.getToken(token));
+  }
+  ASSERT_TRUE(TokenConstraint::SatisfiedBy(actualOutput, expectedOutput));
+  ASSERT_EQ(compactTokens[1].Offset, 4u);
+  ASSERT_EQ(compactTokens[1].Length, 3u);
+  ASSERT_EQ(source.getText().data() + compactTokens[1].Offset, source.getStr(compactTokens[1]).data());
+}
+
+TEST(LexerTests, TestMappedSourceFile) {
+  std::string text = "def main() {\n  # comment\n  print(1);\n};\n";
+  char path[] = "/tmp/lexer_testsXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, text.data(), text.size()), (ssize_t)text.size());
+  close(fd);
+
+  SourceFile mapped = SourceFile::open(path);
+  unlink(path);
+  SourceFile inMemory("memory.d--", text);
+  ASSERT_TRUE(mapped.isMapped());
+  ASSERT_EQ(mapped.getText(), inMemory.getText());
+
+  std::vector<Token> mappedTokens = Scanner::scan(mapped);
+  std::vector<Token> inMemoryTokens = Scanner::scan(inMemory);
+  ASSERT_EQ(mappedTokens.size(), inMemoryTokens.size());
+  for (size_t i = 0; i < mappedTokens.size(); i++) {
+    ASSERT_TRUE(mapped.getToken(mappedTokens[i]) == inMemory.getToken(inMemoryTokens[i]));
+  }
+  ASSERT_THROW(SourceFile::open("/nonexistent/file.d--"), std::runtime_error);
+}
+
+TEST(LexerTests, TestCharScanImplsAgree) {
+  std::string inputBuffer;
+  for (size_t i = 0; i < 300; i++) {
+    inputBuffer += std::string(i % 37, ' ') + "\t\v# comment " + std::to_string(i);
+    inputBuffer += (i % 3 == 0) ? "\r\n" : (i % 3 == 1) ? "\f" : "\n";
+    inputBuffer += "x = " + std::to_string(i) + ";\xc3\xa9";
+  }
+  CharScanImpl previous = getCharScanImpl();
+  std::vector<size_t> expectedWhitespace;
+  std::vector<size_t> expectedLineEnd;
+  setCharScanImpl(CharScanImpl::Scalar);
+  for (size_t pos = 0; pos <= inputBuffer.length(); pos++) {
+    expectedWhitespace.push_back(skipWhitespace(inputBuffer, pos));
+    expectedLineEnd.push_back(skipToLineEnd(inputBuffer, pos));
+  }
+  for (CharScanImpl impl : {CharScanImpl::SSE2, CharScanImpl::AVX2}) {
+    if (!isCharScanImplSupported(impl)) {
+      continue;
+    }
+    setCharScanImpl(impl);
+    for (size_t pos = 0; pos <= inputBuffer.length(); pos++) {
+      ASSERT_EQ(skipWhitespace(inputBuffer, pos), expectedWhitespace[pos]);
+      ASSERT_EQ(skipToLineEnd(inputBuffer, pos), expectedLineEnd[pos]);
+    }
+    for (size_t length = 0; length <= inputBuffer.length(); length += 7) {
+      setCharScanImpl(CharScanImpl::Scalar);
+      size_t expectedNewlines = countNewlines(std::string_view(inputBuffer).substr(0, length));
+      setCharScanImpl(impl);
+      ASSERT_EQ(countNewlines(std::string_view(inputBuffer).substr(0, length)), expectedNewlines);
+    }
+  }
+  setCharScanImpl(previous);
+}
+
+TEST(LexerTests, TestNumberValues) {
+  std::string inputBuffer = "1 1.5 2. 007 123456789.125 0.1";
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  std::vector<double> expectedValues = {1, 1.5, 2, 7, 123456789.125, 0.1};
+  ASSERT_EQ(tokens.size(), expectedValues.size() + 1);
+  for (size_t i = 0; i < expectedValues.size(); i++) {
+    ASSERT_EQ(tokens[i].getType(), TokenType::Number);
+    ASSERT_EQ(tokens[i].getNumber(), expectedValues[i]);
+  }
+  SourceFile source("numbers.d--", inputBuffer);
+  std::vector<Token> compactTokens = Scanner::scan(source);
+  ASSERT_EQ(source.getToken(compactTokens[1]).getNumber(), 1.5);
+}
+
+TEST(LexerTests, TestStreamingScannerAgrees) {
+  std::string inputBuffer;
+  for (size_t i = 0; i < 200; i++) {
+    inputBuffer += "def f" + std::to_string(i) + "(abc, d) {  # comment " + std::to_string(i) + "\n";
+    inputBuffer += "  var externx" + std::to_string(i) + "<2> = [" + std::to_string(i * 1.25) + ", 3];\n}\n";
+  }
+  std::vector<LexToken> expected = Scanner::scan(inputBuffer);
+  // Chunks of one byte and of odd sizes force tokens, whitespace runs and
+  // comments to straddle chunk boundaries.
+  for (size_t chunkSize : {1, 3, 7, 64, 4096}) {
+    StringChunkReader reader(inputBuffer);
+    ScannerTokenStream stream(reader, chunkSize);
+    for (size_t i = 0; i < expected.size(); i++) {
+      LexToken token = stream.next();
+      ASSERT_TRUE(token == expected[i]) << "chunk size " << chunkSize << ", token " << i;
+      ASSERT_EQ(token.getNumber(), expected[i].getNumber());
+    }
+    ASSERT_EQ(stream.peek(3).getType(), TokenType::Eof);
+  }
+  StringChunkReader invalidReader("a = 1;\n$");
+  ScannerTokenStream invalidStream(invalidReader, 2);
+  for (size_t i = 0; i < 4; i++) {
+    invalidStream.next();
+  }
+  ASSERT_THROW(invalidStream.next(), std::runtime_error);
+}
+
+TEST(LexerTests, TestParallelScanAgrees) {
+  std::string inputBuffer;
+  for (size_t i = 0; i < 8000; i++) {
+    inputBuffer += "# comment " + std::to_string(i) + " def [ ; \r\n";
+    inputBuffer += "def f" + std::to_string(i) + "(a) {\fvar b<2> = [1.5, " + std::to_string(i) + "];\n\n}\n";
+  }
+  SourceFile source("parallel.d--", inputBuffer);
+  std::vector<Token> expected = Scanner::scan(source);
+  std::vector<LexToken> expectedLex = Scanner::scan(inputBuffer);
+  for (unsigned numThreads : {1, 2, 5, 16}) {
+    std::vector<Token> actual = Scanner::scanParallel(source, numThreads);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      ASSERT_EQ(actual[i].Type, expected[i].Type);
+      ASSERT_EQ(actual[i].Offset, expected[i].Offset);
+      ASSERT_EQ(actual[i].Length, expected[i].Length);
+    }
+    ASSERT_TRUE(Scanner::scanParallel(inputBuffer, numThreads) == expectedLex);
+  }
+  // The first invalid lexeme in source order is reported, as scan does.
+  std::string invalid = inputBuffer;
+  invalid[invalid.find("def f3000")] = '$';
+  invalid[invalid.find("def f6000")] = '@';
+  std::string expectedMessage;
+  try {
+    Scanner::scan(invalid);
+  } catch (const std::runtime_error& e) {
+    expectedMessage = e.what();
+  }
+  ASSERT_FALSE(expectedMessage.empty());
+  try {
+    Scanner::scanParallel(invalid, 8);
+    FAIL() << "expected an invalid lexeme";
+  } catch (const std::runtime_error& e) {
+    ASSERT_EQ(expectedMessage, e.what());
+  }
+}
+
+TEST(LexerTests, TestSourceLocations) {
+  std::string inputBuffer = "def f(a) {\r\n  # comment\n\n  var b = [1, 2];\n}\nextern g(x)";
+  LineTable lines(inputBuffer);
+  ASSERT_EQ(lines.getNumLines(), 6u);
+  for (size_t offset = 0; offset <= inputBuffer.length(); offset++) {
+    SourceLocation expected = LineTable::locate(inputBuffer, offset);
+    SourceLocation actual = lines.getLocation(offset);
+    ASSERT_EQ(actual.Line, expected.Line);
+    ASSERT_EQ(actual.Column, expected.Column);
+  }
+  SourceFile source("locations.d--", inputBuffer);
+  std::vector<Token> compactTokens = Scanner::scan(source);
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  ASSERT_EQ(tokens.size(), compactTokens.size());
+  for (size_t i = 0; i < tokens.size(); i++) {
+    ASSERT_EQ(tokens[i].getOffset(), compactTokens[i].Offset);
+    ASSERT_EQ(source.getToken(compactTokens[i]).getOffset(), compactTokens[i].Offset);
+  }
+  // "var" starts line 4, column 3; "extern" starts line 6.
+  SourceLocation var = source.getLocation(tokens[6].getOffset());
+  ASSERT_EQ(tokens[6].getType(), TokenType::Var);
+  ASSERT_EQ(var.str(), "4:3");
+  ASSERT_EQ(source.getLocation(inputBuffer.find("extern")).str(), "6:1");
+
+  std::string invalid = "def f(a) {\n  var b = [1, 2];\n  b = b $ 2;\n}\n";
+  std::string message;
+  try {
+    Scanner::scan(invalid);
+  } catch (const std::runtime_error& e) {
+    message = e.what();
+  }
+  ASSERT_EQ(message, "3:9: Invalid lexeme $");
+  for (size_t chunkSize : {1, 5, 4096}) {
+    StringChunkReader reader(invalid);
+    ScannerTokenStream stream(reader, chunkSize);
+    try {
+      while (stream.next().getType() != TokenType::Eof) {
+      }
+      FAIL() << "expected an invalid lexeme";
+    } catch (const std::runtime_error& e) {
+      ASSERT_EQ(std::string(e.what()), message) << "chunk size " << chunkSize;
+    }
+  }
+}
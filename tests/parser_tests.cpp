@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
+#include <map>
 #include "lexer.h"
+#include "ast_visitor.h"
+#include "hash_cons.h"
+#include "incremental_parser.h"
 #include "parser.h"
+#include "source_file.h"
+#include "test_utils.h"
 #include "utils.h"
 
 TEST(ParserTests, TestValidBuffer) {
@@ -65,3 +71,451 @@ b
 
   ASSERT_TRUE(expectedAST == actualAST);
 }
+
+TEST(ParserTests, TestArenaAndHeapAllocationAgree) {
+  std::string inputBuffer = R"(
+extern scale(a)
+def main() {
+  var a<2, 2> = [1, 2, 3, 4];
+  a = scale(a) * 2 + a;
+  print(a);
+}
+)";
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  Module arenaModule = Parser::parse(tokens, NodeAllocation::Arena);
+  Module heapModule = Parser::parse(tokens, NodeAllocation::Heap);
+  ASSERT_NE(arenaModule.getArena(), nullptr);
+  ASSERT_EQ(heapModule.getArena(), nullptr);
+  ASSERT_GT(arenaModule.getArena()->getBytesAllocated(), 0u);
+  ASSERT_EQ(arenaModule.size(), 2u);
+  ASSERT_TRUE(sameDefinitions(arenaModule, heapModule));
+}
+
+// Counts every node reachable from a definition, by kind.
+class NodeCounter : public ConstASTVisitor<NodeCounter> {
+public:
+  std::map<NodeKind, size_t> Counts;
+
+  void visitVariableExprNode(const VariableExprNode& node) {
+    Counts[node.getKind()] += 1;
+    for (const auto& arg : node.getArgs()) {
+      visit(*arg);
+    }
+  }
+
+  void visitBinaryExprNode(const BinaryExprNode& node) {
+    Counts[node.getKind()] += 1;
+    visit(node.getLHS());
+    visit(node.getRHS());
+  }
+
+  void visitConstantTensorNode(const ConstantTensorNode& node) {
+    Counts[node.getKind()] += 1;
+  }
+
+  void visitArrayExprNode(const ArrayExprNode& node) {
+    Counts[node.getKind()] += 1;
+    for (const auto& entry : node.getEntries()) {
+      visit(*entry);
+    }
+  }
+
+  void visitAssgnNode(const AssgnNode& node) {
+    Counts[node.getKind()] += 1;
+    visit(node.getExpr());
+  }
+
+  void visitFunctionNode(const FunctionNode& node) {
+    Counts[node.getKind()] += 1;
+    visit(node.getPrototype());
+    for (const auto& stmt : node.getBody()) {
+      visit(*stmt);
+    }
+  }
+
+  void visitNode(const Node& node) {
+    Counts[node.getKind()] += 1;
+  }
+};
+
+TEST(ParserTests, TestKindCastsAndVisitor) {
+  std::string inputBuffer = R"(
+def main() {
+  var a = [1, 2];
+  print(a * (a + 1));
+}
+)";
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  Module module = Parser::parse(tokens);
+  ASSERT_EQ(module.size(), 1u);
+  Node& def = *module[0];
+  ASSERT_TRUE(isa<FunctionNode>(def));
+  ASSERT_FALSE(isa<StmtNode>(def));
+  ASSERT_EQ(dyn_cast<PrototypeNode>(&def), nullptr);
+  FunctionNode& func = cast<FunctionNode>(def);
+  ASSERT_EQ(func.getPrototype().getName(), Symbol("main"));
+  ASSERT_TRUE(isa<AssgnNode>(*func.getBody()[0]));
+  ASSERT_TRUE(isa<ExprNode>(*func.getBody()[1]));
+
+  NodeCounter counter;
+  counter.visit(def);
+  ASSERT_EQ(counter.Counts[NodeKind::Function], 1u);
+  ASSERT_EQ(counter.Counts[NodeKind::Prototype], 1u);
+  ASSERT_EQ(counter.Counts[NodeKind::Assgn], 1u);
+  ASSERT_EQ(counter.Counts[NodeKind::ConstantTensorExpr], 1u);
+  ASSERT_EQ(counter.Counts[NodeKind::NumberExpr], 1u);
+  ASSERT_EQ(counter.Counts[NodeKind::VariableExpr], 3u);
+  ASSERT_EQ(counter.Counts[NodeKind::BinaryExpr], 2u);
+}
+
+TEST(ParserTests, TestConstantTensorLiterals) {
+  std::string inputBuffer = R"(
+def main() {
+  var a = [[1, 2, 3], [4, 5, 6]];
+  var b = [[1, 2], [x, 3]];
+  var c = [[1, 2], 3];
+}
+)";
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  Module module = Parser::parse(tokens);
+  FunctionNode& func = cast<FunctionNode>(*module[0]);
+
+  auto* a = dyn_cast<ConstantTensorNode>(&cast<AssgnNode>(*func.getBody()[0]).getExpr());
+  ASSERT_NE(a, nullptr);
+  ASSERT_EQ(a->getShape(), (std::vector<size_t>{2, 3}));
+  ASSERT_EQ(a->getValues(), (std::vector<double>{1, 2, 3, 4, 5, 6}));
+
+  auto* b = dyn_cast<ArrayExprNode>(&cast<AssgnNode>(*func.getBody()[1]).getExpr());
+  ASSERT_NE(b, nullptr);
+  ASSERT_TRUE(isa<ConstantTensorNode>(*b->getEntries()[0]));
+  auto* bRow = dyn_cast<ArrayExprNode>(b->getEntries()[1].get());
+  ASSERT_NE(bRow, nullptr);
+  ASSERT_TRUE(isa<VariableExprNode>(*bRow->getEntries()[0]));
+  ASSERT_TRUE(isa<NumberExprNode>(*bRow->getEntries()[1]));
+
+  auto* c = dyn_cast<ArrayExprNode>(&cast<AssgnNode>(*func.getBody()[2]).getExpr());
+  ASSERT_NE(c, nullptr);
+  ASSERT_TRUE(isa<ConstantTensorNode>(*c->getEntries()[0]));
+  ASSERT_TRUE(isa<NumberExprNode>(*c->getEntries()[1]));
+
+  auto expected = ArrayExprNode(make_vector<ExprNode>(
+    std::make_unique<ArrayExprNode>(make_vector<ExprNode>(std::make_unique<NumberExprNode>(1),
+							  std::make_unique<NumberExprNode>(2),
+							  std::make_unique<NumberExprNode>(3))),
+    std::make_unique<ArrayExprNode>(make_vector<ExprNode>(std::make_unique<NumberExprNode>(4),
+							  std::make_unique<NumberExprNode>(5),
+							  std::make_unique<NumberExprNode>(6)))));
+  ASSERT_TRUE(expected == *a);
+  ASSERT_TRUE(*a == expected);
+  ASSERT_FALSE(*a == *b);
+}
+
+TEST(ParserTests, TestStreamingParseAgrees) {
+  std::string inputBuffer = R"(
+extern scale(a)
+def main() {
+  var a<2, 2> = [1, 2, 3, 4];
+  a = scale(a) * 2;
+  print([a, [1, 2]]);
+}
+def other(x) {
+  x;
+}
+)";
+  Module expected = Parser::parse(Scanner::scan(inputBuffer), NodeAllocation::Heap);
+  StringChunkReader reader(inputBuffer, 5);
+  ScannerTokenStream stream(reader, 5);
+  Parser parser(stream);
+  size_t count = 0;
+  while (std::unique_ptr<Node> definition = parser.parseDefinition()) {
+    ASSERT_LT(count, expected.size());
+    ASSERT_TRUE(*definition == *expected[count]);
+    count += 1;
+  }
+  ASSERT_EQ(count, expected.size());
+}
+
+TEST(ParserTests, TestParallelParseAgrees) {
+  std::string inputBuffer;
+  for (size_t i = 0; i < 500; i++) {
+    if (i % 7 == 0) {
+      inputBuffer += "extern ext" + std::to_string(i) + "(a, b)\n";
+    }
+    inputBuffer += "def f" + std::to_string(i) + "(a) {\n  var b = [[" + std::to_string(i) + ", 2], [3, 4]];\n";
+    inputBuffer += "  print(b * a);\n}\n";
+  }
+  SourceFile source("parallel.d--", inputBuffer);
+  std::vector<Token> tokens = Scanner::scan(source);
+  Module expected = Parser::parse(source, tokens);
+  for (unsigned numThreads : {1, 2, 3, 8}) {
+    Module actual = Parser::parseParallel(source, tokens, numThreads);
+    ASSERT_TRUE(sameDefinitions(actual, expected));
+  }
+  // Syntax errors are recovered from at the next definition; the parallel
+  // parse must report the same errors and keep the same definitions.
+  std::string broken = inputBuffer;
+  broken.insert(broken.find("def f300"), ") stray\n");
+  broken.insert(broken.find("print(b * a);", broken.find("def f100")), "var = ;\n");
+  SourceFile brokenSource("broken.d--", broken);
+  std::vector<Token> brokenTokens = Scanner::scan(brokenSource);
+  Module brokenSequential = Parser::parse(brokenSource, brokenTokens);
+  Module brokenParallel = Parser::parseParallel(brokenSource, brokenTokens, 4);
+  ASSERT_EQ(brokenSequential.size(), expected.size());
+  ASSERT_EQ(brokenParallel.size(), expected.size());
+  ASSERT_TRUE(sameDefinitions(brokenParallel, brokenSequential));
+  const auto& sequentialDiags = brokenSequential.getDiagnostics().getDiagnostics();
+  const auto& parallelDiags = brokenParallel.getDiagnostics().getDiagnostics();
+  ASSERT_EQ(sequentialDiags.size(), 2u);
+  ASSERT_EQ(parallelDiags.size(), 2u);
+  for (size_t i = 0; i < sequentialDiags.size(); i++) {
+    ASSERT_EQ(parallelDiags[i].Offset, sequentialDiags[i].Offset);
+    ASSERT_EQ(parallelDiags[i].Message, sequentialDiags[i].Message);
+  }
+}
+
+static std::unique_ptr<ExprNode> var(const char* name) {
+  return std::make_unique<VariableExprNode>(Symbol(name), std::vector<std::unique_ptr<ExprNode>>());
+}
+
+static std::unique_ptr<ExprNode> binary(Op op, std::unique_ptr<ExprNode> lhs, std::unique_ptr<ExprNode> rhs) {
+  return std::make_unique<BinaryExprNode>(op, std::move(lhs), std::move(rhs));
+}
+
+static const ExprNode& firstAssignedExpr(Module& module) {
+  const auto& function = cast<FunctionNode>(*module[0]);
+  return cast<AssgnNode>(*function.getBody()[0]).getExpr();
+}
+
+TEST(ParserTests, TestOperatorPrecedence) {
+  Module module = Parser::parse(Scanner::scan("def main() { r = a + b * c - d / e + f * (g - h); }"));
+  // ((a + (b * c)) - (d / e)) + (f * (g - h))
+  std::unique_ptr<ExprNode> expected =
+    binary(Op::Plus,
+	   binary(Op::Minus,
+		  binary(Op::Plus, var("a"), binary(Op::Times, var("b"), var("c"))),
+		  binary(Op::Divide, var("d"), var("e"))),
+	   binary(Op::Times, var("f"), binary(Op::Minus, var("g"), var("h"))));
+  ASSERT_TRUE(firstAssignedExpr(module) == *expected);
+
+  Module leftAssoc = Parser::parse(Scanner::scan("def main() { r = a - b - c; }"));
+  std::unique_ptr<ExprNode> expectedLeft = binary(Op::Minus, binary(Op::Minus, var("a"), var("b")), var("c"));
+  ASSERT_TRUE(firstAssignedExpr(leftAssoc) == *expectedLeft);
+}
+
+TEST(ParserTests, TestLongExpressionChain) {
+  const size_t numTerms = 20000;
+  std::string inputBuffer = "def main() { r = a0";
+  for (size_t i = 1; i < numTerms; i++) {
+    inputBuffer += (i % 2 == 0) ? " + a" : " * a";
+    inputBuffer += std::to_string(i);
+  }
+  inputBuffer += "; }";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  ASSERT_EQ(module.size(), 1u);
+  // a0 * a1 + a2 * a3 + ... folds into a left spine of additions whose
+  // right operands are the products.
+  const ExprNode* expr = &firstAssignedExpr(module);
+  size_t additions = 0;
+  while (const auto* binaryExpr = dyn_cast<BinaryExprNode>(expr)) {
+    if (binaryExpr->getOp() != Op::Plus) {
+      break;
+    }
+    ASSERT_EQ(binaryExpr->getRHS().getKind(), NodeKind::BinaryExpr);
+    additions += 1;
+    expr = &binaryExpr->getLHS();
+  }
+  ASSERT_EQ(additions, numTerms / 2 - 1);
+}
+
+TEST(ParserTests, TestLongLeftSpineTeardown) {
+  // A single left-associative operator nests one node per operand, deeper
+  // than recursive destruction could go on the default stack.
+  const size_t numTerms = 100000;
+  std::string inputBuffer = "def main() { r = a";
+  for (size_t i = 1; i < numTerms; i++) {
+    inputBuffer += " + a";
+  }
+  inputBuffer += "; }";
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  for (NodeAllocation allocation : {NodeAllocation::Arena, NodeAllocation::Heap}) {
+    Module module = Parser::parse(tokens, allocation);
+    ASSERT_EQ(module.size(), 1u);
+    ASSERT_FALSE(module.getDiagnostics().hasErrors());
+  }
+}
+
+TEST(ParserTests, TestNodeOffsets) {
+  std::string inputBuffer = "extern g(x)\ndef main() {\n  var a = [1, 2];\n  a = g(a) + 1;\n}\n";
+  SourceFile source("offsets.d--", inputBuffer);
+  std::vector<Token> tokens = Scanner::scan(source);
+  for (NodeAllocation allocation : {NodeAllocation::Arena, NodeAllocation::Heap}) {
+    Module module = Parser::parse(source, tokens, allocation);
+    ASSERT_EQ(module.size(), 2u);
+    ASSERT_EQ(source.getLocation(module[0]->getOffset()).str(), "1:8");
+    const auto& function = cast<FunctionNode>(*module[1]);
+    ASSERT_EQ(source.getLocation(function.getOffset()).str(), "2:1");
+    ASSERT_EQ(source.getLocation(function.getPrototype().getOffset()).str(), "2:5");
+    const auto& decl = cast<AssgnNode>(*function.getBody()[0]);
+    ASSERT_EQ(source.getLocation(decl.getOffset()).str(), "3:3");
+    ASSERT_EQ(source.getLocation(decl.getExpr().getOffset()).str(), "3:11");
+    const auto& sum = cast<BinaryExprNode>(cast<AssgnNode>(*function.getBody()[1]).getExpr());
+    ASSERT_EQ(source.getLocation(sum.getOffset()).str(), "4:12");
+    ASSERT_EQ(source.getLocation(sum.getLHS().getOffset()).str(), "4:7");
+    ASSERT_EQ(source.getLocation(sum.getRHS().getOffset()).str(), "4:14");
+  }
+}
+
+TEST(ParserTests, TestErrorRecovery) {
+  std::string inputBuffer = R"(def ok1(a) {
+  print(a);
+};
+def bad1(a) {
+  var = 1;
+  a = (a + ;
+  print(a);
+}
+extern ext(
+def ok2(b) {
+  b;
+}
+) }
+def bad2(c) {
+  c = c * 2
+}
+def ok3() {
+  print([1, 2]);
+}
+)";
+  SourceFile source("broken.d--", inputBuffer);
+  Module module = Parser::parse(source, Scanner::scan(source));
+  DiagnosticEngine& diags = module.getDiagnostics();
+  std::vector<std::string> expected = {
+    "5:7: expected identifier but found '='",
+    "6:12: expected expression but found ';'",
+    "10:1: expected ')' but found 'def'",
+    "13:1: expected 'def' or 'extern' but found ')'",
+    "16:1: expected ';' but found '}'"};
+  ASSERT_EQ(diags.getNumErrors(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    const Diagnostic& diagnostic = diags.getDiagnostics()[i];
+    ASSERT_EQ(source.getLocation(diagnostic.Offset).str() + ": " + diagnostic.Message, expected[i]);
+  }
+  // Statement-level errors keep the rest of the body; the definitions that
+  // failed outright are dropped.
+  std::vector<std::string> names;
+  for (auto& definition : module) {
+    if (auto* function = dyn_cast<FunctionNode>(definition.get())) {
+      names.push_back(std::string(function->getPrototype().getName().str()));
+    }
+  }
+  ASSERT_EQ(names, (std::vector<std::string>{"ok1", "bad1", "ok2", "bad2", "ok3"}));
+  ASSERT_EQ(cast<FunctionNode>(*module[1]).getBody().size(), 1u);
+
+  // Inputs that end in the middle of a construct still terminate.
+  for (std::string truncated : {"def f(", "def f(a) { var b = [1, 2", "extern", "def f(a) { a = ", ") ) ;", "def"}) {
+    Module partial = Parser::parse(Scanner::scan(truncated));
+    ASSERT_TRUE(partial.getDiagnostics().hasErrors()) << truncated;
+  }
+}
+
+static bool matchesFullParse(const IncrementalParser& incremental) {
+  Module module = Parser::parse(Scanner::scan(incremental.getText()), NodeAllocation::Heap);
+  return sameDefinitions(incremental.getDefinitions(), module);
+}
+
+TEST(ParserTests, TestIncrementalReparse) {
+  std::vector<std::string> functions;
+  for (size_t i = 0; i < 30; i++) {
+    functions.push_back("def f" + std::to_string(i) + "(a, b) {\n  var x<2> = [1, " + std::to_string(i) +
+			"];\n  print(x * a + b);\n}\n");
+  }
+  auto join = [&functions]() {
+    std::string text = "# header\nextern g(a)\n";
+    for (const std::string& function : functions) {
+      text += function;
+    }
+    return text;
+  };
+  IncrementalParser incremental;
+  incremental.update(join());
+  ASSERT_EQ(incremental.getNumReparsed(), incremental.getNumSpans());
+  ASSERT_EQ(incremental.getDefinitions().size(), 31u);
+  ASSERT_TRUE(matchesFullParse(incremental));
+
+  // Editing one body reparses only that definition and keeps the others.
+  std::vector<const Node*> before = incremental.getDefinitions();
+  functions[12] = "def f12(a, b) {\n  var x<2> = [1, 2];\n  print(transpose(x) - a);\n}\n";
+  incremental.update(join());
+  ASSERT_EQ(incremental.getNumReparsed(), 1u);
+  std::vector<const Node*> after = incremental.getDefinitions();
+  ASSERT_EQ(after.size(), before.size());
+  for (size_t i = 0; i < after.size(); i++) {
+    ASSERT_EQ(after[i] == before[i], i != 13) << i;
+  }
+  ASSERT_TRUE(matchesFullParse(incremental));
+
+  // Offsets within a span are relative to its start.
+  size_t span = 14;
+  ASSERT_EQ(incremental.getDefinition(span)->getOffset(), 0u);
+  ASSERT_EQ(incremental.getText().compare(incremental.getSpanStart(span), 7, "def f12"), 0);
+
+  functions.insert(functions.begin() + 5, "def inserted() {\n  print(1);\n}\n");
+  incremental.update(join());
+  ASSERT_TRUE(matchesFullParse(incremental));
+  functions.erase(functions.begin() + 20);
+  incremental.update(join());
+  ASSERT_TRUE(matchesFullParse(incremental));
+
+  // Commenting out a definition header, or joining it to the previous
+  // definition, reaches past the edited span.
+  std::string text = join();
+  size_t header = text.find("def f3(");
+  incremental.update(text.substr(0, header) + "# " + text.substr(header));
+  ASSERT_TRUE(matchesFullParse(incremental));
+  incremental.update(text.substr(0, header - 1) + text.substr(header));
+  ASSERT_TRUE(matchesFullParse(incremental));
+
+  // Errors are reported at offsets into the whole text and go away once fixed.
+  size_t body = text.find("print", text.find("def f7("));
+  incremental.update(text.substr(0, body) + "var = ;\n  " + text.substr(body));
+  DiagnosticEngine diags = incremental.collectDiagnostics();
+  ASSERT_EQ(diags.getNumErrors(), 1u);
+  ASSERT_EQ(diags.getDiagnostics()[0].Offset, body + 4);
+  incremental.update(text);
+  ASSERT_FALSE(incremental.collectDiagnostics().hasErrors());
+  ASSERT_TRUE(matchesFullParse(incremental));
+
+  ASSERT_THROW(incremental.update(text + "$"), std::runtime_error);
+  ASSERT_EQ(incremental.getText(), text);
+}
+
+TEST(ParserTests, TestStructuralHash) {
+  std::string inputBuffer = "def f(a) {\n  var x = (a + 1) * (a + 1);\n  print(a + 1);\n}\n";
+  Module first = Parser::parse(Scanner::scan(inputBuffer));
+  Module second = Parser::parse(Scanner::scan(inputBuffer), NodeAllocation::Heap);
+  ASSERT_EQ(first[0]->getHash(), second[0]->getHash());
+  ASSERT_TRUE(*first[0] == *second[0]);
+  Module changed = Parser::parse(Scanner::scan("def f(a) {\n  var x = (a + 1) * (a + 2);\n  print(a + 1);\n}\n"));
+  ASSERT_NE(changed[0]->getHash(), first[0]->getHash());
+  ASSERT_FALSE(*changed[0] == *first[0]);
+
+  // Equal literals hash alike whichever node kind holds them.
+  ConstantTensorNode tensor({2, 2}, {1, 2, 3, 0});
+  ArrayExprNode array(make_vector<ExprNode>(
+    std::make_unique<ConstantTensorNode>(std::vector<size_t>{2}, std::vector<double>{1, 2}),
+    std::make_unique<ArrayExprNode>(make_vector<ExprNode>(std::make_unique<NumberExprNode>(3),
+							  std::make_unique<NumberExprNode>(-0.0)))));
+  ASSERT_TRUE(tensor == array);
+  ASSERT_EQ(tensor.getHash(), array.getHash());
+  ASSERT_NE(tensor.getHash(), ConstantTensorNode({4}, {1, 2, 3, 0}).getHash());
+
+  // The body holds 12 expressions (counting the implicit <1> size) of which
+  // 5 are distinct: a, 1, a + 1, the product and the print call.
+  HashConsTable table;
+  ASSERT_EQ(table.internExpressions(*first[0]), 7u);
+  ASSERT_EQ(table.size(), 5u);
+  const auto& body = cast<FunctionNode>(*first[0]).getBody();
+  const auto& product = cast<BinaryExprNode>(cast<AssgnNode>(*body[0]).getExpr());
+  ASSERT_EQ(table.intern(product.getRHS()), &product.getLHS());
+  ASSERT_EQ(table.internExpressions(*second[0]), 12u);
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "ast_serializer.h"
+#include "lexer.h"
+#include "parser.h"
+#include "test_utils.h"
+#include "utils.h"
+
+static const char* SampleSource = R"(extern scale(a, b)
+def main() {
+  var a<2, 3> = [[1, 2, 3], [4, 5, 6.5]];
+  var b = [[1, 2], [x, 3]];
+  a = scale(a, transpose(b)) * 2 - a / 4;
+  print([a, [1, 2]]);
+}
+def other(x) {
+  x;
+  (x + 1) * x;
+}
+)";
+
+TEST(SerializerTests, TestRoundTrip) {
+  Module module = Parser::parse(Scanner::scan(SampleSource));
+  std::string data = ASTSerializer::serialize(module, 42, 7);
+  ASSERT_EQ(ASTSerializer::readContentKey(data), std::make_pair(uint64_t(42), uint64_t(7)));
+  for (NodeAllocation allocation : {NodeAllocation::Arena, NodeAllocation::Heap}) {
+    Module loaded = ASTSerializer::deserialize(data, allocation);
+    ASSERT_TRUE(sameDefinitions(loaded, module));
+    // Node kinds and offsets are kept too, so writing it again gives the same
+    // bytes.
+    ASSERT_EQ(ASTSerializer::serialize(loaded, 42, 7), data);
+  }
+
+  std::string chain = "def f(a) {\n  a = 1";
+  for (size_t i = 0; i < 5000; i++) {
+    chain += " + a * 2";
+  }
+  chain += ";\n}\n";
+  Module chainModule = Parser::parse(Scanner::scan(chain));
+  ASSERT_TRUE(sameDefinitions(ASTSerializer::deserialize(ASTSerializer::serialize(chainModule)), chainModule));
+}
+
+TEST(SerializerTests, TestRejectsBadData) {
+  Module module = Parser::parse(Scanner::scan(SampleSource));
+  std::string data = ASTSerializer::serialize(module);
+  for (size_t length = 0; length < data.size(); length++) {
+    ASSERT_THROW(ASTSerializer::deserialize(data.substr(0, length)), std::runtime_error) << length;
+  }
+  std::string otherVersion = data;
+  otherVersion[8] += 1;
+  ASSERT_THROW(ASTSerializer::deserialize(otherVersion), std::runtime_error);
+  ASSERT_EQ(ASTSerializer::readContentKey(otherVersion), std::nullopt);
+  // Damaged bytes past the header are either rejected or still give a tree.
+  for (size_t pos = 64; pos < data.size(); pos++) {
+    std::string damaged = data;
+    damaged[pos] ^= 0x5a;
+    try {
+      ASTSerializer::deserialize(damaged);
+    } catch (const std::runtime_error&) {
+    }
+  }
+}
+
+TEST(SerializerTests, TestModuleCache) {
+  char dirTemplate[] = "/tmp/dmm_cache_XXXXXX";
+  ASSERT_NE(mkdtemp(dirTemplate), nullptr);
+  std::string dir = dirTemplate;
+  ModuleCache cache(dir + "/entries");
+  std::string text = SampleSource;
+  ASSERT_EQ(cache.load(text), std::nullopt);
+
+  Module module = Parser::parse(Scanner::scan(text));
+  cache.store(text, module);
+  std::optional<Module> cached = cache.load(text);
+  ASSERT_TRUE(cached.has_value());
+  ASSERT_TRUE(sameDefinitions(*cached, module));
+  ASSERT_EQ(cache.load(text + "\n"), std::nullopt);
+
+  std::string broken = "def f( {\n}\n";
+  cache.store(broken, Parser::parse(Scanner::scan(broken)));
+  ASSERT_EQ(cache.load(broken), std::nullopt);
+
+  // A damaged entry is a miss.
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.dast", (unsigned long long)hashBytes(text));
+  std::ofstream(dir + "/entries/" + name, std::ios::binary | std::ios::trunc) << "garbage";
+  ASSERT_EQ(cache.load(text), std::nullopt);
+  std::system(("rm -rf " + dir).c_str());
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "casting.h"
+#include "lexer.h"
+#include "parser.h"
+#include "shape_inference.h"
+#include "source_file.h"
+
+static const ExprNode& stmtExpr(const FunctionNode& function, size_t index) {
+  const StmtNode& stmt = *function.getBody()[index];
+  if (auto* assign = dyn_cast<AssgnNode>(&stmt)) {
+    return assign->getExpr();
+  }
+  return cast<ExprNode>(stmt);
+}
+
+static std::string shapeOf(const ShapeInference::Specialization& spec, const ExprNode& expr) {
+  const TensorShape* shape = spec.getShape(expr);
+  return (shape != nullptr) ? shape->str() : "none";
+}
+
+TEST(ShapeInferenceTests, TestBuiltinsAndReshape) {
+  std::string inputBuffer = R"(
+def main() {
+  var a = [[1, 2, 3], [4, 5, 6]];
+  var b<2, 3> = [1, 2, 3, 4, 5, 6];
+  var c = [a, b];
+  print(transpose(a) * transpose(b));
+  (a + 1) / 2;
+}
+)";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  DiagnosticEngine diags;
+  ShapeInference inference(module, diags);
+  inference.run();
+  ASSERT_FALSE(diags.hasErrors());
+  const auto& main = cast<FunctionNode>(*module[0]);
+  const ShapeInference::Specialization* spec = inference.specialize(Symbol("main"), {});
+  ASSERT_NE(spec, nullptr);
+  ASSERT_EQ(inference.getNumSpecializations(), 1u);
+  ASSERT_EQ(shapeOf(*spec, stmtExpr(main, 0)), "<2, 3>");
+  ASSERT_EQ(shapeOf(*spec, stmtExpr(main, 1)), "<6>");
+  ASSERT_EQ(shapeOf(*spec, stmtExpr(main, 2)), "<2, 2, 3>");
+  const auto& print = cast<VariableExprNode>(stmtExpr(main, 3));
+  ASSERT_EQ(shapeOf(*spec, print), "none");
+  ASSERT_EQ(shapeOf(*spec, *print.getArgs()[0]), "<3, 2>");
+  const auto& quotient = cast<BinaryExprNode>(stmtExpr(main, 4));
+  ASSERT_EQ(shapeOf(*spec, quotient), "<2, 3>");
+  ASSERT_EQ(shapeOf(*spec, quotient.getRHS()), "<>");
+  ASSERT_EQ(spec->Result, TensorShape({2, 3}));
+}
+
+TEST(ShapeInferenceTests, TestCallsAreSpecializedPerArgumentShapes) {
+  std::string inputBuffer = R"(
+extern load(name)
+def mul(a, b) {
+  a * transpose(b);
+}
+def describe(a) {
+  print(a);
+}
+def main() {
+  var x = mul([[1, 2], [3, 4], [5, 6]], [[1, 2, 3], [4, 5, 6]]);
+  var y = mul([1, 2], [3, 4]);
+  var z = mul([1, 2], [5, 6]);
+  var w = load(1) * x;
+  describe(x);
+}
+)";
+  Module module = Parser::parse(Scanner::scan(inputBuffer));
+  DiagnosticEngine diags;
+  ShapeInference inference(module, diags);
+  inference.run();
+  ASSERT_FALSE(diags.hasErrors());
+  // main, mul twice and describe once.
+  ASSERT_EQ(inference.getNumSpecializations(), 4u);
+  const auto& mul = cast<FunctionNode>(*module[1]);
+  const auto& main = cast<FunctionNode>(*module[3]);
+  const ShapeInference::Specialization& spec = inference.specialize(main, {});
+  ASSERT_EQ(shapeOf(spec, stmtExpr(main, 0)), "<3, 2>");
+  ASSERT_EQ(shapeOf(spec, stmtExpr(main, 1)), "<2>");
+  ASSERT_EQ(shapeOf(spec, stmtExpr(main, 3)), "<?>");
+  ASSERT_EQ(shapeOf(spec, stmtExpr(main, 4)), "none");
+
+  const auto* first = spec.getCallee(cast<VariableExprNode>(stmtExpr(main, 0)));
+  const auto* second = spec.getCallee(cast<VariableExprNode>(stmtExpr(main, 1)));
+  ASSERT_NE(first, nullptr);
+  ASSERT_EQ(&first->Function, &mul);
+  ASSERT_EQ(spec.getCallee(cast<VariableExprNode>(stmtExpr(main, 2))), second);
+  // The same body node has a different shape in each specialization.
+  const auto& product = cast<BinaryExprNode>(stmtExpr(mul, 0));
+  ASSERT_EQ(shapeOf(*first, product.getRHS()), "<3, 2>");
+  ASSERT_EQ(shapeOf(*second, product.getRHS()), "<2>");
+  ASSERT_EQ(spec.getCallee(cast<VariableExprNode>(cast<BinaryExprNode>(stmtExpr(main, 3)).getLHS())), nullptr);
+}
+
+TEST(ShapeInferenceTests, TestShapeErrors) {
+  std::string inputBuffer = R"(def id(a) {
+  a;
+}
+def grow(a) {
+  grow([a, a]);
+}
+def main() {
+  var a = [[1, 2, 3], [4, 5, 6]];
+  var b = a * transpose(a);
+  var c<4> = a;
+  var d = [[1, 2], [3, x]];
+  var e = [[1, 2], a];
+  id(a, a);
+  print(missing(a));
+  var f = print(a) + 1;
+  var g<0.5> = 1;
+  grow(a);
+}
+)";
+  SourceFile source("shapes.d--", inputBuffer);
+  Module module = Parser::parse(source, Scanner::scan(source));
+  ASSERT_FALSE(module.getDiagnostics().hasErrors());
+  DiagnosticEngine diags;
+  ShapeInference inference(module, diags);
+  inference.run();
+  std::vector<std::string> expected = {
+    "9:13: operands of '*' have shapes <2, 3> and <3, 2>",
+    "10:3: cannot reshape a value of shape <2, 3> to <4>",
+    "11:24: unknown variable 'x'",
+    "12:20: array entry has shape <2, 3> but the previous entries have shape <2>",
+    "13:3: 'id' expects 1 argument but got 2",
+    "14:9: unknown function 'missing'",
+    "15:11: expression has no value",
+    "16:9: dimension must be a positive integer"};
+  ASSERT_EQ(diags.getNumErrors(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    const Diagnostic& diagnostic = diags.getDiagnostics()[i];
+    ASSERT_EQ(source.getLocation(diagnostic.Offset).str() + ": " + diagnostic.Message, expected[i]);
+  }
+}
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "lexer.h"
+#include "symbol_table.h"
+
+TEST(SymbolTableTests, TestInternIsStable) {
+  Symbol transpose("transpose");
+  Symbol print("print");
+  std::string name = "trans";
+  name += "pose";
+  ASSERT_EQ(Symbol(name), transpose);
+  ASSERT_NE(transpose, print);
+  ASSERT_EQ(transpose.str(), "transpose");
+  ASSERT_EQ(Symbol().str(), "");
+  ASSERT_EQ(Symbol(""), Symbol());
+}
+
+TEST(SymbolTableTests, TestManySymbolsSurviveGrowth) {
+  std::vector<Symbol> symbols;
+  for (size_t i = 0; i < 20000; i++) {
+    symbols.emplace_back("sym" + std::to_string(i));
+  }
+  for (size_t i = 0; i < symbols.size(); i++) {
+    ASSERT_EQ(symbols[i].str(), "sym" + std::to_string(i));
+    ASSERT_EQ(Symbol("sym" + std::to_string(i)), symbols[i]);
+  }
+}
+
+TEST(SymbolTableTests, TestConcurrentIntern) {
+  const size_t numThreads = 4;
+  std::vector<std::vector<Symbol>> results(numThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([t, &results]() {
+      for (size_t i = 0; i < 5000; i++) {
+	results[t].emplace_back("shared" + std::to_string(i));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 1; t < numThreads; t++) {
+    ASSERT_EQ(results[t], results[0]);
+  }
+}
+
+TEST(SymbolTableTests, TestScannerInternsIdentifiers) {
+  std::string inputBuffer = "a b a";
+  std::vector<LexToken> tokens = Scanner::scan(inputBuffer);
+  ASSERT_EQ(tokens[0].getSymbol(), tokens[2].getSymbol());
+  ASSERT_NE(tokens[0].getSymbol(), tokens[1].getSymbol());
+  ASSERT_EQ(tokens[0].getSymbol(), Symbol("a"));
+}
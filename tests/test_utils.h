@@ -0,0 +1,120 @@
+#ifndef TEST_UTILS_H_
+#define TEST_UTILS_H_
+
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "parser.h"
+#include "tensor.h"
+
+// Whether two lists of definitions are structurally equal, in order.
+inline bool sameDefinitions(const std::vector<const Node*>& actual, const Module& expected) {
+  if (actual.size() != expected.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < expected.size(); i++) {
+    if (!(*actual[i] == *expected.getDefinitions()[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool sameDefinitions(const Module& actual, const Module& expected) {
+  std::vector<const Node*> definitions;
+  for (const auto& definition : actual.getDefinitions()) {
+    definitions.push_back(definition.get());
+  }
+  return sameDefinitions(definitions, expected);
+}
+
+// Programs that the evaluators run and compare with the Interpreter: these
+// functions and a main made of one of the bodies below.
+inline const char* const ProgramFunctions = R"(def scale(a, factor) {
+  a * factor;
+}
+def noValue(a) {
+  var b = a;
+}
+def last(a) {
+  var b = a + 1;
+  print(b);
+  transpose(b * 2);
+}
+def step(a, b) {
+  var c = a * b + a;
+  c = transpose(c) - 1;
+  scale(c, 0.5) + b % 3;
+}
+def loop(a) { loop(a); }
+)";
+
+// Bodies that run to completion.
+inline const std::vector<std::string> ProgramBodies = {
+  "var a = [[1, 2, 3], [4, 5, 6]];\n  var b<2, 3> = [1, 2, 3, 4, 5, 6];\n  print(transpose(a) * transpose(b));",
+  "var a = [[1, 2, 3], [4, 5, 6]];\n  print(scale(a, 2) - 1 + a / 4);\n  print(a % 4);\n  a = [a, a];\n  print(transpose(a));",
+  "var x = 3;\n  var y = [x, x * 2, scale(x, 3)];\n  var z<3, 1> = y;\n  print(z);\n  print(y);\n  print(7 % 3);",
+  "var a = [[1, 2], [3, 4]];\n  noValue(a);\n  print(step(a, transpose(a)));\n  print(step(2, 3));\n  print(last(a));",
+  "var a<2, 5, 10> = [[0, 1, 2, 3, 4, 5, 6, 7, 8, 9], [10, 11, 12, 13, 14, 15, 16, 17, 18, 19],\n"
+  "    [20, 21, 22, 23, 24, 25, 26, 27, 28, 29], [30, 31, 32, 33, 34, 35, 36, 37, 38, 39],\n"
+  "    [40, 41, 42, 43, 44, 45, 46, 47, 48, 49], [50, 51, 52, 53, 54, 55, 56, 57, 58, 59],\n"
+  "    [60, 61, 62, 63, 64, 65, 66, 67, 68, 69], [70, 71, 72, 73, 74, 75, 76, 77, 78, 79],\n"
+  "    [80, 81, 82, 83, 84, 85, 86, 87, 88, 89], [90, 91, 92, 93, 94, 95, 96, 97, 98, 99]];\n"
+  "  var b = transpose(a) * 2 + 1;\n  print(transpose(b) - a);\n  print(b);"};
+
+// Bodies that stop at a runtime error, after printing whatever comes first.
+// NativeEngine reports errors before running anything, so it has its own
+// cases.
+inline const std::vector<std::string> FailingProgramBodies = {
+  "print(noValue(1) + 1);",
+  "var a = [[1, 2, 3], [4, 5, 6]];\n  print(a * transpose(a));",
+  "var a<4> = [1, 2, 3];",
+  "var a<2.5> = 1;",
+  "var a = [1, 2];\n  print([a, [1]]);",
+  "print(x);\n  var x = 1;",
+  "var b = 2;\n  var c = [b, missing(b)];",
+  "print(1, 2);",
+  "print(scale(1));",
+  "loop(1);",
+  "print(last([1, 2]));\n  print(noValue(2));"};
+
+inline std::string makeProgram(const std::string& body) {
+  return std::string(ProgramFunctions) + "def main() {\n  " + body + "\n}\n";
+}
+
+// Trees of elementwise operators and transposes, for comparing fused and
+// unfused evaluation.
+inline const char* const ElementwiseFunctions = R"(def chain(a, b, c, d) {
+  a + b * c - d;
+}
+def mixed(a, b, c) {
+  var d = transpose(a * 2 + transpose(b)) - c % 3;
+  transpose(transpose(d) / (1 + a)) + 0.5;
+}
+)";
+
+// A tensor of the given shape filled with a repeating pattern that depends
+// on the seed.
+inline Tensor makeTensor(std::vector<size_t> shape, double seed) {
+  size_t count = 1;
+  for (size_t dim : shape) {
+    count *= dim;
+  }
+  std::vector<double> values(count);
+  for (size_t i = 0; i < count; i++) {
+    values[i] = (double)((i * 7 + (size_t)seed) % 23) - 11.5 + seed;
+  }
+  return Tensor::fromValues(std::move(shape), values);
+}
+
+// Checks the shapes and every element for exact equality.
+inline void expectSame(const Tensor& actual, const Tensor& expected) {
+  ASSERT_EQ(actual.getShape(), expected.getShape());
+  for (size_t i = 0; i < expected.size(); i++) {
+    ASSERT_EQ(actual.data()[i], expected.data()[i]) << i;
+  }
+}
+
+#endif